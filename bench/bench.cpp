@@ -0,0 +1,531 @@
+//
+// Created by Andrew on 5/4/2021.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <stb_image.h>
+#include <assimp/scene.h>
+
+#include "batch_geometry.h"
+#include "dynamic_vertex_buffer.h"
+#include "geometry.h"
+#include "job_system.h"
+#include "mesh.h"
+#include "scene.h"
+#include "shader.h"
+#include "triangle_bvh.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+// Keep the compiler from discarding a benchmarked result
+template<class T>
+inline void doNotOptimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "g"(&value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+struct BenchmarkResult {
+    string name;
+    unsigned long long iterations;
+    double ns_per_iteration; // Median over samples
+    double min_ns_per_iteration;
+    double items_per_second;
+};
+
+class BenchmarkRunner {
+public:
+    explicit BenchmarkRunner(double sample_seconds, unsigned int n_samples) :
+            sample_seconds(sample_seconds), n_samples(n_samples) {}
+
+    // Time fn, which processes items_per_iteration items per call. setup runs untimed before every sample
+    void run(const string &name, double items_per_iteration, const std::function<void()> &fn,
+             const std::function<void()> &setup=nullptr) {
+        // Calibrate the iteration count so one sample lasts about sample_seconds
+        unsigned long long iterations = 1;
+        while (true) {
+            if (setup) setup();
+            double seconds = timeIterations(fn, iterations);
+            if (seconds >= sample_seconds / 10.0 || iterations >= (1ull << 30)) {
+                iterations = std::max(1ull, static_cast<unsigned long long>(
+                        iterations * sample_seconds / std::max(seconds, 1e-9)));
+                break;
+            }
+            iterations *= 10;
+        }
+
+        vector<double> ns_per_iteration;
+        for (unsigned int i = 0; i < n_samples; ++i) {
+            if (setup) setup();
+            ns_per_iteration.push_back(timeIterations(fn, iterations) * 1e9 / static_cast<double>(iterations));
+        }
+        std::sort(ns_per_iteration.begin(), ns_per_iteration.end());
+        double median = ns_per_iteration[ns_per_iteration.size() / 2];
+
+        BenchmarkResult result{name, iterations, median, ns_per_iteration.front(),
+                               items_per_iteration * 1e9 / median};
+        cerr << name << ": " << median << " ns/iter, " << result.items_per_second << " items/s" << endl;
+        results.push_back(result);
+    }
+
+    void writeJSON(std::ostream &out) const {
+        out << "{\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult &result = results[i];
+            out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name << "\""
+                << ", \"iterations\": " << result.iterations
+                << ", \"ns_per_iteration\": " << result.ns_per_iteration
+                << ", \"min_ns_per_iteration\": " << result.min_ns_per_iteration
+                << ", \"items_per_second\": " << result.items_per_second << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    double sample_seconds;
+    unsigned int n_samples;
+    vector<BenchmarkResult> results;
+
+    static double timeIterations(const std::function<void()> &fn, unsigned long long iterations) {
+        auto begin = std::chrono::steady_clock::now();
+        for (unsigned long long i = 0; i < iterations; ++i)
+            fn();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+};
+
+// Friend of Scene, gives the benchmarks access to the private import stages
+class SceneBenchmark {
+public:
+    static Mesh processMesh(Scene &scene, aiMesh *mesh) {
+        return scene.processMesh(mesh, nullptr, false);
+    }
+    static void readMesh(const aiMesh *mesh, vector<Mesh::Vertex> &vertices, vector<unsigned int> &indices) {
+        Scene::readMesh(mesh, vertices, indices);
+    }
+};
+
+// Square grid of (n+1)^2 vertices and 2n^2 triangles, as Assimp would hand it over after triangulation
+std::unique_ptr<aiMesh> makeGridAiMesh(unsigned int n) {
+    std::unique_ptr<aiMesh> mesh(new aiMesh());
+    unsigned int n_vertices = (n + 1) * (n + 1);
+    mesh->mNumVertices = n_vertices;
+    mesh->mVertices = new aiVector3D[n_vertices];
+    mesh->mNormals = new aiVector3D[n_vertices];
+    mesh->mTextureCoords[0] = new aiVector3D[n_vertices];
+    for (unsigned int y = 0; y <= n; ++y) {
+        for (unsigned int x = 0; x <= n; ++x) {
+            unsigned int i = y * (n + 1) + x;
+            mesh->mVertices[i] = aiVector3D(static_cast<float>(x), 0.0f, static_cast<float>(y));
+            mesh->mNormals[i] = aiVector3D(0.0f, 1.0f, 0.0f);
+            mesh->mTextureCoords[0][i] = aiVector3D(static_cast<float>(x) / n, static_cast<float>(y) / n, 0.0f);
+        }
+    }
+    mesh->mNumFaces = 2 * n * n;
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    for (unsigned int y = 0, f = 0; y < n; ++y) {
+        for (unsigned int x = 0; x < n; ++x) {
+            unsigned int i = y * (n + 1) + x;
+            unsigned int quad[2][3] = {{i, i + n + 1, i + 1}, {i + 1, i + n + 1, i + n + 2}};
+            for (auto &triangle: quad) {
+                mesh->mFaces[f].mNumIndices = 3;
+                mesh->mFaces[f].mIndices = new unsigned int[3];
+                std::copy(triangle, triangle + 3, mesh->mFaces[f].mIndices);
+                ++f;
+            }
+        }
+    }
+    return mesh;
+}
+
+Mesh makeCubeMesh(const Eigen::Vector3f &offset) {
+    vector<Mesh::Vertex> vertices;
+    for (unsigned int i = 0; i < 8; ++i) {
+        Mesh::Vertex vertex;
+        Eigen::Vector3f corner((i & 1) ? 0.5f : -0.5f, (i & 2) ? 0.5f : -0.5f, (i & 4) ? 0.5f : -0.5f);
+        vertex.position = corner + offset;
+        vertex.normal = corner.normalized();
+        vertex.texture_coordinates = Eigen::Vector2f(corner[0] + 0.5f, corner[1] + 0.5f);
+        vertices.push_back(vertex);
+    }
+    vector<unsigned int> indices = {0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                                    2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5};
+    vector<Mesh::Texture> textures;
+    return Mesh(vertices, indices, textures);
+}
+
+// Uncompressed 24-bit TGA in memory, decodable by stb_image
+vector<unsigned char> makeTGA(unsigned int width, unsigned int height) {
+    vector<unsigned char> file(18 + width * height * 3);
+    file[2] = 2;
+    file[12] = width & 0xFF;
+    file[13] = (width >> 8) & 0xFF;
+    file[14] = height & 0xFF;
+    file[15] = (height >> 8) & 0xFF;
+    file[16] = 24;
+    for (size_t i = 18; i < file.size(); ++i)
+        file[i] = static_cast<unsigned char>(i * 31);
+    return file;
+}
+
+vector<unsigned char> readFile(const string &path) {
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open()) {
+        cerr << "Failed to open file: " << path << endl;
+        return {};
+    }
+    return vector<unsigned char>((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+}
+
+void benchmarkGeometry(BenchmarkRunner &runner, unsigned int n_points) {
+    Eigen::Vector3f position(1.0f, 2.0f, 3.0f);
+    Eigen::Vector3f target(0.0f, 0.0f, 0.0f);
+    Eigen::Vector3f up(0.0f, 1.0f, 0.0f);
+    runner.run("geometry/lookAt", 1, [&] {
+        position[0] += 1e-6f;
+        Eigen::Matrix4f view = lookAt(position, target, up);
+        doNotOptimize(view);
+    });
+
+    float fov = 1.0f;
+    runner.run("geometry/perspective", 1, [&] {
+        fov += 1e-7f;
+        Eigen::Matrix4f projection = perspective(fov, 16.0f / 9.0f, 0.1f, 1000.0f);
+        doNotOptimize(projection);
+    });
+
+    Eigen::Matrix4f transform = perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f) * lookAt(position, target, up);
+    Eigen::Matrix<float, 4, Eigen::Dynamic> points = Eigen::Matrix<float, 4, Eigen::Dynamic>::Random(4, n_points);
+    Eigen::Matrix<float, 4, Eigen::Dynamic> transformed(4, n_points);
+    runner.run("geometry/transform_points_" + std::to_string(n_points), n_points, [&] {
+        transformed.noalias() = transform * points;
+        doNotOptimize(transformed);
+    });
+
+    // The same work through the batch kernels, on every instruction set this CPU runs
+    PointsSoA soa_points, soa_transformed;
+    soa_points.resize(n_points);
+    BoundsSoA bounds, transformed_bounds;
+    bounds.resize(n_points);
+    SpheresSoA spheres;
+    spheres.resize(n_points);
+    for (unsigned int i = 0; i < n_points; ++i) {
+        soa_points.x[i] = bounds.min_x[i] = spheres.x[i] = points(0, i);
+        soa_points.y[i] = bounds.min_y[i] = spheres.y[i] = points(1, i);
+        soa_points.z[i] = bounds.min_z[i] = spheres.z[i] = points(2, i);
+        bounds.max_x[i] = bounds.min_x[i] + 0.1f;
+        bounds.max_y[i] = bounds.min_y[i] + 0.1f;
+        bounds.max_z[i] = bounds.min_z[i] + 0.1f;
+        spheres.radius[i] = 0.1f;
+    }
+    vector<float> w;
+    ScreenRectsSoA rects;
+    Eigen::Matrix4f model = Eigen::Affine3f(Eigen::AngleAxisf(0.5f, Eigen::Vector3f::UnitY())).matrix();
+    Eigen::Matrix4f view = lookAt(position, target, up);
+    Eigen::Matrix4f projection = perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+    SimdLevel detected = detectSimdLevel();
+    for (SimdLevel level: {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON}) {
+        if (!setSimdLevel(level))
+            continue;
+        string suffix = string("_") + simdLevelName(level) + "_" + std::to_string(n_points);
+        runner.run("geometry/batch_transform_points" + suffix, n_points, [&] {
+            transformPoints(transform, soa_points, soa_transformed, &w);
+            doNotOptimize(soa_transformed);
+        });
+        runner.run("geometry/batch_compute_bounds" + suffix, n_points, [&] {
+            Eigen::Vector3f min_corner, max_corner;
+            computeBounds(soa_points, min_corner, max_corner);
+            doNotOptimize(min_corner);
+            doNotOptimize(max_corner);
+        });
+        runner.run("geometry/batch_transform_bounds" + suffix, n_points, [&] {
+            transformBounds(model, bounds, transformed_bounds);
+            doNotOptimize(transformed_bounds);
+        });
+        runner.run("geometry/batch_project_spheres" + suffix, n_points, [&] {
+            projectSpheres(view, projection, spheres, rects);
+            doNotOptimize(rects);
+        });
+    }
+    setSimdLevel(detected);
+}
+
+void benchmarkTextureDecode(BenchmarkRunner &runner, const string &texture_path) {
+    vector<unsigned char> tga = makeTGA(1024, 1024);
+    runner.run("texture/decode_tga_1024", 1024.0 * 1024.0, [&] {
+        int width, height, n_channels;
+        unsigned char *pixels = stbi_load_from_memory(tga.data(), static_cast<int>(tga.size()),
+                                                      &width, &height, &n_channels, 0);
+        stbi_image_free(pixels);
+    });
+
+    if (texture_path.empty())
+        return;
+    vector<unsigned char> file = readFile(texture_path);
+    int width = 0, height = 0, n_channels = 0;
+    if (file.empty() || !stbi_info_from_memory(file.data(), static_cast<int>(file.size()),
+                                               &width, &height, &n_channels))
+        return;
+    runner.run("texture/decode_file", static_cast<double>(width) * height, [&] {
+        int w, h, n;
+        unsigned char *pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &w, &h, &n, 0);
+        stbi_image_free(pixels);
+    });
+}
+
+// Rolling height field of 2n^2 triangles, picked from above at random points
+void benchmarkRayQueries(BenchmarkRunner &runner, unsigned int grid_size) {
+    unsigned int n = grid_size;
+    vector<float> positions;
+    positions.reserve(static_cast<size_t>(n + 1) * (n + 1) * 3);
+    for (unsigned int y = 0; y <= n; ++y) {
+        for (unsigned int x = 0; x <= n; ++x) {
+            positions.push_back(static_cast<float>(x));
+            positions.push_back(4.0f * std::sin(x * 0.05f) * std::cos(y * 0.07f));
+            positions.push_back(static_cast<float>(y));
+        }
+    }
+    vector<unsigned int> indices;
+    indices.reserve(static_cast<size_t>(n) * n * 6);
+    for (unsigned int y = 0; y < n; ++y) {
+        for (unsigned int x = 0; x < n; ++x) {
+            unsigned int i = y * (n + 1) + x;
+            indices.insert(indices.end(), {i, i + n + 1, i + 1, i + 1, i + n + 1, i + n + 2});
+        }
+    }
+    TriangleSource source;
+    source.positions = positions.data();
+    source.indices = indices.data();
+    source.n_triangles = indices.size() / 3;
+    string suffix = "_" + std::to_string(source.n_triangles);
+
+    TriangleBvh bvh;
+    runner.run("bvh/build" + suffix, static_cast<double>(source.n_triangles), [&] {
+        bvh.build(source);
+    });
+
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> coordinate(0.0f, static_cast<float>(n)), tilt(-0.5f, 0.5f);
+    vector<Eigen::Vector3f> origins(1024), directions(1024);
+    for (size_t i = 0; i < origins.size(); ++i) {
+        origins[i] = Eigen::Vector3f(coordinate(random), 50.0f, coordinate(random));
+        directions[i] = Eigen::Vector3f(tilt(random), -1.0f, tilt(random)).normalized();
+    }
+    size_t ray = 0;
+    runner.run("bvh/closest_hit" + suffix, 1, [&] {
+        TriangleHit hit;
+        bool found = bvh.closestHit(source, origins[ray], directions[ray], INFINITY, hit);
+        ray = (ray + 1) % origins.size();
+        doNotOptimize(found);
+        doNotOptimize(hit);
+    });
+    runner.run("bvh/any_hit" + suffix, 1, [&] {
+        bool found = bvh.anyHit(source, origins[ray], directions[ray], INFINITY);
+        ray = (ray + 1) % origins.size();
+        doNotOptimize(found);
+    });
+    // A camera collision sphere falling onto the surface, a frame of walking takes a few of these
+    runner.run("bvh/sweep_sphere" + suffix, 1, [&] {
+        TriangleSweepHit hit;
+        Eigen::Vector3f center(origins[ray][0], 6.0f, origins[ray][2]);
+        bool found = bvh.sweepSphere(source, center, 0.2f, directions[ray] * 12.0f, 1.0f, hit);
+        ray = (ray + 1) % origins.size();
+        doNotOptimize(found);
+        doNotOptimize(hit);
+    });
+}
+
+// The CPU conversion of an imported mesh and the mesh creation after it, bounds plus the GL upload, apart
+void benchmarkImport(BenchmarkRunner &runner, unsigned int grid_size) {
+    std::unique_ptr<aiMesh> ai_mesh = makeGridAiMesh(grid_size);
+    string suffix = "_" + std::to_string(ai_mesh->mNumVertices) + "_vertices";
+    vector<Mesh::Vertex> vertices;
+    vector<unsigned int> indices;
+    runner.run("import/readMesh" + suffix, ai_mesh->mNumVertices, [&] {
+        vertices.clear();
+        indices.clear();
+        SceneBenchmark::readMesh(ai_mesh.get(), vertices, indices);
+        doNotOptimize(vertices.data());
+    });
+    vector<Mesh::Texture> textures;
+    runner.run("import/createMesh" + suffix, ai_mesh->mNumVertices, [&] {
+        Mesh mesh(vertices, indices, textures);
+        // The driver may copy the buffers lazily, count that copy too
+        glFinish();
+        mesh.release();
+    });
+}
+
+// Per-frame deformation of a grid: rebuilding the mesh against rewriting a dynamic mesh from another thread
+void benchmarkDynamicMesh(BenchmarkRunner &runner, unsigned int grid_size) {
+    std::unique_ptr<aiMesh> ai_mesh = makeGridAiMesh(grid_size);
+    Scene scene;
+    Mesh source = SceneBenchmark::processMesh(scene, ai_mesh.get());
+    vector<Mesh::Vertex> vertices = source.vertices;
+    vector<unsigned int> indices = source.indices;
+    vector<Mesh::Texture> textures;
+    source.release();
+
+    vector<Eigen::Vector3f> positions(vertices.size());
+    float phase = 0.0f;
+    auto deform = [&] {
+        phase += 0.1f;
+        for (unsigned int i = 0; i < vertices.size(); ++i) {
+            positions[i] = vertices[i].position;
+            positions[i][1] = std::sin(vertices[i].position[0] * 0.1f + phase);
+        }
+    };
+    string suffix = "_" + std::to_string(vertices.size()) + "_vertices";
+
+    runner.run("dynamic_mesh/recreate" + suffix, static_cast<double>(vertices.size()), [&] {
+        deform();
+        vector<Mesh::Vertex> deformed = vertices;
+        for (unsigned int i = 0; i < deformed.size(); ++i)
+            deformed[i].position = positions[i];
+        Mesh mesh(deformed, indices, textures);
+        mesh.draw_depth();
+        mesh.release();
+    }, [] {
+        glFinish();
+    });
+
+    // Written off the GL thread as in the viewer, on a worker started once so thread creation stays out of
+    // the timing
+    JobSystem &jobs = JobSystem::instance();
+    bool own_workers = !jobs.isRunning();
+    if (own_workers)
+        jobs.start(1);
+    Mesh dynamic_mesh(vertices, indices, textures, "dynamic grid", true);
+    runner.run("dynamic_mesh/update" + suffix, static_cast<double>(vertices.size()), [&] {
+        JobCounter counter;
+        jobs.run("deform", [&] {
+            deform();
+            DynamicVertexBuffer::Writer writer = dynamic_mesh.dynamicVertices()->beginWrite();
+            writer.setPositions(0, positions.data(), static_cast<unsigned int>(positions.size()));
+            writer.commit();
+        }, &counter);
+        jobs.wait(counter);
+        dynamic_mesh.draw_depth();
+    }, [] {
+        glFinish();
+    });
+    dynamic_mesh.release();
+    if (own_workers)
+        jobs.stop();
+}
+
+void benchmarkShader(BenchmarkRunner &runner, Shader &shader) {
+    shader.use();
+    Eigen::Matrix4f matrix = Eigen::Matrix4f::Identity();
+    runner.run("shader/setMat4", 1, [&] {
+        shader.setMat4("view", matrix);
+    });
+    runner.run("shader/setBool", 1, [&] {
+        shader.setBool("use_texture", true);
+    });
+    runner.run("shader/setInt", 1, [&] {
+        shader.setInt("texture1", 0);
+    });
+}
+
+void benchmarkDraw(BenchmarkRunner &runner, Shader &shader, unsigned int n_meshes) {
+    Scene scene;
+    for (unsigned int i = 0; i < n_meshes; ++i)
+        scene.addMesh(makeCubeMesh(Eigen::Vector3f(static_cast<float>(i % 100), static_cast<float>(i / 100), 0.0f)));
+
+    shader.use();
+    shader.setMat4("model", Eigen::Matrix4f::Identity());
+    shader.setMat4("view", lookAt(Eigen::Vector3f(50.0f, 50.0f, 100.0f), Eigen::Vector3f(50.0f, 50.0f, 0.0f),
+                                  Eigen::Vector3f(0.0f, 1.0f, 0.0f)));
+    shader.setMat4("projection", perspective(1.0f, 1.0f, 0.1f, 1000.0f));
+
+    // Only CPU submission is timed, the GPU drains between samples
+    runner.run("draw/scene_" + std::to_string(n_meshes) + "_meshes", n_meshes, [&] {
+        scene.draw(&shader);
+    }, [] {
+        glFinish();
+    });
+}
+
+int main(int argc, char** argv) {
+    cxxopts::Options options("Benchmarks");
+    options.add_options()
+        ("vertex", "Vertex shader path", cxxopts::value<string>()->default_value("../shaders/empty.vert"))
+        ("fragment", "Fragment shader path", cxxopts::value<string>()->default_value("../shaders/empty.frag"))
+        ("texture", "Optional image file to time decoding on", cxxopts::value<string>()->default_value(""))
+        ("output", "JSON result path, stdout when empty", cxxopts::value<string>()->default_value(""))
+        ("meshes", "Mesh count of the synthetic draw scene", cxxopts::value<unsigned int>()->default_value("1000"))
+        ("points", "Point count of batch transforms", cxxopts::value<unsigned int>()->default_value("100000"))
+        ("grid", "Grid resolution of the synthetic imported mesh", cxxopts::value<unsigned int>()->default_value("256"))
+        ("bvh-grid", "Grid resolution of the ray query height field",
+         cxxopts::value<unsigned int>()->default_value("1024"))
+        ("sample-time", "Seconds per sample", cxxopts::value<double>()->default_value("0.2"))
+        ("samples", "Samples per benchmark", cxxopts::value<unsigned int>()->default_value("5"))
+        ;
+    auto args = options.parse(argc, argv);
+
+    BenchmarkRunner runner(args["sample-time"].as<double>(), args["samples"].as<unsigned int>());
+
+    // CPU only benchmarks
+    benchmarkGeometry(runner, args["points"].as<unsigned int>());
+    benchmarkTextureDecode(runner, args["texture"].as<string>());
+    benchmarkRayQueries(runner, args["bvh-grid"].as<unsigned int>());
+
+    // Benchmarks needing a GL context, created offscreen
+    if (glfwInit()) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        GLFWwindow *window = glfwCreateWindow(64, 64, "Benchmarks", nullptr, nullptr);
+        if (window) {
+            glfwMakeContextCurrent(window);
+            if (gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+                Shader shader(args["vertex"].as<string>(), args["fragment"].as<string>());
+                benchmarkImport(runner, args["grid"].as<unsigned int>());
+                benchmarkDynamicMesh(runner, args["grid"].as<unsigned int>());
+                benchmarkShader(runner, shader);
+                benchmarkDraw(runner, shader, args["meshes"].as<unsigned int>());
+                shader.release();
+            } else {
+                cerr << "Failed to initialize GLAD" << endl;
+            }
+            glfwDestroyWindow(window);
+        } else {
+            cerr << "Failed to create offscreen context, skipping GL benchmarks" << endl;
+        }
+        glfwTerminate();
+    } else {
+        cerr << "Window manager initialization failed, skipping GL benchmarks" << endl;
+    }
+
+    string output_path = args["output"].as<string>();
+    if (output_path.empty()) {
+        runner.writeJSON(cout);
+    } else {
+        std::ofstream output(output_path);
+        runner.writeJSON(output);
+    }
+    return 0;
+}
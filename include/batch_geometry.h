@@ -0,0 +1,90 @@
+//
+// Created by Andrew on 5/27/2021.
+//
+
+#ifndef EMPTYGL_BATCH_GEOMETRY_H
+#define EMPTYGL_BATCH_GEOMETRY_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+using std::vector;
+
+// Batch geometry kernels over structure of arrays data. Every kernel has SSE2, AVX2 and NEON versions and a
+// scalar fallback; the widest one the CPU supports is picked at startup
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2, // With FMA
+    SIMD_NEON
+};
+
+// Widest instruction set this CPU runs
+SimdLevel detectSimdLevel();
+// Instruction set the kernels currently use
+SimdLevel simdLevel();
+// Force a narrower instruction set, for testing and benchmarking. False and unchanged if the CPU lacks it
+bool setSimdLevel(SimdLevel level);
+const char *simdLevelName(SimdLevel level);
+
+struct PointsSoA {
+    vector<float> x, y, z;
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n);
+};
+
+// Axis aligned boxes
+struct BoundsSoA {
+    vector<float> min_x, min_y, min_z;
+    vector<float> max_x, max_y, max_z;
+
+    size_t size() const { return min_x.size(); }
+    void resize(size_t n);
+};
+
+struct SpheresSoA {
+    vector<float> x, y, z, radius;
+
+    size_t size() const { return x.size(); }
+    void resize(size_t n);
+};
+
+enum SphereVisibility : unsigned char {
+    SPHERE_BEHIND,    // Entirely behind the near plane, no rect
+    SPHERE_PROJECTED, // In front of the near plane, the rect is exact
+    SPHERE_CLIPPED    // Crosses the near plane, the rect is the whole screen
+};
+
+// Normalized device coordinate rects, unclamped
+struct ScreenRectsSoA {
+    vector<float> min_x, min_y, max_x, max_y;
+    vector<SphereVisibility> visibility;
+
+    size_t size() const { return min_x.size(); }
+    void resize(size_t n);
+};
+
+// result = transform * (point, 1), w receives the fourth coordinate if given. result may be points
+void transformPoints(const Eigen::Matrix4f &transform, const PointsSoA &points, PointsSoA &result,
+                     vector<float> *w=nullptr);
+// False if there are no points
+bool computeBounds(const PointsSoA &points, Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner);
+// Boxes around the transformed boxes. The transform must be affine. result may be bounds
+void transformBounds(const Eigen::Matrix4f &transform, const BoundsSoA &bounds, BoundsSoA &result);
+// Screen rects of world space spheres. projection must be a perspective() matrix
+void projectSpheres(const Eigen::Matrix4f &view, const Eigen::Matrix4f &projection, const SpheresSoA &spheres,
+                    ScreenRectsSoA &result);
+// Ray against n triangles given as a corner and the two edges leaving it, in nine arrays: corner x, y, z, first
+// edge x, y, z, second edge x, y, z. Per triangle, distance receives the hit in multiples of direction, infinity
+// on a miss or behind the origin, and u, v the barycentric weights of the first and second edge ends. Takes raw
+// arrays so BVH leaves can be tested from stack storage
+void intersectTriangles(const Eigen::Vector3f &origin, const Eigen::Vector3f &direction,
+                        const float *const *triangles, size_t n, float *distance, float *u, float *v);
+// result[i] = dot(value i - origin, direction) over four channel arrays, e.g. the texels of a compressed block
+void projectChannels(const float *const *channels, const float origin[4], const float direction[4], size_t n,
+                     float *result);
+
+#endif //EMPTYGL_BATCH_GEOMETRY_H
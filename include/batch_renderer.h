@@ -0,0 +1,84 @@
+//
+// Created by Andrew on 4/30/2021.
+//
+
+#ifndef EMPTYGL_BATCH_RENDERER_H
+#define EMPTYGL_BATCH_RENDERER_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <glad/glad.h>
+
+#include "camera_path.h"
+#include "job_system.h"
+#include "multi_view_renderer.h"
+#include "scene.h"
+#include "shader.h"
+
+using std::string;
+using std::vector;
+
+// Encodes and writes read back frames in jobs
+class ImageWriter {
+public:
+    explicit ImageWriter(unsigned int max_pending=16);
+    // Waits for the images still pending
+    ~ImageWriter();
+    // Queue a bottom-up BGRA image for writing. Runs jobs while too many images are pending
+    void submit(const string &path, unsigned int width, unsigned int height, vector<unsigned char> &&pixels);
+    // Wait until every queued image is on disk
+    void flush();
+    // Images successfully written so far
+    unsigned int written() const { return n_written; }
+private:
+    struct Image {
+        string path;
+        unsigned int width, height;
+        vector<unsigned char> pixels;
+    };
+
+    JobCounter pending;
+    unsigned int max_pending;
+    std::atomic<unsigned int> n_written{0};
+
+    static bool writeTGA(const Image &image);
+};
+
+// Renders a list of camera poses into an offscreen framebuffer. Readback goes through a ring of
+// pixel buffer objects guarded by fences, so the GPU keeps rendering while older frames are copied out.
+// With n_views above one, consecutive poses are rendered together as the layers of a MultiViewRenderer
+class BatchRenderer {
+public:
+    BatchRenderer(unsigned int width, unsigned int height, unsigned int n_views=1);
+    ~BatchRenderer();
+    // Render every pose to <output_dir>/<index>.tga. Returns the number of images written. Single view only
+    unsigned int render(Scene *scene, Shader *shader, const vector<CameraPose> &poses, const string &output_dir);
+    // Same as above, n_views poses per pass with the multi-view permutations plus extra_features
+    unsigned int render(Scene *scene, ShaderVariants *variants, unsigned int extra_features,
+                        const vector<CameraPose> &poses, const string &output_dir);
+private:
+    static const unsigned int PBO_RING_SIZE = 3;
+
+    unsigned int width, height;
+    // 0 with multiple views
+    unsigned int FBO = 0, color_RBO = 0, depth_RBO = 0;
+    // PBO_RING_SIZE slots per view, so a whole pass is read back before the first slot is reused
+    vector<unsigned int> PBOs;
+    vector<GLsync> fences;
+    vector<string> pending_paths;
+    ImageWriter writer;
+    std::unique_ptr<MultiViewRenderer> multi_view;
+
+    // Copy the read framebuffer into the ring slot of an image, waiting for the slot if it is still in use
+    void readBack(unsigned int image_index, const string &output_dir);
+    // Wait for the readback in a ring slot and hand its pixels to the writer
+    void retire(unsigned int slot);
+    // Retire every slot still in flight, oldest first
+    void drain(unsigned int n_images);
+};
+
+#endif //EMPTYGL_BATCH_RENDERER_H
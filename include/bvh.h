@@ -0,0 +1,116 @@
+//
+// Created by Andrew on 6/11/2021.
+//
+
+#ifndef EMPTYGL_BVH_H
+#define EMPTYGL_BVH_H
+
+#include <cstddef>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+using std::vector;
+
+// Bounding volume hierarchy over axis aligned boxes, built with binned surface area heuristic splits. It only
+// knows the boxes: queries hand the primitives of the leaves they reach to a callback, which does the exact
+// test. TriangleBvh puts triangles in it, Scene puts whole meshes
+class Bvh {
+public:
+    static const unsigned int LEAF_SIZE = 8;
+
+    // Primitive i is bounded by boxes[i], empty boxes are left out. Large subtrees are built in parallel on
+    // the job system
+    void build(const vector<Eigen::AlignedBox3f> &boxes);
+    bool empty() const { return nodes.empty(); }
+    // False if empty
+    bool bounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) const;
+    // Nodes and primitive indices
+    size_t memoryBytes() const;
+
+    // Leaves whose box grown by radius the segment origin + t direction, t in [0, limit], passes through,
+    // nearer ones first. visit(const unsigned int *primitives, unsigned int count, float &limit) may lower
+    // the limit to skip everything beyond, and returns false to stop
+    template<class Visit>
+    void traverse(const Eigen::Vector3f &origin, const Eigen::Vector3f &direction, float radius, float limit,
+                  Visit &&visit) const;
+
+private:
+    // Leaves hold primitives [first, first + count). Inner nodes have count 0, their first child right after
+    // them and their second child at first
+    struct Node {
+        float min[3];
+        unsigned int first;
+        float max[3];
+        unsigned int count;
+    };
+    // Past this depth ranges are halved instead of binned, so the traversal stack has a fixed bound
+    static const unsigned int MAX_SAH_DEPTH = 64;
+    static const unsigned int STACK_SIZE = 128;
+
+    vector<Node> nodes;
+    // Primitive indices in leaf order
+    vector<unsigned int> primitives;
+
+    void buildNode(const vector<Eigen::AlignedBox3f> &boxes, unsigned int begin, unsigned int end,
+                   unsigned int depth, vector<Node> &out);
+};
+
+template<class Visit>
+void Bvh::traverse(const Eigen::Vector3f &origin, const Eigen::Vector3f &direction, float radius, float limit,
+                   Visit &&visit) const {
+    if (nodes.empty())
+        return;
+    // Axes the segment is parallel to divide to infinity. Comparisons are ordered so the NaN of a segment
+    // starting on such a slab is ignored
+    Eigen::Vector3f inverse = direction.cwiseInverse();
+    auto enter = [&](const Node &node, float &entry) {
+        float t_enter = 0.0f, t_exit = limit;
+        for (int a = 0; a < 3; ++a) {
+            float t0 = (node.min[a] - radius - origin[a]) * inverse[a];
+            float t1 = (node.max[a] + radius - origin[a]) * inverse[a];
+            float slab_enter = t0 < t1 ? t0 : t1, slab_exit = t0 < t1 ? t1 : t0;
+            t_enter = slab_enter > t_enter ? slab_enter : t_enter;
+            t_exit = slab_exit < t_exit ? slab_exit : t_exit;
+        }
+        entry = t_enter;
+        return t_enter <= t_exit;
+    };
+
+    struct Entry {
+        unsigned int node;
+        float distance;
+    };
+    Entry stack[STACK_SIZE];
+    unsigned int stack_size = 0;
+    float root_distance;
+    if (!enter(nodes[0], root_distance))
+        return;
+    stack[stack_size++] = Entry{0, root_distance};
+    while (stack_size > 0) {
+        Entry entry = stack[--stack_size];
+        // The limit was lowered since it was pushed
+        if (entry.distance > limit)
+            continue;
+        const Node &node = nodes[entry.node];
+        if (node.count > 0) {
+            if (!visit(&primitives[node.first], node.count, limit))
+                return;
+            continue;
+        }
+
+        // Nearer child on top, so it is searched first and what it finds cuts off the other
+        unsigned int children[2] = {entry.node + 1, node.first};
+        float child_distance[2];
+        bool child_hit[2] = {enter(nodes[children[0]], child_distance[0]),
+                             enter(nodes[children[1]], child_distance[1])};
+        int nearer = child_hit[0] && child_hit[1] && child_distance[1] < child_distance[0] ? 1 : 0;
+        for (int k: {1 - nearer, nearer}) {
+            if (child_hit[k])
+                stack[stack_size++] = Entry{children[k], child_distance[k]};
+        }
+    }
+}
+
+#endif //EMPTYGL_BVH_H
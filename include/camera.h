@@ -69,7 +69,7 @@ public:
     }
 
     // Returns the view matrix calculated using Euler Angles and the LookAt Matrix
-    Eigen::Matrix4f getViewMatrix();
+    Eigen::Matrix4f getViewMatrix() const;
 
     // Process input received from any keyboard-like input system
     // Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
@@ -83,6 +83,9 @@ public:
     // Only requires input on the vertical wheel-axis
     void processMouseScroll(float y_offset);
 
+    // Place the camera at an absolute pose, e.g. one read from a pose file
+    void setPose(const Vector3f &position, float yaw, float pitch);
+
 private:
     // Calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors();
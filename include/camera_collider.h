@@ -0,0 +1,53 @@
+//
+// Created by Andrew on 6/11/2021.
+//
+
+#ifndef EMPTYGL_CAMERA_COLLIDER_H
+#define EMPTYGL_CAMERA_COLLIDER_H
+
+#include <Eigen/Dense>
+
+#include "camera.h"
+#include "scene.h"
+
+enum CollisionMode {
+    COLLISION_FLY,
+    // Horizontal moves only, held eye_height above the floor, climbing steps and falling off ledges
+    COLLISION_WALK
+};
+
+// Keeps the camera out of the scene geometry. The camera is a sphere around the eye, and each frame's move
+// is swept through the scene BVHs and slid along whatever it touches, so it never passes through walls
+class CameraCollider {
+public:
+    CameraCollider(Scene *scene, CollisionMode mode, float radius=0.2f, float eye_height=1.7f);
+
+    // Placement of the scene, uniform scale only
+    void setModel(const Eigen::Matrix4f &model) { this->model = model; }
+    // After input moved the camera from previous_position, replace the move with the one the scene allows
+    void constrain(Camera *camera, const Eigen::Vector3f &previous_position, float delta_time);
+
+    // Tallest ledge walked onto without jumping
+    float max_step_height = 0.4f;
+    float gravity = 9.81f;
+    float terminal_speed = 50.0f;
+
+private:
+    // Sweeps before the rest of a move is dropped, enough for corners between a few walls
+    static const int MAX_SLIDES = 5;
+
+    Scene *scene;
+    CollisionMode mode;
+    float radius;
+    float eye_height;
+    Eigen::Matrix4f model = Eigen::Matrix4f::Identity();
+    float fall_speed = 0.0f;
+    bool grounded = false;
+
+    // Where a sphere at position ends up moving by motion, sliding along what it touches
+    Eigen::Vector3f slide(Eigen::Vector3f position, Eigen::Vector3f motion);
+    Eigen::Vector3f walk(const Eigen::Vector3f &up, const Eigen::Vector3f &previous_position,
+                         const Eigen::Vector3f &motion, float delta_time);
+};
+
+#endif //EMPTYGL_CAMERA_COLLIDER_H
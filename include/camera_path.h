@@ -0,0 +1,43 @@
+//
+// Created by Andrew on 5/6/2021.
+//
+
+#ifndef EMPTYGL_CAMERA_PATH_H
+#define EMPTYGL_CAMERA_PATH_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "camera.h"
+
+using std::string;
+using std::vector;
+
+// Absolute camera state. Angles and field of view are in degrees
+struct CameraPose {
+    Eigen::Vector3f position;
+    float yaw;
+    float pitch;
+    float fov;
+};
+
+CameraPose captureCameraPose(const Camera &camera);
+void applyCameraPose(const CameraPose &pose, Camera *camera);
+
+// Read poses from a text file, one "x y z yaw pitch fov" per line. Lines starting with '#' are skipped
+vector<CameraPose> loadCameraPoses(const string &path);
+
+// Appends the camera state of every frame to a pose file, replayable with loadCameraPoses
+class CameraPathRecorder {
+public:
+    bool open(const string &path);
+    bool isOpen() const { return stream.is_open(); }
+    void record(const Camera &camera);
+private:
+    std::ofstream stream;
+};
+
+#endif //EMPTYGL_CAMERA_PATH_H
@@ -0,0 +1,74 @@
+//
+// Created by Andrew on 6/6/2021.
+//
+
+#ifndef EMPTYGL_DRAW_LIST_H
+#define EMPTYGL_DRAW_LIST_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "frame_view.h"
+#include "ring_buffer.h"
+#include "scene.h"
+#include "shader.h"
+
+using std::vector;
+
+class DynamicVertexBuffer;
+
+// One recorded draw: plain handles and offsets, no GL calls until it is replayed
+struct DrawPacket {
+    static const unsigned int MAX_TEXTURES = 4;
+
+    unsigned int program = 0;
+    unsigned int vao = 0;
+    unsigned int index_count = 0;
+    // Dynamic meshes pick their vertex region when replayed
+    DynamicVertexBuffer *dynamic_vertices = nullptr;
+    // DrawData block in the draw buffer, size 0 when per-draw data comes from uniforms
+    size_t draw_data_offset = 0;
+    size_t draw_data_size = 0;
+    // Texture i goes to unit i, its sampler uniform is set to i unless the location is -1
+    unsigned int n_textures = 0;
+    unsigned int textures[MAX_TEXTURES] = {};
+    int sampler_locations[MAX_TEXTURES] = {};
+};
+
+struct DrawList {
+    vector<DrawPacket> packets;
+};
+
+// GL thread. Issue the lists in order as if they were one, skipping program and texture binds that are
+// already in place. draw_data_buffer holds the DrawData blocks packets point into
+void replayDrawLists(const vector<DrawList> &lists, unsigned int draw_data_buffer=0);
+
+// Records the draws of a scene into lists for disjoint ranges of the draw order in job system jobs, then
+// replays them on the GL thread. Culling and per-draw data writes happen while recording, so the GL
+// thread only merges and issues the packets
+class DrawListRecorder {
+public:
+    // GL thread. Scene::draw through recorded lists, culled against the view. With a draw buffer the
+    // per-draw data goes there as in the ring buffer overload of Scene::draw
+    void draw(Scene *scene, ShaderVariants *variants, DynamicRingBuffer *draw_buffer, const FrameView &view,
+              const Eigen::Matrix4f &model, unsigned int extra_features=0);
+
+    // Any thread. The recording half of draw(): fill lists with the draws of a scene, see
+    // Scene::prepareRecording and Scene::updateRecording
+    static void record(const Scene *scene, const SceneRecording &recording, vector<DrawList> &lists);
+    // GL thread. The replaying half of draw(), for lists recorded elsewhere without a draw buffer
+    void replay(const vector<DrawList> &lists, unsigned int draw_data_buffer=0);
+
+    // Packets replayed by the last draw() or replay()
+    size_t lastDrawCount() const { return n_draws; }
+
+private:
+    // Each a job of its own, fewer would leave threads idle and more would only add merging
+    static const unsigned int LISTS_PER_THREAD = 2;
+
+    vector<DrawList> lists;
+    size_t n_draws = 0;
+};
+
+#endif //EMPTYGL_DRAW_LIST_H
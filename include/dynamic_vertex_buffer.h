@@ -0,0 +1,109 @@
+//
+// Created by Andrew on 5/19/2021.
+//
+
+#ifndef EMPTYGL_DYNAMIC_VERTEX_BUFFER_H
+#define EMPTYGL_DYNAMIC_VERTEX_BUFFER_H
+
+#include <mutex>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <glad/glad.h>
+
+#include "mesh.h"
+
+using std::vector;
+
+// Vertex storage of a dynamic mesh, shared by every copy of the Mesh. Holds REGION_COUNT copies of the
+// vertices in one persistently mapped buffer: workers write the next copy while the GPU still draws from
+// older ones, and a fence per copy says when it may be written again. Without buffer storage the buffer
+// is orphaned and re-uploaded instead. Nothing here waits on the GPU.
+class DynamicVertexBuffer {
+public:
+    static const unsigned int REGION_COUNT = 3;
+
+    // Exclusive write access to the vertices, usable from any thread. Writes land in a CPU copy and
+    // become visible to draws on commit
+    class Writer {
+    public:
+        Writer(Writer &&) = default;
+        ~Writer();
+        unsigned int vertexCount() const;
+        void setPositions(unsigned int first, const Eigen::Vector3f *positions, unsigned int count);
+        void setNormals(unsigned int first, const Eigen::Vector3f *normals, unsigned int count);
+        void setVertices(unsigned int first, const Mesh::Vertex *vertices, unsigned int count);
+        // Copy the changed range into a region the GPU is done with and publish it for the next draw.
+        // While every region is still in flight the copy is left to the draw that frees one
+        void commit();
+    private:
+        friend class DynamicVertexBuffer;
+        DynamicVertexBuffer *owner;
+        std::unique_lock<std::mutex> lock;
+        unsigned int dirty_begin, dirty_end;
+
+        Writer(DynamicVertexBuffer *owner);
+        void markDirty(unsigned int first, unsigned int count);
+    };
+
+    // GL thread only
+    explicit DynamicVertexBuffer(const vector<Mesh::Vertex> &vertices);
+    void release();
+    // Pick up the newest committed vertices and recycle regions whose fence passed. Call before drawing
+    void prepareDraw();
+    // Fence the region drawn from. Call after drawing
+    void fenceDraw();
+    // Added to the indices, selects the region drawn from
+    int baseVertex() const { return static_cast<int>(current * vertex_count); }
+    unsigned int bufferID() const { return buffer; }
+    bool isPersistent() const { return mapped != nullptr; }
+    MemoryUsage memoryUsage() const;
+
+    // Any thread. Only one writer exists at a time, further calls block until it is gone. Don't draw the
+    // mesh on a thread that holds a writer
+    Writer beginWrite();
+    // Any thread. Box around the most recently committed vertices, for culling
+    void bounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner);
+
+private:
+    enum RegionState {
+        REGION_FREE,    // Not used by the GPU, may be written
+        REGION_WRITING, // A writer copies into it
+        REGION_READY,   // Written, drawn from on the next prepareDraw
+        REGION_CURRENT, // Drawn from
+        REGION_RETIRED  // Replaced, waits for its fence
+    };
+    struct Range {
+        unsigned int begin = 0, end = 0;
+        void add(unsigned int b, unsigned int e);
+    };
+
+    unsigned int buffer = 0;
+    unsigned int vertex_count;
+    Mesh::Vertex *mapped = nullptr;
+
+    // Latest vertices, owned by the active writer
+    std::mutex writer_mutex;
+    vector<Mesh::Vertex> shadow;
+
+    std::mutex state_mutex;
+    RegionState states[REGION_COUNT];
+    Range stale[REGION_COUNT]; // Ranges committed since the region was last written
+    GLsync fences[REGION_COUNT] = {};
+    unsigned int current = 0;
+    bool copy_deferred = false; // A commit found no writable region
+    Eigen::Vector3f committed_min = Eigen::Vector3f::Zero(), committed_max = Eigen::Vector3f::Zero();
+
+    // Orphaning fallback, the committed vertices waiting for upload
+    vector<Mesh::Vertex> staging;
+    bool upload_pending = false;
+
+    void commit(unsigned int dirty_begin, unsigned int dirty_end);
+    // Box around the shadow. Needs writer_mutex
+    void shadowBounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) const;
+    unsigned int writableRegion() const;
+    // Copy the stale part of the shadow into region. Needs writer_mutex and a region nobody else touches
+    void copyToRegion(unsigned int region);
+};
+
+#endif //EMPTYGL_DYNAMIC_VERTEX_BUFFER_H
@@ -0,0 +1,19 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#ifndef EMPTYGL_FILE_UTIL_H
+#define EMPTYGL_FILE_UTIL_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+using std::string;
+
+// Write a binary file under a temporary name no other writer uses, then rename it into place. Concurrent
+// processes filling the same cache never read a partial file or clobber each other's temporary. write
+// returns false, or leaves the stream failed, to give up without touching path
+bool writeFileAtomically(const string &path, const std::function<bool(std::ostream &)> &write);
+
+#endif //EMPTYGL_FILE_UTIL_H
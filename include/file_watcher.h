@@ -0,0 +1,45 @@
+//
+// Created by Andrew on 5/12/2021.
+//
+
+#ifndef EMPTYGL_FILE_WATCHER_H
+#define EMPTYGL_FILE_WATCHER_H
+
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Reports modified files without blocking. Uses inotify on Linux and falls back to polling
+// modification times elsewhere
+class FileWatcher {
+public:
+    FileWatcher();
+    ~FileWatcher();
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    void watch(const string &path);
+    // Watched paths changed since the last call, as passed to watch()
+    vector<string> poll();
+
+private:
+    // Normalized absolute path -> path as given by the caller
+    std::map<string, string> watched_files;
+#ifdef __linux__
+    int inotify_fd = -1;
+    // Watch descriptor -> normalized directory. Directories are watched so editors that save by
+    // renaming a temporary file over the original are still noticed
+    std::map<int, string> watched_directories;
+#else
+    std::map<string, std::filesystem::file_time_type> modification_times;
+#endif
+
+    static string normalize(const string &path);
+};
+
+#endif //EMPTYGL_FILE_WATCHER_H
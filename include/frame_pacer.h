@@ -0,0 +1,65 @@
+//
+// Created by Andrew on 6/4/2021.
+//
+
+#ifndef EMPTYGL_FRAME_PACER_H
+#define EMPTYGL_FRAME_PACER_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "frame_stats.h"
+
+// Keeps the driver from queueing frames ahead of the display, which is what makes a fast viewer feel
+// laggy. A fence after every swap bounds the frames in flight, an optional frame-rate cap spaces frames
+// out, and input is meant to be sampled only after beginFrame() returned, as late as possible. Latency is
+// measured from input sampling to a GPU timestamp written right after the swap, so it does not depend on
+// when the pacer gets around to checking the fence
+class FramePacer {
+public:
+    // 0 frames in flight or 0 fps leave that limit off
+    explicit FramePacer(unsigned int max_frames_in_flight=0, float max_fps=0.0f);
+    // GL thread
+    ~FramePacer();
+    FramePacer(const FramePacer &) = delete;
+    FramePacer &operator=(const FramePacer &) = delete;
+
+    // GL thread, before sampling input. Waits until fewer than max_frames_in_flight swaps are unfinished,
+    // then until the frame-rate cap allows the next frame
+    void beginFrame();
+    // GL thread, right after the swap. input_time_ns is the Profiler::now() time the frame's input was read,
+    // 0 for frames showing no new input, which are left out of the latency statistics
+    void endFrame(uint64_t input_time_ns);
+
+    // Input to present, in milliseconds
+    const FrameTimeStats &latencyStats() const { return latency; }
+
+private:
+    // Sleeping is only trusted up to this close to the deadline, the rest is spun
+    static const uint64_t SPIN_NS = 2000000;
+
+    struct PendingFrame {
+        GLsync fence;
+        unsigned int timestamp_query; // 0 for frames without input time
+        uint64_t input_time_ns;
+    };
+
+    unsigned int max_frames_in_flight;
+    uint64_t frame_period_ns;
+    uint64_t next_frame_ns = 0;
+    std::deque<PendingFrame> pending;
+    std::vector<unsigned int> free_queries;
+    // Profiler::now() minus GL_TIMESTAMP, measured on the first frame
+    int64_t gpu_clock_offset = 0;
+    bool gpu_calibrated = false;
+    FrameTimeStats latency;
+
+    // Record and drop the oldest pending frame once it finished, waiting for it if asked to
+    bool retire(bool wait);
+    void waitUntil(uint64_t time_ns) const;
+};
+
+#endif //EMPTYGL_FRAME_PACER_H
@@ -0,0 +1,33 @@
+//
+// Created by Andrew on 5/6/2021.
+//
+
+#ifndef EMPTYGL_FRAME_STATS_H
+#define EMPTYGL_FRAME_STATS_H
+
+#include <chrono>
+#include <ostream>
+#include <vector>
+
+using std::vector;
+
+// Collects frame times and summarizes them as percentiles and a histogram
+class FrameTimeStats {
+public:
+    // Mark a frame boundary. The first call only starts the clock
+    void tick();
+    void addFrameTime(double milliseconds);
+    size_t frameCount() const { return frame_times.size(); }
+
+    double average() const;
+    // p in [0, 100], nearest rank
+    double percentile(double p) const;
+    // Print average, p50/p95/p99 and a histogram with bucket_ms wide buckets
+    void report(std::ostream &out, double bucket_ms=1.0, unsigned int n_buckets=34) const;
+private:
+    vector<double> frame_times; // Milliseconds
+    std::chrono::steady_clock::time_point last_tick;
+    bool started = false;
+};
+
+#endif //EMPTYGL_FRAME_STATS_H
@@ -0,0 +1,70 @@
+//
+// Created by Andrew on 5/28/2021.
+//
+
+#ifndef EMPTYGL_FRAME_VIEW_H
+#define EMPTYGL_FRAME_VIEW_H
+
+#include <array>
+#include <cstdint>
+
+#include <Eigen/Dense>
+
+#include "camera.h"
+#include "geometry.h"
+
+// Everything derived from the camera and viewport that a frame needs, computed once and only again when
+// either changes. Culling, shadows and LOD read the same view, and can skip their own per view work while
+// version() stays the same
+class FrameView {
+public:
+    explicit FrameView(float z_near=0.1f, float z_far=1000.0f);
+
+    // Rebuild if the camera pose, field of view or viewport changed since the last call. True if it did
+    bool update(const Camera &camera, unsigned int width, unsigned int height);
+    // Changes exactly when the view does, 0 before the first update
+    uint64_t version() const { return view_version; }
+
+    const Eigen::Matrix4f &view() const { return view_matrix; }
+    const Eigen::Matrix4f &projection() const { return projection_matrix; }
+    const Eigen::Matrix4f &viewProjection() const { return view_projection_matrix; }
+    const Eigen::Matrix4f &inverseView() const { return inverse_view_matrix; }
+    const Eigen::Matrix4f &inverseProjection() const { return inverse_projection_matrix; }
+    const Eigen::Matrix4f &inverseViewProjection() const { return inverse_view_projection_matrix; }
+
+    const Eigen::Vector3f &position() const { return eye; }
+    const Eigen::Vector3f &forward() const { return front; }
+    float fovY() const { return fov_y; }
+    float aspectRatio() const { return static_cast<float>(width) / static_cast<float>(height); }
+    float zNear() const { return z_near; }
+    float zFar() const { return z_far; }
+    unsigned int viewportWidth() const { return width; }
+    unsigned int viewportHeight() const { return height; }
+
+    // World space, see frustumPlanes()
+    const std::array<Eigen::Vector4f, 6> &frustumPlanes() const { return planes; }
+    // World space, near plane corners then far plane corners, each bottom left, bottom right, top right, top left
+    const std::array<Eigen::Vector3f, 8> &frustumCorners() const { return corners; }
+
+    // Conservative tests against the world space frustum
+    bool intersectsSphere(const Eigen::Vector3f &center, float radius) const;
+    bool intersectsBox(const Eigen::Vector3f &min_corner, const Eigen::Vector3f &max_corner) const;
+
+private:
+    float z_near, z_far;
+    uint64_t view_version = 0;
+
+    // Inputs of the current state
+    Eigen::Vector3f eye = Eigen::Vector3f::Zero();
+    Eigen::Vector3f front = Eigen::Vector3f::Zero();
+    Eigen::Vector3f world_up = Eigen::Vector3f::Zero();
+    float fov_y = 0.0f;
+    unsigned int width = 0, height = 0;
+
+    Eigen::Matrix4f view_matrix, projection_matrix, view_projection_matrix;
+    Eigen::Matrix4f inverse_view_matrix, inverse_projection_matrix, inverse_view_projection_matrix;
+    std::array<Eigen::Vector4f, 6> planes;
+    std::array<Eigen::Vector3f, 8> corners;
+};
+
+#endif //EMPTYGL_FRAME_VIEW_H
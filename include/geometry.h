@@ -5,6 +5,8 @@
 #ifndef EMPTYGL_GEOMETRY_H
 #define EMPTYGL_GEOMETRY_H
 
+#include <array>
+
 #include <Eigen/Dense>
 
 const float PI = 3.14159265359f;
@@ -20,4 +22,33 @@ Eigen::Matrix4f perspective(float fov_y, float aspect_ratio, float z_near, float
 
 Eigen::Matrix4f orthographic(float left, float right, float bottom, float top, float near, float far);
 
+enum FrustumPlane {
+    FRUSTUM_LEFT,
+    FRUSTUM_RIGHT,
+    FRUSTUM_BOTTOM,
+    FRUSTUM_TOP,
+    FRUSTUM_NEAR,
+    FRUSTUM_FAR
+};
+
+// Planes of the volume a projection matrix maps to clip space, indexed by FrustumPlane. (n, d) with unit n
+// pointing inside, n . p + d >= 0 inside
+std::array<Eigen::Vector4f, 6> frustumPlanes(const Eigen::Matrix4f &view_projection);
+
+// Conservative: false only if the sphere is entirely outside one of the planes
+bool sphereInFrustum(const std::array<Eigen::Vector4f, 6> &planes, const Eigen::Vector3f &center, float radius);
+// Conservative: false only if the axis aligned box is entirely outside one of the planes
+bool boxInFrustum(const std::array<Eigen::Vector4f, 6> &planes, const Eigen::Vector3f &min_corner,
+                  const Eigen::Vector3f &max_corner);
+
+struct Ray {
+    Eigen::Vector3f origin;
+    Eigen::Vector3f direction; // Unit length
+};
+
+// Ray through a window position in pixels, y down as window systems report it, by inverting a lookAt() view and
+// a perspective() or orthographic() projection. Starts on the near plane
+Ray screenRay(const Eigen::Matrix4f &view, const Eigen::Matrix4f &projection, float x, float y, float width,
+              float height);
+
 #endif //EMPTYGL_GEOMETRY_H
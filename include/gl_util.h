@@ -0,0 +1,12 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#ifndef EMPTYGL_GL_UTIL_H
+#define EMPTYGL_GL_UTIL_H
+
+// Whether the current context offers an extension. The list is read from the driver once, on the first call,
+// so call it on the GL thread after the context was created
+bool hasGLExtension(const char *name);
+
+#endif //EMPTYGL_GL_UTIL_H
@@ -0,0 +1,118 @@
+//
+// Created by Andrew on 6/8/2021.
+//
+
+#ifndef EMPTYGL_JOB_SYSTEM_H
+#define EMPTYGL_JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+class JobCounter;
+
+struct Job {
+    const char *name; // Must outlive the job, string literals in practice
+    std::function<void()> function;
+    JobCounter *counter;
+};
+
+// Jobs still running under it. Jobs can be made to wait for a counter to reach zero. Only destroy a counter
+// after JobSystem::wait() saw it reach zero
+class JobCounter {
+public:
+    JobCounter() = default;
+    JobCounter(const JobCounter &) = delete;
+    JobCounter &operator=(const JobCounter &) = delete;
+
+    unsigned int pending() const { return count.load(std::memory_order_acquire); }
+
+private:
+    friend class JobSystem;
+
+    std::atomic<unsigned int> count{0};
+    std::mutex mutex;
+    vector<Job> continuations; // Scheduled when count drops to zero
+};
+
+// The one scheduler every subsystem runs its parallel work on. Each worker owns a deque: it pushes and
+// pops its own jobs at the back and, when out of work, steals from the front of the others'. Jobs from
+// other threads go through a shared queue. Threads waiting on a counter run jobs meanwhile instead of
+// blocking. GL-only jobs go to the main thread, which runs them in pumpMainThread() or while it waits.
+// Before start() there are no workers and everything runs inline on the calling thread
+class JobSystem {
+public:
+    // Called around every job that ran, on the thread that ran it
+    using Observer = std::function<void(const char *name, uint64_t begin_ns, uint64_t end_ns)>;
+
+    static JobSystem &instance();
+
+    // 0 workers picks one per core besides the calling thread, which becomes the main thread
+    void start(unsigned int n_workers=0);
+    // Run what is queued and join the workers
+    void stop();
+    bool isRunning() const { return !workers.empty(); }
+    unsigned int workerCount() const { return static_cast<unsigned int>(workers.size()); }
+    // Hand main thread affinity to the calling thread, e.g. when the GL context moves to another thread
+    void setMainThread();
+    bool isMainThread() const { return std::this_thread::get_id() == main_thread.load(); }
+    // Jobs are recorded as Profiler CPU markers either way. Set before start()
+    void setObserver(Observer observer) { this->observer = std::move(observer); }
+
+    // Queue a job. counter, if given, counts it until it finished. With a dependency the job is only
+    // queued once that counter drops to zero
+    void run(const char *name, std::function<void()> function, JobCounter *counter=nullptr,
+             JobCounter *dependency=nullptr);
+    // Queue a job only the main thread runs, for GL calls
+    void runOnMainThread(const char *name, std::function<void()> function, JobCounter *counter=nullptr);
+    // Run jobs until at most target jobs are pending under counter
+    void wait(JobCounter &counter, unsigned int target=0);
+    // Main thread, e.g. once per frame. Run the main thread jobs queued so far
+    void pumpMainThread();
+
+    // Split [0, n) into ranges of at least min_grain and run body on them in parallel, the calling thread
+    // included. Ranges are sized so every thread gets a few, which evens out uneven costs
+    void parallelFor(const char *name, size_t n, const std::function<void(size_t begin, size_t end)> &body,
+                     size_t min_grain=1);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+    // Ranges per thread parallelFor aims for
+    static const size_t CHUNKS_PER_THREAD = 4;
+
+    vector<std::unique_ptr<Worker>> workers;
+    std::mutex shared_mutex;
+    std::deque<Job> shared_jobs;
+    std::mutex main_mutex;
+    std::deque<Job> main_jobs;
+    // Written by whichever thread takes over the GL context while workers ask isMainThread()
+    std::atomic<std::thread::id> main_thread{std::this_thread::get_id()};
+    Observer observer;
+
+    // Queued jobs not yet taken, workers sleep while there are none
+    std::atomic<int> n_queued{0};
+    std::mutex sleep_mutex;
+    std::condition_variable work_ready;
+    std::atomic<bool> stopping{false};
+
+    JobSystem() = default;
+    void workerLoop(unsigned int index);
+    void schedule(Job job);
+    bool takeJob(Job &job);
+    void execute(Job &job);
+    void finish(JobCounter *counter);
+};
+
+#endif //EMPTYGL_JOB_SYSTEM_H
@@ -0,0 +1,43 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#ifndef EMPTYGL_MAILBOX_H
+#define EMPTYGL_MAILBOX_H
+
+#include <atomic>
+#include <utility>
+
+// Lock-free hand over of the newest value from one producer thread to one consumer thread. A post never
+// fails or blocks, it replaces whatever the consumer has not taken yet. Values are swapped in and out of
+// three slots instead of copied, so buffers they hold keep their capacity from one round to the next
+template<typename T>
+class Mailbox {
+public:
+    // Producer thread. value comes back holding an older one, for its storage
+    void post(T &value) {
+        std::swap(slots[back], value);
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    // Consumer thread. Swap the newest value into value, false if nothing was posted since the last take
+    bool take(T &value) {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        std::swap(slots[front], value);
+        return true;
+    }
+
+private:
+    // Set in middle while it holds a value the consumer has not taken
+    static const unsigned int FRESH = 4;
+
+    T slots[3];
+    // Producer's slot, the slot in between and the consumer's slot. Only middle is shared
+    unsigned int back = 0;
+    alignas(64) std::atomic<unsigned int> middle{1};
+    alignas(64) unsigned int front = 2;
+};
+
+#endif //EMPTYGL_MAILBOX_H
@@ -0,0 +1,71 @@
+//
+// Created by Andrew on 5/8/2021.
+//
+
+#ifndef EMPTYGL_MEMORY_TRACKER_H
+#define EMPTYGL_MEMORY_TRACKER_H
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Kinds of tracked assets. Each asset is identified by its kind plus a GL object name
+enum MemoryCategory {
+    MEMORY_MESH,
+    MEMORY_TEXTURE,
+    MEMORY_BUFFER,
+    // Keyed by the framebuffer name, with whatever renderbuffers and buffers only it uses
+    MEMORY_FRAMEBUFFER
+};
+
+struct MemoryUsage {
+    size_t cpu_bytes = 0;
+    size_t gpu_bytes = 0;
+
+    MemoryUsage &operator+=(const MemoryUsage &other) {
+        cpu_bytes += other.cpu_bytes;
+        gpu_bytes += other.gpu_bytes;
+        return *this;
+    }
+};
+
+// Process wide registry of CPU and GPU bytes per asset, updated where allocations happen
+class MemoryTracker {
+public:
+    struct Record {
+        MemoryCategory category;
+        unsigned int id;
+        string name;
+        MemoryUsage usage;
+    };
+
+    static MemoryTracker &instance();
+    static const char *categoryName(MemoryCategory category);
+
+    // Set the footprint of an asset, replacing earlier numbers for the same asset
+    void track(MemoryCategory category, unsigned int id, const string &name, const MemoryUsage &usage);
+    void untrack(MemoryCategory category, unsigned int id);
+
+    MemoryUsage usage(MemoryCategory category, unsigned int id) const;
+    MemoryUsage total() const;
+    MemoryUsage total(MemoryCategory category) const;
+    // All records, largest total footprint first
+    vector<Record> records() const;
+    // Print totals and the largest max_records assets
+    void report(std::ostream &out, size_t max_records=50) const;
+
+private:
+    mutable std::mutex mutex;
+    std::map<std::pair<MemoryCategory, unsigned int>, Record> assets;
+
+    MemoryTracker() = default;
+};
+
+#endif //EMPTYGL_MEMORY_TRACKER_H
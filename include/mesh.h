@@ -5,16 +5,21 @@
 #ifndef TOONSHADING_MESH_H
 #define TOONSHADING_MESH_H
 
+#include <memory>
 #include <string>
 #include <vector>
 
 #include <Eigen/Dense>
 
+#include "memory_tracker.h"
 #include "shader.h"
 
 using std::string;
 using std::vector;
 
+class DynamicVertexBuffer;
+struct DrawPacket;
+
 class Mesh {
 public:
     struct Vertex {
@@ -31,14 +36,44 @@ public:
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
+    string name;
+    // ShaderFeature bits of the shader permutation this mesh draws with, chosen at load time
+    unsigned int shader_features = 0;
+    // Material diffuse color, used by untextured meshes when draw data comes from buffer blocks
+    Eigen::Vector4f base_color = Eigen::Vector4f(0.8f, 0.8f, 0.8f, 1.0f);
+    // Bounding box and sphere in model space
+    Eigen::Vector3f bounds_min = Eigen::Vector3f::Zero(), bounds_max = Eigen::Vector3f::Zero();
+    Eigen::Vector3f bounds_center = Eigen::Vector3f::Zero();
+    float bounds_radius = 0.0f;
+    // Texture coordinate units per model space unit, averaged over the surface
+    float uv_density = 0.0f;
 
-    Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<Texture> &textures);
-    void draw(const Shader *shader);
+    // Dynamic meshes keep their vertices in a multi-buffered DynamicVertexBuffer so they can be rewritten
+    // every frame, static ones upload once
+    Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<Texture> &textures,
+         const string &name="", bool dynamic=false);
+    // More than one instance is for shaders that pick per instance state by gl_InstanceID, see MultiViewRenderer
+    void draw(const Shader *shader, unsigned int n_instances=1);
     void draw_depth();
+    // Fill the program, geometry and texture fields of a draw packet for a permutation, see DrawList.
+    // Touches no GL state, so any thread may record
+    void record(const Shader *shader, DrawPacket &packet) const;
+    // Release GPU buffers
+    void release();
+    // Attributes setup_mesh feeds to vertex shaders
+    static vector<VertexAttribute> vertexLayout();
+    // Vertex and index bytes held in RAM and in GPU buffers. Textures are accounted separately
+    MemoryUsage memoryUsage() const;
+    bool isDynamic() const { return dynamic_vertices != nullptr; }
+    // Vertex updates of dynamic meshes, nullptr for static ones. Shared by copies of this mesh
+    DynamicVertexBuffer *dynamicVertices() const { return dynamic_vertices.get(); }
 private:
     unsigned int VAO, VBO, EBO;
+    std::shared_ptr<DynamicVertexBuffer> dynamic_vertices;
 
-    void setup_mesh();
+    void setup_mesh(bool dynamic);
+    void compute_bounds();
+    void draw_elements(unsigned int n_instances=1);
 };
 
 
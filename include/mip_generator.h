@@ -0,0 +1,53 @@
+//
+// Created by Andrew on 5/23/2021.
+//
+
+#ifndef EMPTYGL_MIP_GENERATOR_H
+#define EMPTYGL_MIP_GENERATOR_H
+
+#include <functional>
+#include <vector>
+
+using std::vector;
+
+enum MipFilter {
+    MIP_FILTER_BOX,   // 2x2 average, cheapest
+    MIP_FILTER_KAISER // Kaiser windowed sinc over 6x6 texels, keeps more detail without aliasing
+};
+
+// RGBA8 image and its mip levels, level 0 first, each half the size of the one before down to 1x1
+struct MipChain {
+    unsigned int width = 0, height = 0;
+    vector<vector<unsigned char>> levels;
+
+    unsigned int levelWidth(unsigned int level) const;
+    unsigned int levelHeight(unsigned int level) const;
+};
+
+// Builds mip chains on the CPU, so uploads copy levels instead of calling glGenerateMipmap. Every level
+// is filtered from the one above it in floating point, rows are split into job system ranges and the filter
+// taps run on SSE2 unless simdLevel() is scalar
+class MipGenerator {
+public:
+    // n_threads caps the ranges a pass is split into, 0 leaves it to the job system and 1 runs serially
+    explicit MipGenerator(MipFilter filter=MIP_FILTER_KAISER, unsigned int n_threads=0);
+    // gamma_correct filters color in linear space, for sRGB encoded color maps. Alpha is always linear
+    void generate(const unsigned char *rgba, unsigned int width, unsigned int height, bool gamma_correct,
+                  MipChain &chain) const;
+
+private:
+    unsigned int n_threads;
+    // Taps of the 2:1 downsampling kernel, source texel 2x + tap_offsets[i] for destination texel x
+    vector<int> tap_offsets;
+    vector<float> tap_weights;
+
+    // Separable passes over RGBA float images, each halving one dimension. Rows are destination rows
+    void downsampleHorizontal(const float *source, unsigned int width, float *destination,
+                              unsigned int row_begin, unsigned int row_end) const;
+    void downsampleVertical(const float *source, unsigned int width, unsigned int height, float *destination,
+                            unsigned int row_begin, unsigned int row_end) const;
+    void parallelRows(unsigned int n_rows, size_t row_cost,
+                      const std::function<void(unsigned int, unsigned int)> &run) const;
+};
+
+#endif //EMPTYGL_MIP_GENERATOR_H
@@ -0,0 +1,57 @@
+//
+// Created by Andrew on 5/31/2021.
+//
+
+#ifndef EMPTYGL_MULTI_VIEW_RENDERER_H
+#define EMPTYGL_MULTI_VIEW_RENDERER_H
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "scene.h"
+#include "shader.h"
+
+using std::vector;
+
+// Renders several views of a scene into the layers of an array framebuffer, e.g. stereo pairs or the cameras
+// of a capture rig. Every view's view projection matrix sits in one uniform buffer array. Where vertex
+// shaders can write gl_Layer (ARB_shader_viewport_layer_array or AMD_vertex_shader_layer) each mesh is drawn
+// once, instanced per view, so all views cost one submission; elsewhere every view is its own pass
+class MultiViewRenderer {
+public:
+    // Shaders with USE_MULTIVIEW size their view array with this
+    static const unsigned int MAX_VIEWS = 8;
+    // Uniform buffer binding of the MultiViewData block, after FrameData and DrawData
+    static const unsigned int VIEW_BINDING = 2;
+
+    MultiViewRenderer(unsigned int width, unsigned int height, unsigned int n_views);
+    ~MultiViewRenderer();
+    MultiViewRenderer(const MultiViewRenderer &) = delete;
+    MultiViewRenderer &operator=(const MultiViewRenderer &) = delete;
+
+    // True when the driver lets vertex shaders pick the layer, checked once
+    static bool layeredVertexOutput();
+
+    // GL thread. Clear and render view i into layer i, with the SHADER_FEATURE_MULTIVIEW permutations of the
+    // meshes plus extra_features. At most viewCount() views. Leaves the layered framebuffer bound
+    void render(Scene *scene, ShaderVariants *variants, const vector<Eigen::Matrix4f> &view_projections,
+                const Eigen::Matrix4f &model, unsigned int extra_features=0);
+    // Attach one layer's color to GL_READ_FRAMEBUFFER, for glReadPixels
+    void bindLayerForRead(unsigned int view);
+
+    unsigned int viewCount() const { return n_views; }
+    unsigned int colorTexture() const { return color_texture; }
+
+private:
+    unsigned int width, height, n_views;
+    bool single_pass;
+    bool layered_attachment = true; // Whole arrays attached, otherwise single layers of the fallback
+    unsigned int framebuffer = 0, read_framebuffer = 0;
+    unsigned int color_texture = 0, depth_texture = 0;
+    unsigned int view_buffer = 0;
+
+    void attachLayer(int layer);
+};
+
+#endif //EMPTYGL_MULTI_VIEW_RENDERER_H
@@ -0,0 +1,124 @@
+//
+// Created by Andrew on 5/2/2021.
+//
+
+#ifndef EMPTYGL_PROFILER_H
+#define EMPTYGL_PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// CPU/GPU frame profiler. CPU markers go into per-thread lock-free ring buffers, GPU markers are
+// timestamp queries read back a few frames later, so neither side ever waits on the other.
+// Everything collected can be exported as Chrome about:tracing JSON.
+class Profiler {
+public:
+    struct Event {
+        const char *name; // Must outlive the profiler, string literals in practice
+        uint64_t begin_ns;
+        uint64_t end_ns;
+        uint32_t thread_id; // GPU_THREAD_ID for GPU events
+    };
+    static const uint32_t GPU_THREAD_ID = 0;
+
+    static Profiler &instance();
+    // Monotonic CPU clock in nanoseconds
+    static uint64_t now();
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // CPU markers, callable from any thread
+    void recordCPU(const char *name, uint64_t begin_ns, uint64_t end_ns);
+
+    // GPU markers, GL thread only. Scopes may nest
+    int64_t beginGPU(const char *name);
+    void endGPU(int64_t scope);
+
+    // Call once per frame on the GL thread. Drains CPU rings and reads back finished GPU queries
+    void newFrame();
+    // GL thread. Waits for the GPU scopes still in flight, then writes all collected events as Chrome trace JSON
+    bool exportChromeTrace(const string &path);
+
+private:
+    struct ThreadBuffer {
+        static const size_t CAPACITY = 1 << 14;
+        Event events[CAPACITY];
+        std::atomic<size_t> head{0};
+        std::atomic<size_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        uint32_t thread_id = 0;
+    };
+    struct GPUScope {
+        const char *name;
+        unsigned int begin_query;
+        unsigned int end_query;
+        bool ended;
+    };
+    static const size_t MAX_EVENTS = 1 << 22;
+
+    std::atomic<bool> enabled{false};
+
+    // Registry of per-thread rings, owned here so events survive their thread
+    std::mutex registry_mutex;
+    vector<std::unique_ptr<ThreadBuffer>> thread_buffers;
+
+    vector<GPUScope> gpu_pending;
+    int64_t gpu_first_scope = 0; // Scope ID of gpu_pending.front()
+    vector<unsigned int> free_queries;
+    int64_t gpu_clock_offset = 0;
+    bool gpu_calibrated = false;
+
+    std::mutex events_mutex;
+    vector<Event> events;
+    // Events that arrived after MAX_EVENTS were collected
+    uint64_t dropped_events = 0;
+
+    Profiler() = default;
+    ThreadBuffer *threadBuffer();
+    void drainThreadBuffers();
+    // Without wait, stops at the first query whose result is not available yet
+    void readbackGPU(bool wait=false);
+    unsigned int acquireQuery();
+};
+
+// RAII CPU marker
+class ProfileScope {
+public:
+    explicit ProfileScope(const char *name) : name(name),
+            begin_ns(Profiler::instance().isEnabled() ? Profiler::now() : 0) {}
+    ~ProfileScope() {
+        if (begin_ns)
+            Profiler::instance().recordCPU(name, begin_ns, Profiler::now());
+    }
+private:
+    const char *name;
+    uint64_t begin_ns;
+};
+
+// RAII GPU marker, GL thread only
+class GPUProfileScope {
+public:
+    explicit GPUProfileScope(const char *name) :
+            scope(Profiler::instance().isEnabled() ? Profiler::instance().beginGPU(name) : -1) {}
+    ~GPUProfileScope() {
+        if (scope >= 0)
+            Profiler::instance().endGPU(scope);
+    }
+private:
+    int64_t scope;
+};
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILER_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) GPUProfileScope PROFILER_CONCAT(gpu_profile_scope_, __LINE__)(name)
+
+#endif //EMPTYGL_PROFILER_H
@@ -0,0 +1,78 @@
+//
+// Created by Andrew on 6/2/2021.
+//
+
+#ifndef EMPTYGL_RENDER_THREAD_H
+#define EMPTYGL_RENDER_THREAD_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "camera_path.h"
+#include "draw_list.h"
+#include "frame_pacer.h"
+#include "mailbox.h"
+
+// Simulation state one frame is drawn from, copied out of the simulation thread so the renderer never
+// reads state that is being updated
+struct FrameSnapshot {
+    CameraPose camera;
+    Eigen::Matrix4f model = Eigen::Matrix4f::Identity();
+    uint64_t tick = 0; // Simulation step the snapshot was taken after
+    uint64_t input_time_ns = 0; // Profiler::now() when the step read input
+    // Draws recorded on the simulation thread, see DrawListRecorder::record. Empty to draw the scene on the
+    // render thread instead
+    std::vector<DrawList> draw_lists;
+};
+
+// Owns the GL context on its own thread and draws the newest submitted snapshot, so input handling and
+// simulation on the main thread never wait on GL submission or buffer swaps. Snapshots travel through a
+// lock-free mailbox; ones superseded before the renderer got to them are overwritten
+class RenderThread {
+public:
+    // acquire_context makes the GL context current on the render thread and release_context detaches it
+    // again, the creating thread must have detached it first. render_frame draws and presents one frame.
+    // With a pacer, the snapshot to draw is picked only after the pacer let the frame begin
+    RenderThread(std::function<void()> acquire_context, std::function<void(const FrameSnapshot &)> render_frame,
+                 std::function<void()> release_context, FramePacer *pacer=nullptr);
+    // Stops the thread, see stop()
+    ~RenderThread();
+    RenderThread(const RenderThread &) = delete;
+    RenderThread &operator=(const RenderThread &) = delete;
+
+    // Simulation thread. Replaces the snapshot waiting to be drawn, if any. snapshot comes back holding an older
+    // one, whose draw lists can be recorded into again
+    void submit(FrameSnapshot &snapshot);
+    // Finish the frame in progress, release the context and join. The context can be made current again after
+    void stop();
+
+    uint64_t framesRendered() const { return frames_rendered.load(std::memory_order_relaxed); }
+    // Simulation step of the snapshot drawn last
+    uint64_t lastRenderedTick() const { return last_rendered_tick.load(std::memory_order_relaxed); }
+
+private:
+    std::function<void()> acquire_context;
+    std::function<void(const FrameSnapshot &)> render_frame;
+    std::function<void()> release_context;
+    FramePacer *pacer;
+    Mailbox<FrameSnapshot> snapshots;
+    // Wakes the render thread for the first snapshot or for stopping, it has nothing to draw before either
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool submitted = false;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> frames_rendered{0};
+    std::atomic<uint64_t> last_rendered_tick{0};
+    std::thread thread;
+
+    void loop();
+};
+
+#endif //EMPTYGL_RENDER_THREAD_H
@@ -0,0 +1,65 @@
+//
+// Created by Andrew on 5/18/2021.
+//
+
+#ifndef EMPTYGL_RING_BUFFER_H
+#define EMPTYGL_RING_BUFFER_H
+
+#include <cstddef>
+#include <vector>
+
+#include <glad/glad.h>
+
+// Persistently mapped buffer split into per-frame regions for per-frame and per-draw data. The CPU writes
+// straight into mapped memory and binds by offset; a fence per region keeps it from overwriting data the
+// GPU still reads. Without glBufferStorage (GL 4.4) writes go to a CPU copy instead, the buffer is orphaned
+// every frame and allocations are uploaded when bound or flushed
+class DynamicRingBuffer {
+public:
+    struct Allocation {
+        void *data;    // Mapped, write only
+        size_t offset; // From the start of the buffer, for glBindBufferRange
+        size_t size;
+    };
+
+    // frame_size bytes per region. target decides the offset alignment, e.g. GL_UNIFORM_BUFFER
+    DynamicRingBuffer(size_t frame_size, GLenum target=GL_UNIFORM_BUFFER, unsigned int n_frames=3);
+    ~DynamicRingBuffer();
+    DynamicRingBuffer(const DynamicRingBuffer &) = delete;
+    DynamicRingBuffer &operator=(const DynamicRingBuffer &) = delete;
+
+    // Move to the next region, waiting only if the GPU still reads it from n_frames ago
+    void beginFrame();
+    // Fence the current region after the frame's draws were submitted
+    void endFrame();
+    // Aligned space in the current region. data is nullptr when the region is full
+    Allocation allocate(size_t size);
+    // Upload an allocation written since the last call. Only needed for ranges bound without bindRange,
+    // and a no-op on the persistently mapped path
+    void flush(const Allocation &allocation) const;
+    void bindRange(unsigned int binding, const Allocation &allocation) const;
+
+    unsigned int bufferID() const { return buffer; }
+    size_t frameSize() const { return frame_size; }
+    bool isPersistent() const { return persistent; }
+    static size_t offsetAlignment(GLenum target);
+
+private:
+    static const unsigned int MAX_FRAMES = 4;
+
+    GLenum target;
+    unsigned int buffer = 0;
+    unsigned char *mapped = nullptr;
+    bool persistent = false;
+    // CPU copy of the buffer when it cannot be mapped persistently
+    std::vector<unsigned char> staging;
+    size_t frame_size;
+    size_t alignment;
+    unsigned int n_frames;
+    unsigned int frame = 0;
+    size_t frame_offset = 0; // Bytes used in the current region
+    GLsync fences[MAX_FRAMES] = {};
+    bool overflow_reported = false;
+};
+
+#endif //EMPTYGL_RING_BUFFER_H
@@ -3,34 +3,171 @@
 
 #include <Eigen/Dense>
 
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <map>
 #include <vector>
 #include <string>
 
 #include <assimp/scene.h>
 
+#include "batch_geometry.h"
+#include "frame_view.h"
+#include "geometry.h"
+#include "memory_tracker.h"
+#include "ring_buffer.h"
 #include "shader.h"
 #include "mesh.h"
+#include "texture_streamer.h"
+#include "triangle_bvh.h"
 
 using std::vector;
 using std::string;
 
+struct DrawList;
+
+// Per frame state shared by every thread recording draws of a scene, see Scene::prepareRecording
+struct SceneRecording {
+    Eigen::Matrix4f model;
+    std::array<Eigen::Vector4f, 6> planes;
+    float model_scale = 1.0f;
+    // Bounding sphere centers of the meshes under model
+    PointsSoA centers;
+    // Mesh indices grouped by permutation, and the permutation of every mesh
+    vector<unsigned int> draw_order;
+    vector<const Shader *> shaders;
+    // One DrawData block per draw order position, data is nullptr when drawing with uniforms
+    DynamicRingBuffer::Allocation draw_data{nullptr, 0, 0};
+    size_t draw_data_stride = 0;
+};
+
+// Closest triangle a ray query found
+struct RayHit {
+    unsigned int mesh = 0;
+    unsigned int triangle = 0;
+    // Weights of the three triangle corners
+    Eigen::Vector3f barycentrics = Eigen::Vector3f::Zero();
+    // Along the ray, world units
+    float distance = 0.0f;
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+};
+
+// First triangle a moving sphere touched
+struct SphereSweepHit {
+    unsigned int mesh = 0;
+    unsigned int triangle = 0;
+    // Part of the motion done before touching
+    float fraction = 0.0f;
+    // Contact point, and the world space direction from it to the sphere center
+    Eigen::Vector3f position = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+};
+
 class Scene {
 public:
+    Scene() = default;
     Scene(const vector<string> &path_list);
     Scene(const vector<string> &path, bool with_texture);
+    // Append an already uploaded mesh, e.g. for procedurally generated scenes
+    void addMesh(const Mesh &mesh);
     void draw(const Shader *shader);
+    // Draw every mesh with the permutation matching its shader features plus extra_features, one program
+    // switch per permutation
+    void draw(ShaderVariants *variants, unsigned int extra_features=0, unsigned int n_instances=1);
+    // Same as above, but the model matrix and material of every draw are written into the ring buffer
+    // instead of being set as uniforms. Permutations are looked up with SHADER_FEATURE_DRAW_DATA added.
+    // Draws the ring buffer has no room for fall back to uniforms taken from view
+    void draw(ShaderVariants *variants, DynamicRingBuffer *draw_buffer, const Eigen::Matrix4f &model,
+              const FrameView &view, unsigned int extra_features=0);
+    // Command list path, see DrawListRecorder. GL thread: resolve the permutations and, with a draw buffer,
+    // reserve a DrawData block for every mesh. If the draw buffer is full every draw uses uniforms instead
+    void prepareRecording(ShaderVariants *variants, DynamicRingBuffer *draw_buffer, const Eigen::Matrix4f &model,
+                          const FrameView &view, unsigned int extra_features, SceneRecording &recording);
+    // Any thread: point a prepared recording at another model matrix and view, e.g. once per simulation step
+    void updateRecording(const Eigen::Matrix4f &model, const FrameView &view, SceneRecording &recording) const;
+    // Any thread: append packets for the draw order positions [begin, end) that pass culling. Disjoint
+    // ranges may be recorded concurrently
+    void recordDraws(const SceneRecording &recording, size_t begin, size_t end, DrawList &list) const;
     void draw_depth();
+    // Depth only draw of some meshes, e.g. the ones cull() kept
+    void draw_depth(const vector<unsigned int> &mesh_indices);
+    // Meshes whose bounding box under model touches the volume the planes bound, see frustumPlanes().
+    // Dynamic meshes are tested with the box around their latest vertices. has_dynamic tells whether any of
+    // them is a dynamic mesh
+    void cull(const Eigen::Matrix4f &model, const std::array<Eigen::Vector4f, 6> &planes,
+              vector<unsigned int> &visible, bool *has_dynamic=nullptr) const;
+    // Sphere around every mesh under model. False if the scene is empty
+    bool boundingSphere(const Eigen::Matrix4f &model, Eigen::Vector3f &center, float &radius) const;
+    // Build the ray query BVH of every mesh that has none yet, in parallel. Queries do it themselves, calling
+    // it after loading keeps the first one fast
+    void prepareRayQueries();
+    // Closest triangle a world space ray hits within max_distance, with the scene placed by model. Dynamic
+    // meshes are skipped, their vertices on the CPU are the ones from load time
+    bool raycast(const Eigen::Matrix4f &model, const Ray &ray, RayHit &hit,
+                 float max_distance=std::numeric_limits<float>::infinity());
+    // Whether any triangle is hit within max_distance, e.g. for visibility tests. Stops at the first hit
+    bool raycastAny(const Eigen::Matrix4f &model, const Ray &ray,
+                    float max_distance=std::numeric_limits<float>::infinity());
+    // First triangle a world space sphere moving by motion touches, for collision. model must scale uniformly.
+    // Dynamic meshes are skipped as for rays
+    bool sweepSphere(const Eigen::Matrix4f &model, const Eigen::Vector3f &center, float radius,
+                     const Eigen::Vector3f &motion, SphereSweepHit &hit);
+    // Changes whenever meshes are added, so cached renderings of the scene know to redraw
+    uint64_t geometryVersion() const { return geometry_version; }
+    unsigned int meshCount() const;
+    // Feature masks used by the meshes, e.g. to prepare their permutations up front
+    vector<unsigned int> shaderFeatureSets();
+    // Bytes held by all meshes plus every texture loaded for this scene
+    MemoryUsage memoryUsage() const;
+    // Texture streaming feedback: report the texel density every mesh needs at its distance from the camera
+    void requestTextureLevels(TextureStreamer *streamer, const Eigen::Matrix4f &model, const FrameView &view) const;
+    // Textures of scenes loaded afterwards stream through this, nullptr loads them whole
+    static void setTextureStreamer(TextureStreamer *streamer) { texture_streamer = streamer; }
 private:
+    // Benchmarks time the private import stages directly
+    friend class SceneBenchmark;
+
     // model data
     vector<Mesh> meshes;
+    // Bounding spheres of meshes in model space, laid out for the batch kernels
+    PointsSoA mesh_centers;
+    vector<float> mesh_radii;
+    BoundsSoA mesh_boxes;
     string directory;
     vector<Mesh::Texture> textures_loaded;
+    static TextureStreamer *texture_streamer;
+    // Textures of the model being loaded, cooked in jobs before the meshes need them so the GL thread only
+    // uploads. Keyed by file path and texture type
+    struct PendingTexture {
+        CookedTexture cooked;
+        bool success = false;
+    };
+    std::map<std::pair<string, string>, PendingTexture> pending_textures;
+    // Mesh indices grouped by shader features, rebuilt when meshes change
+    std::map<unsigned int, vector<unsigned int>> meshes_by_features;
+    bool meshes_by_features_dirty = true;
+    // Per mesh, in model space. Empty for dynamic meshes
+    vector<TriangleBvh> mesh_bvhs;
+    // Over the bounds of mesh_bvhs, so queries only visit the meshes they pass near
+    Bvh mesh_tree;
+    uint64_t geometry_version = 0;
+
+    const std::map<unsigned int, vector<unsigned int>> &meshesByFeatures();
+    // After a mesh is appended to meshes
+    void meshAdded();
 
     void loadModel(const string &path, bool with_texture=true);
     void processNode(aiNode *node, const aiScene *scene, bool with_texture=true);
     Mesh processMesh(aiMesh *mesh, const aiScene *scene, bool with_texture=true);
+    // CPU side of processMesh: vertices and indices of an imported mesh, nothing is uploaded
+    static void readMesh(const aiMesh *mesh, vector<Mesh::Vertex> &vertices, vector<unsigned int> &indices);
     vector<Mesh::Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, const string &typeName);
-    static unsigned int generateTextureFromFile(const char *path, const string &directory);
+    // Fill pending_textures with every material texture not loaded yet, in parallel
+    void cookMaterialTextures(const aiScene *scene);
+    // Cooks the file itself unless pending already holds it
+    static unsigned int generateTextureFromFile(const char *path, const string &directory, const string &type,
+                                                const PendingTexture *pending=nullptr);
 };
 
 #endif //EMPTYGL_SCENE_H
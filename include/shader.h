@@ -5,22 +5,113 @@
 #ifndef EMPTYGL_SHADER_H
 #define EMPTYGL_SHADER_H
 
+#include <functional>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include <Eigen/Dense>
 
+#include "shader_reflection.h"
+
+// Features compiled into a shader permutation. Each set bit injects a #define after the #version line
+enum ShaderFeature {
+    SHADER_FEATURE_TEXTURE = 1 << 0,   // HAS_TEXTURE
+    SHADER_FEATURE_DRAW_DATA = 1 << 1, // USE_DRAW_DATA, frame and draw uniforms come from buffer blocks
+    SHADER_FEATURE_SHADOWS = 1 << 2,   // USE_SHADOWS, cascaded shadow map lookup, see ShadowCascades
+    SHADER_FEATURE_MULTIVIEW = 1 << 3  // USE_MULTIVIEW, view projections from a buffer block, see MultiViewRenderer
+};
+
 class Shader {
+public:
+    enum Status {
+        PENDING, // Compile or link still running in the driver
+        READY,
+        FAILED
+    };
+
 private:
+    // Directory of linked program binaries, empty when caching is off
+    static std::string binary_cache_directory;
+
+    std::string vertex_path;
+    std::string fragment_path;
+    bool specialized = false;
+    unsigned int feature_mask = 0;
+    Status build_status = PENDING;
+    // Build not yet checked by finishBuild. ID keeps serving until it links successfully
+    unsigned int pending_program = 0;
+    unsigned int pending_vertex_shader = 0;
+    unsigned int pending_fragment_shader = 0;
+    std::string pending_cache_key;
+
+    // Interface of the current program, refreshed whenever a new program is swapped in
+    ShaderReflection program_reflection;
+    std::unordered_map<std::string, int> uniform_locations;
+    // Names already reported missing, so a typo costs one message instead of one per frame
+    mutable std::unordered_set<std::string> reported_names;
+
+    // Stage compiles and the link are only issued here, finishBuild collects their results
     unsigned int generateVertexShader(const std::string &vertex_shader_source);
     unsigned int generateFragmentShader(const std::string &fragment_shader_source);
     unsigned int linkShaders(unsigned int vertex_shader, unsigned int fragment_shader);
+    void startBuild(const std::string &vertex_source, const std::string &fragment_source);
+    void finishBuild();
+    void adoptProgram(unsigned int program, Status status);
+    void reportOnce(const char *kind, const std::string &name) const;
+    // Program binary cache keyed by sources and driver, see setBinaryCacheDirectory. Needs GL 4.1 and a
+    // driver offering at least one binary format
+    static bool hasProgramBinaries();
+    static std::string binaryCacheKey(const std::string &vertex_source, const std::string &fragment_source);
+    unsigned int loadProgramBinary(const std::string &key) const;
+    void saveProgramBinary(const std::string &key, unsigned int program) const;
 
 public:
     // Program ID
-    unsigned int ID;
+    unsigned int ID = 0;
+
+    // Cache linked programs in this directory so later launches skip the GLSL compiler. Empty disables
+    static void setBinaryCacheDirectory(const std::string &directory);
+    // True when the driver reports completion status without blocking (GL_KHR_parallel_shader_compile)
+    static bool hasParallelCompile();
+
+    // Constructor reads and builds the shader. An asynchronous build returns right after issuing the
+    // compiles and the link; poll() or wait() before using the program
+    Shader(const std::string &vertex_path, const std::string &fragment_path, bool asynchronous=false);
+    // Permutation of the sources with the given ShaderFeature bits compiled in. SHADER_PERMUTATION is
+    // defined as well, so sources can drop the uniforms the uber-shader branches on
+    Shader(const std::string &vertex_path, const std::string &fragment_path, unsigned int features,
+           bool asynchronous);
+    bool isSpecialized() const { return specialized; }
+    unsigned int features() const { return feature_mask; }
+    // Insert the #defines of a feature mask after the #version line of source
+    static std::string injectFeatureDefines(const std::string &source, unsigned int features);
+    // Non-blocking check of an asynchronous build
+    Status poll();
+    // Block until the build finished
+    Status wait();
+    Status status() const { return build_status; }
+    // Re-read both files and rebuild asynchronously. The current program stays in use until poll()
+    // swaps in the new one after a successful link; a failed rebuild keeps the current program
+    void reload();
+    bool isReloading() const { return pending_program != 0 && ID != 0; }
+    const std::string &vertexPath() const { return vertex_path; }
+    const std::string &fragmentPath() const { return fragment_path; }
 
-    // Constructor reads and builds the shader
-    Shader(const std::string &vertex_path, const std::string &fragment_path);
+    const ShaderReflection &reflection() const { return program_reflection; }
+    // Cached location of an active uniform, -1 (reported once) if the program has no such uniform
+    int uniformLocation(const std::string &name) const;
+    // Same without reporting, so any thread may call it while the program is not being rebuilt
+    int findUniform(const std::string &name) const;
+    // Check the program's vertex inputs against a mesh vertex layout
+    bool checkVertexLayout(const std::vector<VertexAttribute> &layout) const;
+    // Bind a named block to a buffer binding point. Returns false (reported once) if the block is not active
+    bool bindUniformBlock(const std::string &name, unsigned int binding);
+    bool bindStorageBlock(const std::string &name, unsigned int binding);
     // Use/Activate the shader
     void use();
     // Release program
@@ -33,4 +124,41 @@ public:
     void setMat4(const std::string &name, const Eigen::Matrix4f &mat) const;
 };
 
+// Permutations of one shader pair, built on demand and cached by feature mask
+class ShaderVariants {
+public:
+    ShaderVariants(const std::string &vertex_path, const std::string &fragment_path);
+    // Start building a variant without waiting for it
+    void prepare(unsigned int features);
+    // Block until every prepared variant finished building
+    void wait();
+    // Variant for a feature mask, built synchronously if it was not prepared
+    Shader *get(unsigned int features);
+    // Set a uniform on every variant whose mask has all of features, no program needs to be bound
+    void setMat4(const std::string &name, const Eigen::Matrix4f &mat, unsigned int features=0) const;
+    void setMat4Array(const std::string &name, const Eigen::Matrix4f *mats, int count,
+                      unsigned int features=0) const;
+    void setInt(const std::string &name, int value, unsigned int features=0) const;
+    void set4f(const std::string &name, const float value[], unsigned int features=0) const;
+    const std::map<unsigned int, std::shared_ptr<Shader>> &variants() const { return shaders; }
+    const std::string &vertexPath() const { return vertex_path; }
+    const std::string &fragmentPath() const { return fragment_path; }
+    void release();
+private:
+    std::string vertex_path;
+    std::string fragment_path;
+    std::map<unsigned int, std::shared_ptr<Shader>> shaders;
+};
+
+// Tracks asynchronously built shaders and runs a callback for each once it finished building
+class ShaderCompileQueue {
+public:
+    void add(const std::shared_ptr<Shader> &shader, std::function<void(Shader &)> on_ready=nullptr);
+    // Non-blocking. Returns the number of shaders still building
+    size_t poll();
+    void waitAll();
+private:
+    std::vector<std::pair<std::shared_ptr<Shader>, std::function<void(Shader &)>>> pending;
+};
+
 #endif //EMPTYGL_SHADER_H
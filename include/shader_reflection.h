@@ -0,0 +1,66 @@
+//
+// Created by Andrew on 5/15/2021.
+//
+
+#ifndef EMPTYGL_SHADER_REFLECTION_H
+#define EMPTYGL_SHADER_REFLECTION_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Active variable of a linked program
+struct ShaderVariable {
+    string name;
+    unsigned int type;   // GL type enum, e.g. GL_FLOAT_VEC3
+    int location;        // -1 for block members
+    int array_size;
+    int offset;          // Byte offset inside the block, -1 outside blocks
+    int block_index;     // -1 outside blocks
+};
+
+// Active uniform or shader storage block
+struct ShaderBlock {
+    string name;
+    int binding;
+    int data_size;
+    vector<ShaderVariable> members;
+};
+
+// Vertex attribute as a mesh feeds it
+struct VertexAttribute {
+    string name;
+    int location;
+    int components;
+};
+
+// Link-time description of a program's interface, gathered with program interface queries
+class ShaderReflection {
+public:
+    vector<ShaderVariable> attributes;
+    vector<ShaderVariable> uniforms;
+    vector<ShaderBlock> uniform_blocks;
+    vector<ShaderBlock> storage_blocks;
+
+    void reflect(unsigned int program);
+    void clear();
+
+    const ShaderVariable *findAttribute(const string &name) const;
+    const ShaderVariable *findUniform(const string &name) const;
+    const ShaderBlock *findUniformBlock(const string &name) const;
+    const ShaderBlock *findStorageBlock(const string &name) const;
+
+    // Compare the active attributes with what a vertex layout provides. Prints every mismatch and
+    // returns false if there was any
+    bool checkVertexLayout(const vector<VertexAttribute> &layout, std::ostream &out) const;
+    void print(std::ostream &out) const;
+
+    static const char *typeName(unsigned int type);
+    // Component count of float vector types, 0 for everything else
+    static int floatComponents(unsigned int type);
+};
+
+#endif //EMPTYGL_SHADER_REFLECTION_H
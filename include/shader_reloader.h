@@ -0,0 +1,38 @@
+//
+// Created by Andrew on 5/12/2021.
+//
+
+#ifndef EMPTYGL_SHADER_RELOADER_H
+#define EMPTYGL_SHADER_RELOADER_H
+
+#include <chrono>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "file_watcher.h"
+#include "shader.h"
+
+// Rebuilds shaders whose source files change and swaps them in at frame boundaries
+class ShaderHotReloader {
+public:
+    void add(const std::shared_ptr<Shader> &shader);
+    // Every variant of the set, including ones ShaderVariants::get() builds later
+    void add(ShaderVariants *variants);
+    // Call between frames. Starts rebuilds for edited sources once the edits settled and swaps in finished
+    // programs. With parallel compile this never waits on the compiler; without it each rebuild blocks the
+    // frame it starts in, so at most one starts per frame
+    void update();
+private:
+    FileWatcher watcher;
+    std::vector<std::shared_ptr<Shader>> shaders;
+    std::vector<ShaderVariants *> variant_sets;
+    std::set<string> changed_files;
+    std::chrono::steady_clock::time_point last_change;
+    // Edited shaders whose rebuild has not started yet
+    std::vector<std::shared_ptr<Shader>> stale;
+
+    void markStale(const std::shared_ptr<Shader> &shader);
+};
+
+#endif //EMPTYGL_SHADER_RELOADER_H
@@ -0,0 +1,91 @@
+//
+// Created by Andrew on 5/29/2021.
+//
+
+#ifndef EMPTYGL_SHADOW_CASCADES_H
+#define EMPTYGL_SHADOW_CASCADES_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "frame_view.h"
+#include "scene.h"
+#include "shader.h"
+
+using std::string;
+using std::vector;
+
+// Cascaded shadow maps for one directional light. The view is sliced by distance and each slice gets an
+// orthographic light frustum fit around it, rendered with the depth only draw path into one layer of a
+// texture array. Cascades are fit to a bounding sphere and snapped to whole texels, so their matrices stay
+// exactly the same while the slice moves less than a texel. A cascade holding only static meshes is then
+// not rendered again until it moves a texel, or the light or the scene geometry changes
+class ShadowCascades {
+public:
+    // Shaders with USE_SHADOWS index this many cascades
+    static const unsigned int MAX_CASCADES = 4;
+    // Sampled from this unit, above the ones material textures use
+    static const unsigned int TEXTURE_UNIT = 15;
+
+    // split_lambda blends uniform (0) and logarithmic (1) slice distances. Shadows end at max_distance
+    ShadowCascades(const string &vertex_path, const string &fragment_path, unsigned int n_cascades=MAX_CASCADES,
+                   unsigned int resolution=2048, float max_distance=200.0f, float split_lambda=0.75f);
+    // GL thread
+    ~ShadowCascades();
+    ShadowCascades(const ShadowCascades &) = delete;
+    ShadowCascades &operator=(const ShadowCascades &) = delete;
+
+    // Light travel direction, world space
+    void setLightDirection(const Eigen::Vector3f &direction);
+    const Eigen::Vector3f &lightDirection() const { return light_direction; }
+
+    // GL thread. Fit the cascades to the view and render the ones whose contents changed. Leaves the
+    // default framebuffer bound with the viewport restored
+    void render(const FrameView &view, Scene *scene, const Eigen::Matrix4f &model);
+    // Bind the shadow map and set the USE_SHADOWS uniforms on every variant
+    void apply(const ShaderVariants &variants) const;
+
+    unsigned int cascadeCount() const { return n_cascades; }
+    unsigned int textureID() const { return texture; }
+    // World to shadow map clip space
+    const Eigen::Matrix4f &cascadeMatrix(unsigned int cascade) const { return cascades[cascade].view_projection; }
+    // View distance where a cascade ends
+    float cascadeEnd(unsigned int cascade) const { return cascades[cascade].split_end; }
+    // Cascades rendered by the last render(), the rest came from the cache
+    unsigned int renderedLastFrame() const { return n_rendered; }
+
+private:
+    struct Cascade {
+        float split_begin = 0.0f, split_end = 0.0f;
+        Eigen::Matrix4f view_projection = Eigen::Matrix4f::Identity();
+        // State the layer was last rendered with
+        bool valid = false;
+        Eigen::Matrix4f rendered_view_projection = Eigen::Matrix4f::Identity();
+        Eigen::Matrix4f rendered_model = Eigen::Matrix4f::Identity();
+        uint64_t rendered_geometry_version = 0;
+        // Dynamic casters were drawn, so the layer is stale even once they leave the cascade
+        bool rendered_dynamic = false;
+        vector<unsigned int> casters;
+    };
+
+    unsigned int n_cascades;
+    unsigned int resolution;
+    float max_distance;
+    float split_lambda;
+    Eigen::Vector3f light_direction;
+    std::array<Cascade, MAX_CASCADES> cascades;
+    unsigned int n_rendered = 0;
+
+    std::unique_ptr<Shader> depth_shader;
+    unsigned int texture = 0;
+    unsigned int framebuffer = 0;
+
+    void fit(const FrameView &view, const Eigen::Vector3f &scene_center, float scene_radius);
+};
+
+#endif //EMPTYGL_SHADOW_CASCADES_H
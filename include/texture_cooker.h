@@ -0,0 +1,104 @@
+//
+// Created by Andrew on 5/21/2021.
+//
+
+#ifndef EMPTYGL_TEXTURE_COOKER_H
+#define EMPTYGL_TEXTURE_COOKER_H
+
+#include <string>
+#include <vector>
+
+#include "mip_generator.h"
+
+using std::string;
+using std::vector;
+
+// S3TC is an extension that glad does not load, RGTC and BPTC are core
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum TextureCompression {
+    TEXTURE_COMPRESSION_NONE,        // Uncompressed RGBA8
+    TEXTURE_COMPRESSION_FAST,        // BC1 opaque color, BC3 color with alpha, BC5 normal maps
+    TEXTURE_COMPRESSION_HIGH_QUALITY // BC7 color, BC5 normal maps
+};
+
+enum BlockFormat {
+    BLOCK_FORMAT_BC1, // RGB, 8 bytes per 4x4 block
+    BLOCK_FORMAT_BC3, // RGBA, 16 bytes
+    BLOCK_FORMAT_BC5, // RG, 16 bytes. Normal maps, z is reconstructed in the shader
+    BLOCK_FORMAT_BC7, // RGBA, 16 bytes
+    BLOCK_FORMAT_RGBA8 // Uncompressed, 4 bytes per texel
+};
+
+// Texture ready for upload, every mip level encoded, level 0 first
+struct CookedTexture {
+    unsigned int internal_format = 0; // GL internal format, compressed unless GL_RGBA8
+    unsigned int width = 0, height = 0;
+    vector<vector<unsigned char>> levels;
+
+    size_t byteSize() const;
+};
+
+// Import-time texture compression. Images get their mip chain built and are transcoded to BC formats on
+// worker threads, then kept in an on-disk cache, so later loads only read the finished levels and copy
+// them to the GPU
+class TextureCooker {
+public:
+    // GL thread. Falls back to high quality when the driver lacks S3TC
+    static void setCompression(TextureCompression compression);
+    static TextureCompression compression() { return compression_mode; }
+    // Empty disables the cache
+    static void setCacheDirectory(const string &directory);
+    static void setMipFilter(MipFilter filter) { mip_filter = filter; }
+
+    // Read the cooked texture from the cache, or decode and encode the image file. type is the
+    // Mesh::Texture type, normal maps get a two channel format. Levels above first_level are left empty
+    // when the cache can provide them later, cache_file then receives the entry to read them from
+    static bool cook(const string &path, const string &type, CookedTexture &cooked, unsigned int first_level=0,
+                     string *cache_file=nullptr);
+    // Every level uncompressed, bypassing the cache. The fallback when a cooked texture does not load
+    static bool cookUncompressed(const string &path, const string &type, CookedTexture &cooked);
+    // Any thread. One level of a cache entry handed out by cook
+    static bool readCachedLevel(const string &file, unsigned int level, vector<unsigned char> &data);
+    // Any thread. Every level of a cache entry from first_level on, in one read. Finer levels are left empty
+    static bool loadCached(const string &file, CookedTexture &cooked, unsigned int first_level);
+    // Encode every level of an RGBA8 mip chain. n_threads caps the job system ranges, 0 leaves it to the
+    // job system and 1 runs serially
+    static void encode(const MipChain &chain, BlockFormat format, CookedTexture &cooked, unsigned int n_threads=0);
+    // GL thread. Upload every level into the texture bound to GL_TEXTURE_2D. False if the driver rejected
+    // them, e.g. for a compressed format it lacks
+    static bool upload(const CookedTexture &cooked);
+    // GL thread. Define one level of the bound texture, empty data releases it
+    static void uploadLevel(unsigned int internal_format, unsigned int width, unsigned int height,
+                            unsigned int level, const vector<unsigned char> &data);
+    // GL thread. Whether a level of the bound texture holds an image
+    static bool hasLevel(unsigned int level);
+
+    static BlockFormat chooseFormat(const string &type, bool has_alpha);
+    static unsigned int internalFormat(BlockFormat format);
+    static size_t levelSize(BlockFormat format, unsigned int width, unsigned int height);
+    static size_t levelSize(unsigned int internal_format, unsigned int width, unsigned int height);
+
+    // Single 4x4 blocks, texels are RGBA8 in row order
+    static void encodeBC1(const unsigned char *texels, unsigned char *block);
+    static void encodeBC3(const unsigned char *texels, unsigned char *block);
+    static void encodeBC5(const unsigned char *texels, unsigned char *block);
+    static void encodeBC7(const unsigned char *texels, unsigned char *block);
+
+private:
+    static TextureCompression compression_mode;
+    static MipFilter mip_filter;
+    static string cache_directory;
+
+    static string cacheKey(const string &path, const string &type);
+    // Decode the image and build its mip chain. False if the file cannot be decoded
+    static bool decode(const string &path, const string &type, MipChain &chain, bool &has_alpha);
+    static bool saveCached(const string &file, const CookedTexture &cooked);
+};
+
+#endif //EMPTYGL_TEXTURE_COOKER_H
@@ -0,0 +1,94 @@
+//
+// Created by Andrew on 5/25/2021.
+//
+
+#ifndef EMPTYGL_TEXTURE_STREAMER_H
+#define EMPTYGL_TEXTURE_STREAMER_H
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "job_system.h"
+#include "texture_cooker.h"
+
+using std::string;
+using std::vector;
+
+// Keeps only the mip levels that are actually needed on the GPU. Textures start with their small levels
+// resident; each frame the renderer reports how much of a texture lands on a pixel, and finer levels are
+// read from the texture cache in jobs and uploaded a few per frame. The resident total stays
+// within a VRAM budget, evicting the finest levels of the least recently used textures first. Textures
+// without a cache entry have nowhere to read levels from later and are loaded whole.
+class TextureStreamer {
+public:
+    // Levels at most this wide and high are always resident
+    static const unsigned int RESIDENT_SIZE = 64;
+
+    explicit TextureStreamer(size_t budget_bytes, size_t upload_bytes_per_frame=8 << 20);
+    // Waits for the reads in flight
+    ~TextureStreamer();
+    TextureStreamer(const TextureStreamer &) = delete;
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    // GL thread. Cook the image and create its texture with the resident levels only, returns the texture
+    unsigned int load(const string &path, const string &type);
+    // Any order, once per frame per use: texture coordinate units one screen pixel spans there
+    void request(unsigned int texture, float uv_per_pixel);
+    // GL thread, once per frame after the requests. Queues loads, uploads finished levels, evicts
+    void update();
+
+    size_t budget() const { return budget_bytes; }
+    size_t residentBytes() const { return resident_bytes; }
+    // Finest resident level of a texture, for debugging
+    unsigned int residentLevel(unsigned int texture) const;
+
+private:
+    struct StreamedTexture {
+        unsigned int id;
+        string name;
+        string cache_file;    // Where the finer levels come from, empty when loaded whole
+        CookedTexture cooked; // Format and size, no level data is kept once uploaded
+        unsigned int n_levels;
+        unsigned int base_level;     // Coarsest level that is not always resident, never evicted beyond
+        unsigned int resident_level; // Finest level on the GPU
+        unsigned int wanted_level;   // From this frame's requests
+        bool loading = false;
+        uint64_t last_used_frame = 0;
+    };
+    struct LoadResult {
+        unsigned int texture_index;
+        unsigned int level;
+        vector<unsigned char> data;
+        bool success;
+    };
+
+    size_t budget_bytes;
+    size_t upload_bytes_per_frame;
+    size_t resident_bytes = 0;
+    size_t loading_bytes = 0;
+    uint64_t frame = 0;
+
+    vector<StreamedTexture> textures;
+    std::unordered_map<unsigned int, unsigned int> texture_indices; // GL name to textures index
+    vector<float> demand; // Smallest uv_per_pixel requested this frame, per texture
+
+    // Level reads run as jobs and hand their data back through results
+    JobCounter loads;
+    std::mutex mutex;
+    std::deque<LoadResult> results;
+
+    size_t levelBytes(const StreamedTexture &texture, unsigned int level) const;
+    // GL thread, texture bound. Pick the always resident levels and upload them, reading the cache entry once.
+    // False if the driver rejected them
+    bool uploadResident(StreamedTexture &texture);
+    void setResidentLevel(StreamedTexture &texture, unsigned int level);
+    // Drop the finest level of the least recently used texture holding more than it needs. False if none
+    bool evictOne(unsigned int keep_index);
+    void track(const StreamedTexture &texture) const;
+};
+
+#endif //EMPTYGL_TEXTURE_STREAMER_H
@@ -0,0 +1,80 @@
+//
+// Created by Andrew on 6/10/2021.
+//
+
+#ifndef EMPTYGL_TRIANGLE_BVH_H
+#define EMPTYGL_TRIANGLE_BVH_H
+
+#include <cstddef>
+#include <cstring>
+
+#include <Eigen/Dense>
+
+#include "bvh.h"
+
+// Indexed triangles a TriangleBvh is built over and queried against. Positions are read with a byte stride,
+// so vertex structs are used in place
+struct TriangleSource {
+    const float *positions = nullptr;
+    size_t stride = 3 * sizeof(float);
+    const unsigned int *indices = nullptr;
+    size_t n_triangles = 0;
+
+    Eigen::Vector3f vertex(size_t triangle, int corner) const {
+        const char *data = reinterpret_cast<const char *>(positions) + indices[triangle * 3 + corner] * stride;
+        float position[3];
+        std::memcpy(position, data, sizeof(position));
+        return Eigen::Vector3f(position[0], position[1], position[2]);
+    }
+};
+
+struct TriangleHit {
+    unsigned int triangle = 0;
+    // In multiples of the ray direction
+    float distance = 0.0f;
+    // Barycentric weights of the second and third corner
+    float u = 0.0f, v = 0.0f;
+};
+
+struct TriangleSweepHit {
+    unsigned int triangle = 0;
+    // Part of the motion done before the sphere touches the triangle
+    float fraction = 0.0f;
+    // Where they touch, and the direction from there to the sphere center
+    Eigen::Vector3f point = Eigen::Vector3f::Zero();
+    Eigen::Vector3f normal = Eigen::Vector3f::Zero();
+};
+
+// Bounding volume hierarchy over the triangles of one mesh, for ray and sphere queries on the CPU. Leaves hold
+// up to Bvh::LEAF_SIZE triangles, tested against rays in one call to the batch geometry triangle kernel. Only
+// triangle indices are kept, positions are read from the source on every query
+class TriangleBvh {
+public:
+    // Subtrees of large meshes are built in parallel on the job system
+    void build(const TriangleSource &source);
+    bool empty() const { return tree.empty(); }
+    // Ray in the space of the triangles, hits are taken in [0, max_distance]. source must be the one built from
+    bool closestHit(const TriangleSource &source, const Eigen::Vector3f &origin, const Eigen::Vector3f &direction,
+                    float max_distance, TriangleHit &hit) const;
+    // Stops at the first hit found, for visibility tests
+    bool anyHit(const TriangleSource &source, const Eigen::Vector3f &origin, const Eigen::Vector3f &direction,
+                float max_distance) const;
+    // First triangle a sphere moving by motion touches within max_fraction of it. Triangles collide from both
+    // sides. One the sphere already overlaps stops it at once if it moves further in, and not if it moves out
+    bool sweepSphere(const TriangleSource &source, const Eigen::Vector3f &center, float radius,
+                     const Eigen::Vector3f &motion, float max_fraction, TriangleSweepHit &hit) const;
+    // False if empty
+    bool bounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) const {
+        return tree.bounds(min_corner, max_corner);
+    }
+    size_t memoryBytes() const { return tree.memoryBytes(); }
+
+private:
+    Bvh tree;
+
+    template<bool ANY_HIT>
+    bool intersect(const TriangleSource &source, const Eigen::Vector3f &origin, const Eigen::Vector3f &direction,
+                   float max_distance, TriangleHit &hit) const;
+};
+
+#endif //EMPTYGL_TRIANGLE_BVH_H
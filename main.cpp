@@ -1,15 +1,35 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <memory>
 
 #include <cxxopts.hpp>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <stb_image.h>
 
+#include "batch_renderer.h"
 #include "camera.h"
+#include "camera_collider.h"
+#include "camera_path.h"
+#include "draw_list.h"
+#include "frame_pacer.h"
+#include "frame_stats.h"
+#include "frame_view.h"
 #include "geometry.h"
+#include "job_system.h"
+#include "memory_tracker.h"
+#include "multi_view_renderer.h"
+#include "profiler.h"
+#include "render_thread.h"
+#include "ring_buffer.h"
 #include "scene.h"
 #include "shader.h"
+#include "shader_reloader.h"
+#include "shadow_cascades.h"
+#include "texture_cooker.h"
+#include "texture_streamer.h"
 
 using std::cout;
 using std::cerr;
@@ -24,6 +44,10 @@ bool initWindowManager() {
 
 auto camera = make_shared<Camera>(0, 0, 5, 0, 1, 0, 0, 0);
 
+// Set by the resize callback, applied by whichever thread renders
+std::atomic<bool> framebuffer_resized{false};
+std::atomic<int> framebuffer_width{0}, framebuffer_height{0};
+
 void scroll_callback(GLFWwindow* window, double x_offset, double y_offset) {
     camera->processMouseScroll(static_cast<float>(y_offset));
 }
@@ -49,11 +73,13 @@ void mouse_callback(GLFWwindow* window, double x, double y) {
 }
 
 // Create window
-shared_ptr<GLFWwindow> createWindowAndContext(const unsigned int width, const unsigned int height) {
+shared_ptr<GLFWwindow> createWindowAndContext(const unsigned int width, const unsigned int height,
+                                              bool visible=true) {
     // OpenGL context setup
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
 
     // Create window with OpenGL context
     shared_ptr<GLFWwindow> window(glfwCreateWindow(width, height, "ToonShading", nullptr, nullptr));
@@ -65,10 +91,12 @@ shared_ptr<GLFWwindow> createWindowAndContext(const unsigned int width, const un
     // Make context current for this window
     glfwMakeContextCurrent(window.get());
 
-    // Handle window resize
+    // Handle window resize. The context may be current on the render thread, so the viewport is set there
     glfwSetFramebufferSizeCallback(window.get(),
                                    [](GLFWwindow *window, const int width, const int height){
-                                       glViewport(0, 0, width, height);
+                                       framebuffer_width = width;
+                                       framebuffer_height = height;
+                                       framebuffer_resized = true;
                                    });
 
     // Handle mouse input
@@ -97,6 +125,38 @@ void processInput(GLFWwindow *window, Camera *camera, float delta_time) {
         camera->processKeyboard(LEFT, delta_time);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera->processKeyboard(RIGHT, delta_time);
+
+    // Memory report on key release
+    static bool memory_key_pressed = false;
+    bool memory_key_down = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (memory_key_pressed && !memory_key_down)
+        MemoryTracker::instance().report(cout);
+    memory_key_pressed = memory_key_down;
+}
+
+// A left click reports the triangle at the screen center, where the disabled cursor keeps the camera aimed
+void processPicking(GLFWwindow *window, const Camera &camera, Scene *scene, unsigned int width, unsigned int height) {
+    static bool pick_button_pressed = false;
+    bool pick_button_down = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+    bool clicked = pick_button_down && !pick_button_pressed;
+    pick_button_pressed = pick_button_down;
+    if (!clicked)
+        return;
+
+    FrameView view;
+    view.update(camera, width, height);
+    Ray ray = screenRay(view.view(), view.projection(), width / 2.0f, height / 2.0f, static_cast<float>(width),
+                        static_cast<float>(height));
+    uint64_t begin_ns = Profiler::now();
+    RayHit hit;
+    bool found = scene->raycast(Eigen::Matrix4f::Identity(), ray, hit);
+    double elapsed_ms = static_cast<double>(Profiler::now() - begin_ns) / 1e6;
+    if (found) {
+        cout << "Picked mesh " << hit.mesh << " triangle " << hit.triangle << " at distance " << hit.distance
+             << " (" << elapsed_ms << " ms)" << endl;
+    } else {
+        cout << "Picked nothing (" << elapsed_ms << " ms)" << endl;
+    }
 }
 
 int main(int argc, char** argv) {
@@ -108,6 +168,62 @@ int main(int argc, char** argv) {
         ("fragment", "Fragment shader path", cxxopts::value<std::string>()->default_value("../shaders/empty.frag"))
         ("width", "Screen resolution in width", cxxopts::value<unsigned int>()->default_value("1920"))
         ("height", "Screen resolution in height", cxxopts::value<unsigned int>()->default_value("1080"))
+        ("poses", "Camera pose file, renders every pose offscreen instead of opening the viewer",
+         cxxopts::value<std::string>()->default_value(""))
+        ("output", "Output directory for batch rendered images", cxxopts::value<std::string>()->default_value("."))
+        ("workers", "Job system worker threads, 0 for one per core besides the main thread",
+         cxxopts::value<unsigned int>()->default_value("0"))
+        ("views", "Poses rendered together into the layers of one framebuffer in batch mode, at most 8. Implies "
+                  "--permutations above 1", cxxopts::value<unsigned int>()->default_value("1"))
+        ("profile", "Record CPU/GPU timings and write a Chrome trace to this path on exit",
+         cxxopts::value<std::string>()->default_value(""))
+        ("record", "Record the camera pose of every frame to this path", cxxopts::value<std::string>()->default_value(""))
+        ("replay", "Replay a recorded camera path and report frame time statistics",
+         cxxopts::value<std::string>()->default_value(""))
+        ("frames", "Frame count of a replay, 0 for one pass over the path",
+         cxxopts::value<unsigned int>()->default_value("0"))
+        ("timestep", "Fixed timestep of a replay in seconds", cxxopts::value<float>()->default_value("0.016666667"))
+        ("headless", "Render into a hidden window")
+        ("shader-cache", "Directory of cached shader program binaries, empty disables",
+         cxxopts::value<std::string>()->default_value("shader_cache"))
+        ("texture-compression", "Texture block compression: none, fast (BC1/BC3/BC5) or high (BC7/BC5)",
+         cxxopts::value<std::string>()->default_value("fast"))
+        ("texture-cache", "Directory of cooked textures, empty disables",
+         cxxopts::value<std::string>()->default_value("texture_cache"))
+        ("mip-filter", "Texture mip chain filter: box or kaiser", cxxopts::value<std::string>()->default_value("kaiser"))
+        ("texture-budget", "Stream texture mip levels by screen-space demand within this many MB of VRAM, "
+                           "0 keeps every level resident. Ignored in batch mode",
+         cxxopts::value<unsigned int>()->default_value("0"))
+        ("permutations", "Draw with per-material shader permutations instead of the uber-shader")
+        ("draw-buffers", "Stream per-frame and per-draw data through a persistently mapped ring buffer, "
+                         "implies --permutations")
+        ("shadows", "Cascaded shadow maps with this many cascades, at most 4. 0 disables, implies --permutations "
+                    "otherwise. Ignored in batch mode", cxxopts::value<unsigned int>()->default_value("0"))
+        ("shadow-resolution", "Width and height of each shadow cascade",
+         cxxopts::value<unsigned int>()->default_value("2048"))
+        ("shadow-vertex", "Shadow depth pass vertex shader path",
+         cxxopts::value<std::string>()->default_value("../shaders/shadow_depth.vert"))
+        ("shadow-fragment", "Shadow depth pass fragment shader path",
+         cxxopts::value<std::string>()->default_value("../shaders/shadow_depth.frag"))
+        ("render-thread", "Render on a dedicated thread while input and simulation run on the main thread. "
+                          "Ignored when replaying")
+        ("sim-rate", "Fixed simulation steps per second with --render-thread",
+         cxxopts::value<float>()->default_value("120"))
+        ("frames-in-flight", "Frames the driver may queue ahead of the display, 0 leaves it to the driver",
+         cxxopts::value<unsigned int>()->default_value("0"))
+        ("fps-cap", "Frame-rate cap, 0 disables", cxxopts::value<float>()->default_value("0"))
+        ("latency-report", "Print input to present latency statistics on exit")
+        ("draw-lists", "Record culled draw lists in jobs and replay them on the GL thread, implies "
+                       "--permutations. Ignored in batch mode")
+        ("watch-shaders", "Rebuild shaders when their source files change")
+        ("shader-info", "Print the reflected interface of the shader program")
+        ("memory-report", "Print CPU/GPU memory per asset after loading. M prints it at any time")
+        ("no-picking", "Disable left click picking and skip building its ray query BVHs")
+        ("collision", "Camera collision with the scene: none, fly (slide along surfaces) or walk (also gravity "
+                      "and steps)", cxxopts::value<std::string>()->default_value("none"))
+        ("collision-radius", "Radius of the sphere around the eye that collides",
+         cxxopts::value<float>()->default_value("0.2"))
+        ("eye-height", "Eye height above the floor when walking", cxxopts::value<float>()->default_value("1.7"))
         ;
     auto args = options.parse(argc, argv);
     const std::string mesh_file_path = args["mesh"].as<std::string>();
@@ -115,6 +231,47 @@ int main(int argc, char** argv) {
     const std::string fragment_file_path = args["fragment"].as<std::string>();
     const unsigned int screen_width = args["width"].as<unsigned int>();
     const unsigned int screen_height = args["height"].as<unsigned int>();
+    const std::string pose_file_path = args["poses"].as<std::string>();
+    const std::string output_directory = args["output"].as<std::string>();
+    const unsigned int n_workers = args["workers"].as<unsigned int>();
+    const bool batch_mode = !pose_file_path.empty();
+    const std::string profile_file_path = args["profile"].as<std::string>();
+    Profiler::instance().setEnabled(!profile_file_path.empty());
+    const std::string record_file_path = args["record"].as<std::string>();
+    const std::string replay_file_path = args["replay"].as<std::string>();
+    const bool replay_mode = !replay_file_path.empty();
+    const float replay_timestep = args["timestep"].as<float>();
+    unsigned int replay_frames = args["frames"].as<unsigned int>();
+    const bool headless = args["headless"].as<bool>() || batch_mode;
+    const bool memory_report = args["memory-report"].as<bool>();
+    const std::string shader_cache_directory = args["shader-cache"].as<std::string>();
+    const std::string texture_compression = args["texture-compression"].as<std::string>();
+    const std::string texture_cache_directory = args["texture-cache"].as<std::string>();
+    const std::string mip_filter = args["mip-filter"].as<std::string>();
+    const unsigned int texture_budget = args["texture-budget"].as<unsigned int>();
+    const bool watch_shaders = args["watch-shaders"].as<bool>();
+    const bool use_render_thread = args["render-thread"].as<bool>() && !replay_mode;
+    const double simulation_timestep = 1.0 / std::max(args["sim-rate"].as<float>(), 1.0f);
+    const unsigned int max_frames_in_flight = args["frames-in-flight"].as<unsigned int>();
+    const float fps_cap = args["fps-cap"].as<float>();
+    const bool latency_report = args["latency-report"].as<bool>();
+    const bool use_draw_buffers = args["draw-buffers"].as<bool>();
+    const unsigned int n_shadow_cascades = batch_mode ? 0 : args["shadows"].as<unsigned int>();
+    const unsigned int shadow_resolution = args["shadow-resolution"].as<unsigned int>();
+    const unsigned int n_views = batch_mode ? std::min(std::max(args["views"].as<unsigned int>(), 1u),
+                                                            MultiViewRenderer::MAX_VIEWS) : 1;
+    const bool use_draw_lists = args["draw-lists"].as<bool>() && !batch_mode;
+    const bool use_permutations = args["permutations"].as<bool>() || use_draw_buffers || n_shadow_cascades > 0 ||
+                                  n_views > 1 || use_draw_lists;
+    // Extra feature bits of every permutation drawn
+    const unsigned int draw_features = (use_draw_buffers && n_views == 1 ? SHADER_FEATURE_DRAW_DATA : 0) |
+                                       (n_shadow_cascades > 0 ? SHADER_FEATURE_SHADOWS : 0) |
+                                       (n_views > 1 ? SHADER_FEATURE_MULTIVIEW : 0);
+    const bool shader_info = args["shader-info"].as<bool>();
+    const bool use_picking = !args["no-picking"].as<bool>() && !batch_mode && !replay_mode;
+    const std::string collision_mode = batch_mode || replay_mode ? "none" : args["collision"].as<std::string>();
+    const float collision_radius = args["collision-radius"].as<float>();
+    const float eye_height = args["eye-height"].as<float>();
 
     // Set up window and OpenGL context
     if (!initWindowManager()) {
@@ -122,60 +279,344 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    shared_ptr<GLFWwindow> window = createWindowAndContext(screen_width, screen_height);
+    shared_ptr<GLFWwindow> window = createWindowAndContext(screen_width, screen_height, !headless);
+    // Texture cooking, image writing and draw recording all run their jobs here
+    JobSystem::instance().start(n_workers);
 
     // Set up camera
 
     // Set up shaders
     glEnable(GL_DEPTH_TEST);
-    auto shader = make_shared<Shader>(vertex_file_path, fragment_file_path);
+    Shader::setBinaryCacheDirectory(shader_cache_directory);
+    // Programs compile in the driver while the model imports
+    ShaderCompileQueue shader_queue;
+    auto shader = make_shared<Shader>(vertex_file_path, fragment_file_path, true);
+    shader_queue.add(shader);
+    ShaderVariants shader_variants(vertex_file_path, fragment_file_path);
+    if (use_permutations) {
+        shader_variants.prepare(draw_features);
+        shader_variants.prepare(SHADER_FEATURE_TEXTURE | draw_features);
+    }
+
+    // Textures are cooked on import, or read back from the cache
+    if (texture_compression == "none") {
+        TextureCooker::setCompression(TEXTURE_COMPRESSION_NONE);
+    } else if (texture_compression == "high") {
+        TextureCooker::setCompression(TEXTURE_COMPRESSION_HIGH_QUALITY);
+    } else {
+        if (texture_compression != "fast")
+            cerr << "Unknown texture compression " << texture_compression << ", using fast" << endl;
+        TextureCooker::setCompression(TEXTURE_COMPRESSION_FAST);
+    }
+    TextureCooker::setCacheDirectory(texture_cache_directory);
+    TextureCooker::setMipFilter(mip_filter == "box" ? MIP_FILTER_BOX : MIP_FILTER_KAISER);
+    std::unique_ptr<TextureStreamer> texture_streamer;
+    if (texture_budget > 0 && !batch_mode) {
+        texture_streamer.reset(new TextureStreamer(static_cast<size_t>(texture_budget) << 20));
+        Scene::setTextureStreamer(texture_streamer.get());
+    }
 
     // Load model
     cout << "Loading model..." << endl;
     vector<string> mesh_file_path_list = {mesh_file_path};
     auto scene = make_shared<Scene>(mesh_file_path_list);
     cout << "Model loaded!" << endl;
+    std::unique_ptr<CameraCollider> collider;
+    if (collision_mode == "fly" || collision_mode == "walk") {
+        collider.reset(new CameraCollider(scene.get(), collision_mode == "walk" ? COLLISION_WALK : COLLISION_FLY,
+                                          collision_radius, eye_height));
+    } else if (collision_mode != "none") {
+        cerr << "Unknown collision mode " << collision_mode << ", collision disabled" << endl;
+    }
+    // Up front, so the first click or move does not build them
+    if (use_picking || collider)
+        scene->prepareRayQueries();
+    if (use_permutations) {
+        // Meshes chose their permutation while loading
+        for (unsigned int features: scene->shaderFeatureSets())
+            shader_variants.prepare(features | draw_features);
+        shader_variants.wait();
+    }
+    shader_queue.waitAll();
+
+    // Validate what the meshes feed against what the programs consume, once instead of every draw
+    shader->checkVertexLayout(Mesh::vertexLayout());
+    for (auto &variant: shader_variants.variants())
+        variant.second->checkVertexLayout(Mesh::vertexLayout());
+    if (shader_info)
+        shader->reflection().print(cout);
+    if (memory_report) {
+        MemoryUsage scene_usage = scene->memoryUsage();
+        cout << "Scene: " << scene_usage.cpu_bytes << " bytes CPU, " << scene_usage.gpu_bytes << " bytes GPU" << endl;
+        MemoryTracker::instance().report(cout);
+    }
 
-    // Main loop
-    float last_frame_time = 0.0f;
-    while (!glfwWindowShouldClose(window.get())) {
-        // Timing
-        auto current_time = static_cast<float>(glfwGetTime());
-        float delta_time = current_time - last_frame_time;
-        last_frame_time = current_time;
+    // Batch job mode
+    if (batch_mode) {
+        vector<CameraPose> poses = loadCameraPoses(pose_file_path);
+        BatchRenderer batch_renderer(screen_width, screen_height, n_views);
+
+        double start_time = glfwGetTime();
+        unsigned int n_images = n_views > 1 ? batch_renderer.render(scene.get(), &shader_variants, draw_features,
+                                                                    poses, output_directory)
+                                            : batch_renderer.render(scene.get(), shader.get(), poses, output_directory);
+        double elapsed_time = glfwGetTime() - start_time;
+
+        cout << "Rendered " << n_images << " images in " << elapsed_time << "s ("
+             << (elapsed_time > 0.0 ? n_images / elapsed_time : 0.0) << " images/s)" << endl;
+        shader->release();
+        shader_variants.release();
+        JobSystem::instance().stop();
+        if (!profile_file_path.empty())
+            Profiler::instance().exportChromeTrace(profile_file_path);
+        return 0;
+    }
+
+    // Camera path recording and replay
+    CameraPathRecorder recorder;
+    if (!record_file_path.empty())
+        recorder.open(record_file_path);
+    vector<CameraPose> replay_path;
+    if (replay_mode) {
+        replay_path = loadCameraPoses(replay_file_path);
+        if (replay_path.empty()) {
+            cerr << "Camera path is empty: " << replay_file_path << endl;
+            return -1;
+        }
+        if (replay_frames == 0)
+            replay_frames = static_cast<unsigned int>(replay_path.size());
+        glfwSwapInterval(0); // Measure the renderer, not the display refresh
+    }
+    FrameTimeStats frame_stats;
+    std::unique_ptr<DynamicRingBuffer> draw_buffer;
+    if (use_draw_buffers) {
+        // One frame block plus one draw block per mesh, each at the uniform offset alignment
+        size_t alignment = DynamicRingBuffer::offsetAlignment(GL_UNIFORM_BUFFER);
+        size_t block_size = (32 * sizeof(float) + alignment - 1) / alignment * alignment;
+        draw_buffer.reset(new DynamicRingBuffer(block_size * (scene->meshCount() + 1)));
+    }
+    std::unique_ptr<ShadowCascades> shadow_cascades;
+    if (n_shadow_cascades > 0) {
+        shadow_cascades.reset(new ShadowCascades(args["shadow-vertex"].as<std::string>(),
+                                                 args["shadow-fragment"].as<std::string>(), n_shadow_cascades,
+                                                 shadow_resolution));
+    }
+    std::unique_ptr<DrawListRecorder> draw_list_recorder;
+    if (use_draw_lists)
+        draw_list_recorder.reset(new DrawListRecorder());
+    ShaderHotReloader shader_reloader;
+    if (watch_shaders) {
+        shader_reloader.add(shader);
+        shader_reloader.add(&shader_variants);
+    }
 
-        // Process user input
-        processInput(window.get(), camera.get(), delta_time);
+    // Draw and present one frame, on whichever thread owns the context
+    FrameView frame_view(0.1f, 1000.0f);
+    FramePacer frame_pacer(max_frames_in_flight, fps_cap);
+    // draw_lists, if given, were recorded for this camera on the simulation thread
+    auto render_frame = [&](const Camera &view_camera, const Eigen::Matrix4f &model_matrix,
+                            const vector<DrawList> *draw_lists) {
+        if (framebuffer_resized.exchange(false))
+            glViewport(0, 0, framebuffer_width, framebuffer_height);
+        // GL work other threads handed over
+        JobSystem::instance().pumpMainThread();
+
+        // Frame boundary, the only place programs get swapped
+        if (watch_shaders)
+            shader_reloader.update();
+
+            // View and projection transformation, rebuilt only when the camera moved
+        frame_view.update(view_camera, screen_width, screen_height);
+        const Eigen::Matrix4f &projection_matrix = frame_view.projection();
+        const Eigen::Matrix4f &view_matrix = frame_view.view();
+
+        // Shadow pass, cascades whose contents did not change are kept from earlier frames
+        if (shadow_cascades) {
+            shadow_cascades->render(frame_view, scene.get(), model_matrix);
+            shadow_cascades->apply(shader_variants);
+        }
 
         // One render pass
             // Clear all buffers
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-            // Activate shader
-        shader->use();
-
-            // Projection transformation
-        Eigen::Matrix4f projection_matrix = perspective(degree2Radian(camera->zoom),
-                                                        (float) screen_width / (float) screen_height,
-                                                        0.1f, 1000.0f);
-        Eigen::Matrix4f view_matrix = camera->getViewMatrix();
-        Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
-
-        shader->setMat4("model", model_matrix);
-        shader->setMat4("view", view_matrix);
-        shader->setMat4("projection", projection_matrix);
-
-            // Draw
-        scene->draw(shader.get());
+        if (texture_streamer) {
+            scene->requestTextureLevels(texture_streamer.get(), model_matrix, frame_view);
+            texture_streamer->update();
+        }
+
+        if (use_draw_buffers) {
+            draw_buffer->beginFrame();
+            DynamicRingBuffer::Allocation frame_data = draw_buffer->allocate(32 * sizeof(float));
+            Eigen::Map<Eigen::Matrix4f>(static_cast<float *>(frame_data.data)) = view_matrix;
+            Eigen::Map<Eigen::Matrix4f>(static_cast<float *>(frame_data.data) + 16) = projection_matrix;
+            draw_buffer->bindRange(0, frame_data);
+
+                // Draw
+            if (draw_list_recorder) {
+                draw_list_recorder->draw(scene.get(), &shader_variants, draw_buffer.get(), frame_view, model_matrix,
+                                         draw_features);
+            } else {
+                scene->draw(&shader_variants, draw_buffer.get(), model_matrix, frame_view, draw_features);
+            }
+            draw_buffer->endFrame();
+        } else if (use_permutations) {
+            shader_variants.setMat4("model", model_matrix);
+            shader_variants.setMat4("view", view_matrix);
+            shader_variants.setMat4("projection", projection_matrix);
+
+                // Draw
+            if (draw_lists) {
+                draw_list_recorder->replay(*draw_lists);
+            } else if (draw_list_recorder) {
+                draw_list_recorder->draw(scene.get(), &shader_variants, nullptr, frame_view, model_matrix,
+                                         draw_features);
+            } else {
+                scene->draw(&shader_variants, draw_features);
+            }
+        } else {
+                // Activate shader
+            shader->use();
+
+            shader->setMat4("model", model_matrix);
+            shader->setMat4("view", view_matrix);
+            shader->setMat4("projection", projection_matrix);
+
+                // Draw
+            scene->draw(shader.get());
+        }
 
         // New frame
-        glfwPollEvents();
-        glfwSwapBuffers(window.get());
+        {
+            PROFILE_SCOPE("glfwSwapBuffers");
+            glfwSwapBuffers(window.get());
+        }
+        Profiler::instance().newFrame();
+    };
+
+    if (use_render_thread) {
+        // Without a draw buffer, draw lists need no per-frame GL allocations and the simulation thread records
+        // them into the snapshots. Hot reloading changes the programs they name, so it keeps them on the GL thread
+        const bool record_on_simulation = draw_list_recorder && !use_draw_buffers && !watch_shaders;
+        SceneRecording simulation_recording;
+        FrameView simulation_view(0.1f, 1000.0f);
+        if (record_on_simulation) {
+            scene->prepareRecording(&shader_variants, nullptr, Eigen::Matrix4f::Identity(), simulation_view,
+                                    draw_features, simulation_recording);
+        }
+
+        // The render thread takes the context, this thread only handles events and steps the simulation
+        glfwMakeContextCurrent(nullptr);
+        Camera render_camera;
+        RenderThread render_thread([&window] {
+                                       glfwMakeContextCurrent(window.get());
+                                       JobSystem::instance().setMainThread();
+                                   },
+                                   [&](const FrameSnapshot &snapshot) {
+                                       applyCameraPose(snapshot.camera, &render_camera);
+                                       render_frame(render_camera, snapshot.model,
+                                                    snapshot.draw_lists.empty() ? nullptr : &snapshot.draw_lists);
+                                   },
+                                   [] { glfwMakeContextCurrent(nullptr); }, &frame_pacer);
+
+        FrameSnapshot snapshot;
+        uint64_t tick = 0;
+        double next_step_time = glfwGetTime();
+        while (!glfwWindowShouldClose(window.get())) {
+            // Sleep until input arrives or the next step is due
+            glfwWaitEventsTimeout(std::max(next_step_time - glfwGetTime(), 0.0));
+            double current_time = glfwGetTime();
+            // After a long stall, drop the backlog instead of simulating it all at once
+            if (current_time - next_step_time > 0.25)
+                next_step_time = current_time;
+            bool stepped = false;
+            while (next_step_time <= current_time) {
+                Eigen::Vector3f previous_position = camera->position;
+                processInput(window.get(), camera.get(), static_cast<float>(simulation_timestep));
+                if (collider)
+                    collider->constrain(camera.get(), previous_position, static_cast<float>(simulation_timestep));
+                if (use_picking)
+                    processPicking(window.get(), *camera, scene.get(), screen_width, screen_height);
+                if (recorder.isOpen())
+                    recorder.record(*camera);
+                ++tick;
+                next_step_time += simulation_timestep;
+                stepped = true;
+            }
+            if (stepped) {
+                snapshot.tick = tick;
+                snapshot.camera = captureCameraPose(*camera);
+                snapshot.model = Eigen::Matrix4f::Identity();
+                if (record_on_simulation) {
+                    simulation_view.update(*camera, screen_width, screen_height);
+                    scene->updateRecording(snapshot.model, simulation_view, simulation_recording);
+                    DrawListRecorder::record(scene.get(), simulation_recording, snapshot.draw_lists);
+                }
+                snapshot.input_time_ns = Profiler::now();
+                render_thread.submit(snapshot);
+            }
+        }
+        render_thread.stop();
+        glfwMakeContextCurrent(window.get());
+        JobSystem::instance().setMainThread();
+    } else {
+        float last_frame_time = 0.0f;
+        unsigned int frame_index = 0;
+        while (!glfwWindowShouldClose(window.get())) {
+            frame_pacer.beginFrame();
+            // Late latch: events are read only after pacing waited, right before the frame is built
+            glfwPollEvents();
+
+            // Timing
+            auto current_time = static_cast<float>(glfwGetTime());
+            float delta_time = current_time - last_frame_time;
+            last_frame_time = current_time;
+
+            if (replay_mode) {
+                // Deterministic camera and time step, only the frame time is measured
+                frame_stats.tick();
+                if (frame_index == replay_frames)
+                    break;
+                delta_time = replay_timestep;
+                applyCameraPose(replay_path[frame_index % replay_path.size()], camera.get());
+            } else {
+                // Process user input
+                Eigen::Vector3f previous_position = camera->position;
+                processInput(window.get(), camera.get(), delta_time);
+                if (collider)
+                    collider->constrain(camera.get(), previous_position, delta_time);
+                if (use_picking)
+                    processPicking(window.get(), *camera, scene.get(), screen_width, screen_height);
+            }
+            if (recorder.isOpen())
+                recorder.record(*camera);
+            ++frame_index;
+
+            uint64_t input_time = Profiler::now();
+            render_frame(*camera, Eigen::Matrix4f::Identity(), nullptr);
+            frame_pacer.endFrame(input_time);
+        }
+    }
+
+    if (replay_mode)
+        frame_stats.report(cout);
+    if (latency_report) {
+        cout << "Input to present latency" << endl;
+        frame_pacer.latencyStats().report(cout);
     }
 
     // Release resources
     shader->release();
+    shader_variants.release();
+    draw_buffer.reset();
+    shadow_cascades.reset();
+    draw_list_recorder.reset();
+    Scene::setTextureStreamer(nullptr);
+    texture_streamer.reset();
+    JobSystem::instance().stop();
+    if (!profile_file_path.empty())
+        Profiler::instance().exportChromeTrace(profile_file_path);
 
 	return 0;
 }
\ No newline at end of file
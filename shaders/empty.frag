@@ -4,9 +4,58 @@ in vec3 our_color;
 in vec2 texture_coordinate;
 
 uniform sampler2D texture1;
+#ifndef SHADER_PERMUTATION
+uniform bool use_texture;
+#endif
+
+#ifdef USE_DRAW_DATA
+layout (std140, binding = 1) uniform DrawData {
+    mat4 model;
+    vec4 base_color;
+};
+#define untextured_color base_color
+#else
+const vec4 untextured_color = vec4(0.8, 0.8, 0.8, 1.0);
+#endif
+
+#ifdef USE_SHADOWS
+// See ShadowCascades::apply
+#define SHADOW_CASCADES 4
+in vec3 world_position;
+in float view_depth;
+uniform sampler2DArrayShadow shadow_map;
+uniform mat4 shadow_matrices[SHADOW_CASCADES];
+uniform vec4 shadow_splits; // View distance where each cascade ends
+
+// 1 lit, 0 shadowed
+float shadowFactor() {
+    if (view_depth > shadow_splits[SHADOW_CASCADES - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < SHADOW_CASCADES - 1 && view_depth > shadow_splits[cascade])
+        ++cascade;
+    vec3 coordinate = (shadow_matrices[cascade] * vec4(world_position, 1.0)).xyz * 0.5 + 0.5;
+    // 3x3 taps, each a bilinear 2x2 comparison
+    vec2 texel = 1.0 / vec2(textureSize(shadow_map, 0).xy);
+    float lit = 0.0;
+    for (int y = -1; y <= 1; ++y)
+        for (int x = -1; x <= 1; ++x)
+            lit += texture(shadow_map, vec4(coordinate.xy + vec2(x, y) * texel, cascade, coordinate.z));
+    return lit / 9.0;
+}
+#endif
 
 out vec4 fragment_color;
 
 void main() {
+#if defined(HAS_TEXTURE)
     fragment_color = texture(texture1, texture_coordinate);
+#elif defined(SHADER_PERMUTATION)
+    fragment_color = untextured_color;
+#else
+    fragment_color = use_texture ? texture(texture1, texture_coordinate) : untextured_color;
+#endif
+#ifdef USE_SHADOWS
+    fragment_color.rgb *= mix(0.35, 1.0, shadowFactor());
+#endif
 }
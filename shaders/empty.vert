@@ -1,16 +1,67 @@
 #version 430 core
+#ifdef USE_MULTIVIEW
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+#endif
 
 layout (location = 0) in vec3 a_position;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_texture_coordinate;
 
 out vec2 texture_coordinate;
+#ifdef USE_SHADOWS
+out vec3 world_position;
+out float view_depth;
+#endif
 
+#ifdef USE_DRAW_DATA
+// Written into the dynamic ring buffer, see Scene::draw
+layout (std140, binding = 0) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+};
+layout (std140, binding = 1) uniform DrawData {
+    mat4 model;
+    vec4 base_color;
+};
+#elif defined(USE_MULTIVIEW)
+// One view projection per layer of the target, see MultiViewRenderer
+#define MAX_VIEWS 8
+layout (std140, binding = 2) uniform MultiViewData {
+    mat4 view_projections[MAX_VIEWS];
+};
+uniform mat4 model;
+#if defined(GL_ARB_shader_viewport_layer_array) || defined(GL_AMD_vertex_shader_layer)
+// Single pass, instanced once per view
+#define LAYERED_VERTEX_OUTPUT
+uniform int view_count;
+#else
+// One pass per view
+uniform int view_index;
+#endif
+#else
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+#endif
 
 void main() {
-    gl_Position = projection * view * model * vec4(a_position, 1.0);
+    vec4 world = model * vec4(a_position, 1.0);
+#if defined(USE_MULTIVIEW) && !defined(USE_DRAW_DATA)
+#ifdef LAYERED_VERTEX_OUTPUT
+    int view_index = gl_InstanceID % view_count;
+    gl_Layer = view_index;
+#endif
+    gl_Position = view_projections[view_index] * world;
+    float depth = gl_Position.w;
+#else
+    vec4 view_position = view * world;
+    gl_Position = projection * view_position;
+    float depth = -view_position.z;
+#endif
     texture_coordinate = a_texture_coordinate;
-}
\ No newline at end of file
+#ifdef USE_SHADOWS
+    world_position = world.xyz;
+    view_depth = depth;
+#endif
+}
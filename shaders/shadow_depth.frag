@@ -0,0 +1,5 @@
+#version 430 core
+
+// Depth only, nothing to write
+void main() {
+}
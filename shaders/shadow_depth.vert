@@ -0,0 +1,10 @@
+#version 430 core
+
+layout (location = 0) in vec3 a_position;
+
+uniform mat4 model;
+uniform mat4 light_view_projection;
+
+void main() {
+    gl_Position = light_view_projection * model * vec4(a_position, 1.0);
+}
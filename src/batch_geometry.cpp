@@ -0,0 +1,182 @@
+//
+// Created by Andrew on 5/27/2021.
+//
+
+#include "batch_geometry.h"
+
+#include <atomic>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+
+#include "batch_geometry_kernels.h"
+
+namespace {
+
+std::atomic<int> active_level(-1);
+
+bool cpuHasAvx2() {
+#if defined(BATCH_GEOMETRY_SSE2) && (defined(__GNUC__) || defined(__clang__))
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#elif defined(BATCH_GEOMETRY_SSE2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0, os_saves_ymm = (info[2] & (1 << 27)) != 0;
+    // The OS must also save the YMM registers on context switches
+    if (!fma || !os_saves_ymm || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+const BatchKernels &kernelsFor(SimdLevel level) {
+    static const BatchKernels scalar = makeBatchKernels<ScalarOps>();
+    switch (level) {
+#ifdef BATCH_GEOMETRY_SSE2
+        case SIMD_SSE2: {
+            static const BatchKernels sse2 = makeBatchKernels<Sse2Ops>();
+            return sse2;
+        }
+        case SIMD_AVX2:
+            return *avx2BatchKernels();
+#endif
+#ifdef BATCH_GEOMETRY_NEON
+        case SIMD_NEON: {
+            static const BatchKernels neon = makeBatchKernels<NeonOps>();
+            return neon;
+        }
+#endif
+        default:
+            return scalar;
+    }
+}
+
+const BatchKernels &kernels() {
+    return kernelsFor(simdLevel());
+}
+
+}
+
+SimdLevel detectSimdLevel() {
+#if defined(BATCH_GEOMETRY_SSE2)
+    static const SimdLevel level = cpuHasAvx2() && avx2BatchKernels() ? SIMD_AVX2 : SIMD_SSE2;
+    return level;
+#elif defined(BATCH_GEOMETRY_NEON)
+    return SIMD_NEON;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+SimdLevel simdLevel() {
+    int level = active_level.load(std::memory_order_relaxed);
+    if (level < 0) {
+        level = detectSimdLevel();
+        active_level.store(level, std::memory_order_relaxed);
+    }
+    return static_cast<SimdLevel>(level);
+}
+
+bool setSimdLevel(SimdLevel level) {
+    SimdLevel detected = detectSimdLevel();
+    bool supported = level == SIMD_SCALAR || level == detected || (level == SIMD_SSE2 && detected == SIMD_AVX2);
+    if (supported)
+        active_level.store(level, std::memory_order_relaxed);
+    return supported;
+}
+
+const char *simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE2:
+            return "sse2";
+        case SIMD_AVX2:
+            return "avx2";
+        case SIMD_NEON:
+            return "neon";
+        default:
+            return "scalar";
+    }
+}
+
+void PointsSoA::resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+}
+
+void BoundsSoA::resize(size_t n) {
+    min_x.resize(n);
+    min_y.resize(n);
+    min_z.resize(n);
+    max_x.resize(n);
+    max_y.resize(n);
+    max_z.resize(n);
+}
+
+void SpheresSoA::resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    z.resize(n);
+    radius.resize(n);
+}
+
+void ScreenRectsSoA::resize(size_t n) {
+    min_x.resize(n);
+    min_y.resize(n);
+    max_x.resize(n);
+    max_y.resize(n);
+    visibility.resize(n);
+}
+
+void transformPoints(const Eigen::Matrix4f &transform, const PointsSoA &points, PointsSoA &result,
+                     vector<float> *w) {
+    size_t n = points.size();
+    result.resize(n);
+    if (w)
+        w->resize(n);
+    kernels().transform_points(transform.data(), points.x.data(), points.y.data(), points.z.data(), n,
+                               result.x.data(), result.y.data(), result.z.data(), w ? w->data() : nullptr);
+}
+
+bool computeBounds(const PointsSoA &points, Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) {
+    if (points.size() == 0)
+        return false;
+    kernels().compute_bounds(points.x.data(), points.y.data(), points.z.data(), points.size(),
+                             min_corner.data(), max_corner.data());
+    return true;
+}
+
+void transformBounds(const Eigen::Matrix4f &transform, const BoundsSoA &bounds, BoundsSoA &result) {
+    result.resize(bounds.size());
+    const float *in[6] = {bounds.min_x.data(), bounds.min_y.data(), bounds.min_z.data(),
+                          bounds.max_x.data(), bounds.max_y.data(), bounds.max_z.data()};
+    float *out[6] = {result.min_x.data(), result.min_y.data(), result.min_z.data(),
+                     result.max_x.data(), result.max_y.data(), result.max_z.data()};
+    kernels().transform_bounds(transform.data(), in, bounds.size(), out);
+}
+
+void projectSpheres(const Eigen::Matrix4f &view, const Eigen::Matrix4f &projection, const SpheresSoA &spheres,
+                    ScreenRectsSoA &result) {
+    result.resize(spheres.size());
+    const float *in[4] = {spheres.x.data(), spheres.y.data(), spheres.z.data(), spheres.radius.data()};
+    float *out[4] = {result.min_x.data(), result.min_y.data(), result.max_x.data(), result.max_y.data()};
+    static_assert(sizeof(SphereVisibility) == 1, "visibility is written as bytes");
+    kernels().project_spheres(view.data(), projection.data(), in, spheres.size(), out,
+                              reinterpret_cast<unsigned char *>(result.visibility.data()));
+}
+
+void intersectTriangles(const Eigen::Vector3f &origin, const Eigen::Vector3f &direction,
+                        const float *const *triangles, size_t n, float *distance, float *u, float *v) {
+    float ray[6] = {origin[0], origin[1], origin[2], direction[0], direction[1], direction[2]};
+    float *hits[3] = {distance, u, v};
+    kernels().intersect_triangles(ray, triangles, n, hits);
+}
+
+void projectChannels(const float *const *channels, const float origin[4], const float direction[4], size_t n,
+                     float *result) {
+    kernels().project_channels(channels, origin, direction, n, result);
+}
@@ -0,0 +1,16 @@
+//
+// Created by Andrew on 5/27/2021.
+//
+
+// Built with AVX2 and FMA enabled, only called once the CPU has been checked for them
+
+#include "batch_geometry_kernels.h"
+
+const BatchKernels *avx2BatchKernels() {
+#ifdef BATCH_GEOMETRY_AVX2
+    static const BatchKernels kernels = makeBatchKernels<Avx2Ops>();
+    return &kernels;
+#else
+    return nullptr;
+#endif
+}
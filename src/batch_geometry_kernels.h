@@ -0,0 +1,420 @@
+//
+// Created by Andrew on 5/27/2021.
+//
+
+#ifndef EMPTYGL_BATCH_GEOMETRY_KERNELS_H
+#define EMPTYGL_BATCH_GEOMETRY_KERNELS_H
+
+// Kernels written once against a small vector type per instruction set. Included by batch_geometry.cpp and by
+// batch_geometry_avx2.cpp, which is the only file built with AVX2 enabled. Everything here has internal
+// linkage and calls no inline library functions, so code compiled for AVX2 never ends up called on CPUs without
+// it through the linker picking one copy of a shared inline function
+
+#include <cstddef>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BATCH_GEOMETRY_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__) && defined(__FMA__)
+#define BATCH_GEOMETRY_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define BATCH_GEOMETRY_NEON
+#include <arm_neon.h>
+#endif
+
+// Matrices are 16 floats in column order, as Eigen stores them
+struct BatchKernels {
+    void (*transform_points)(const float *m, const float *x, const float *y, const float *z, size_t n,
+                             float *out_x, float *out_y, float *out_z, float *out_w);
+    // n must be at least 1
+    void (*compute_bounds)(const float *x, const float *y, const float *z, size_t n, float *min, float *max);
+    // bounds and out are min x, y, z then max x, y, z arrays
+    void (*transform_bounds)(const float *m, const float *const *bounds, size_t n, float *const *out);
+    // spheres are x, y, z, radius arrays, rects min x, min y, max x, max y arrays
+    void (*project_spheres)(const float *view, const float *projection, const float *const *spheres, size_t n,
+                            float *const *rects, unsigned char *visibility);
+    // ray is origin x, y, z then direction x, y, z. triangles are corner x, y, z, first edge x, y, z, second edge
+    // x, y, z arrays, hits distance, u, v arrays
+    void (*intersect_triangles)(const float *ray, const float *const *triangles, size_t n, float *const *hits);
+    // values are four channel arrays, origin and direction four floats
+    void (*project_channels)(const float *const *values, const float *origin, const float *direction, size_t n,
+                             float *out);
+};
+
+// Defined in batch_geometry_avx2.cpp when the compiler targets x86
+const BatchKernels *avx2BatchKernels();
+
+namespace {
+
+struct ScalarOps {
+    typedef float Float;
+    typedef bool Mask;
+    static const size_t WIDTH = 1;
+
+    static Float load(const float *p) { return *p; }
+    static void store(float *p, Float v) { *p = v; }
+    static Float set(float v) { return v; }
+    static Float add(Float a, Float b) { return a + b; }
+    static Float sub(Float a, Float b) { return a - b; }
+    static Float mul(Float a, Float b) { return a * b; }
+    static Float div(Float a, Float b) { return a / b; }
+    static Float mulAdd(Float a, Float b, Float c) { return a * b + c; }
+    static Float min(Float a, Float b) { return a < b ? a : b; }
+    static Float max(Float a, Float b) { return a > b ? a : b; }
+    static Float sqrt(Float a) { return sqrtf(a); }
+    static Mask lessEqual(Float a, Float b) { return a <= b; }
+    static Float select(Mask m, Float a, Float b) { return m ? a : b; }
+};
+
+#ifdef BATCH_GEOMETRY_SSE2
+struct Sse2Ops {
+    typedef __m128 Float;
+    typedef __m128 Mask;
+    static const size_t WIDTH = 4;
+
+    static Float load(const float *p) { return _mm_loadu_ps(p); }
+    static void store(float *p, Float v) { _mm_storeu_ps(p, v); }
+    static Float set(float v) { return _mm_set1_ps(v); }
+    static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm_div_ps(a, b); }
+    static Float mulAdd(Float a, Float b, Float c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+    static Float sqrt(Float a) { return _mm_sqrt_ps(a); }
+    static Mask lessEqual(Float a, Float b) { return _mm_cmple_ps(a, b); }
+    static Float select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+};
+#endif
+
+#ifdef BATCH_GEOMETRY_AVX2
+struct Avx2Ops {
+    typedef __m256 Float;
+    typedef __m256 Mask;
+    static const size_t WIDTH = 8;
+
+    static Float load(const float *p) { return _mm256_loadu_ps(p); }
+    static void store(float *p, Float v) { _mm256_storeu_ps(p, v); }
+    static Float set(float v) { return _mm256_set1_ps(v); }
+    static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+    static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+    static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+    static Float div(Float a, Float b) { return _mm256_div_ps(a, b); }
+    static Float mulAdd(Float a, Float b, Float c) { return _mm256_fmadd_ps(a, b, c); }
+    static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+    static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+    static Float sqrt(Float a) { return _mm256_sqrt_ps(a); }
+    static Mask lessEqual(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static Float select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b, a, m); }
+};
+#endif
+
+#ifdef BATCH_GEOMETRY_NEON
+struct NeonOps {
+    typedef float32x4_t Float;
+    typedef uint32x4_t Mask;
+    static const size_t WIDTH = 4;
+
+    static Float load(const float *p) { return vld1q_f32(p); }
+    static void store(float *p, Float v) { vst1q_f32(p, v); }
+    static Float set(float v) { return vdupq_n_f32(v); }
+    static Float add(Float a, Float b) { return vaddq_f32(a, b); }
+    static Float sub(Float a, Float b) { return vsubq_f32(a, b); }
+    static Float mul(Float a, Float b) { return vmulq_f32(a, b); }
+    static Float div(Float a, Float b) { return vdivq_f32(a, b); }
+    static Float mulAdd(Float a, Float b, Float c) { return vfmaq_f32(c, a, b); }
+    static Float min(Float a, Float b) { return vminq_f32(a, b); }
+    static Float max(Float a, Float b) { return vmaxq_f32(a, b); }
+    static Float sqrt(Float a) { return vsqrtq_f32(a); }
+    static Mask lessEqual(Float a, Float b) { return vcleq_f32(a, b); }
+    static Float select(Mask m, Float a, Float b) { return vbslq_f32(m, a, b); }
+};
+#endif
+
+// Each body handles the whole vectors and returns how many elements it covered, the scalar body does the rest
+
+template<class Ops>
+size_t transformPointsBody(const float *m, const float *x, const float *y, const float *z, size_t n,
+                           float *out_x, float *out_y, float *out_z, float *out_w) {
+    typedef typename Ops::Float Float;
+    Float column[4][4];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r)
+            column[c][r] = Ops::set(m[c * 4 + r]);
+    size_t i = 0;
+    for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+        Float px = Ops::load(x + i), py = Ops::load(y + i), pz = Ops::load(z + i);
+        Float result[4];
+        for (int r = 0; r < 4; ++r)
+            result[r] = Ops::mulAdd(column[0][r], px, Ops::mulAdd(column[1][r], py,
+                                                                  Ops::mulAdd(column[2][r], pz, column[3][r])));
+        Ops::store(out_x + i, result[0]);
+        Ops::store(out_y + i, result[1]);
+        Ops::store(out_z + i, result[2]);
+        if (out_w)
+            Ops::store(out_w + i, result[3]);
+    }
+    return i;
+}
+
+template<class Ops>
+void transformPointsKernel(const float *m, const float *x, const float *y, const float *z, size_t n,
+                           float *out_x, float *out_y, float *out_z, float *out_w) {
+    size_t i = transformPointsBody<Ops>(m, x, y, z, n, out_x, out_y, out_z, out_w);
+    transformPointsBody<ScalarOps>(m, x + i, y + i, z + i, n - i, out_x + i, out_y + i, out_z + i,
+                                   out_w ? out_w + i : nullptr);
+}
+
+template<class Ops>
+void computeBoundsKernel(const float *x, const float *y, const float *z, size_t n, float *min, float *max) {
+    typedef typename Ops::Float Float;
+    const float *axes[3] = {x, y, z};
+    for (int a = 0; a < 3; ++a) {
+        min[a] = max[a] = axes[a][0];
+        size_t i = 0;
+        if (n >= Ops::WIDTH) {
+            Float low = Ops::load(axes[a]), high = low;
+            for (i = Ops::WIDTH; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+                Float value = Ops::load(axes[a] + i);
+                low = Ops::min(low, value);
+                high = Ops::max(high, value);
+            }
+            float lanes_low[Ops::WIDTH], lanes_high[Ops::WIDTH];
+            Ops::store(lanes_low, low);
+            Ops::store(lanes_high, high);
+            for (size_t lane = 0; lane < Ops::WIDTH; ++lane) {
+                min[a] = ScalarOps::min(min[a], lanes_low[lane]);
+                max[a] = ScalarOps::max(max[a], lanes_high[lane]);
+            }
+        }
+        for (; i < n; ++i) {
+            min[a] = ScalarOps::min(min[a], axes[a][i]);
+            max[a] = ScalarOps::max(max[a], axes[a][i]);
+        }
+    }
+}
+
+// Center and half extent form: the new extent along each axis is the absolute matrix times the old extent
+template<class Ops>
+size_t transformBoundsBody(const float *m, const float *const *bounds, size_t n, float *const *out) {
+    typedef typename Ops::Float Float;
+    Float linear[3][3], absolute[3][3], translation[3];
+    for (int c = 0; c < 3; ++c) {
+        for (int r = 0; r < 3; ++r) {
+            linear[c][r] = Ops::set(m[c * 4 + r]);
+            absolute[c][r] = Ops::set(fabsf(m[c * 4 + r]));
+        }
+        translation[c] = Ops::set(m[12 + c]);
+    }
+    Float half = Ops::set(0.5f);
+    size_t i = 0;
+    for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+        Float center[3], extent[3];
+        for (int a = 0; a < 3; ++a) {
+            Float low = Ops::load(bounds[a] + i), high = Ops::load(bounds[a + 3] + i);
+            center[a] = Ops::mul(Ops::add(low, high), half);
+            extent[a] = Ops::mul(Ops::sub(high, low), half);
+        }
+        for (int r = 0; r < 3; ++r) {
+            Float new_center = Ops::mulAdd(linear[0][r], center[0], Ops::mulAdd(linear[1][r], center[1],
+                    Ops::mulAdd(linear[2][r], center[2], translation[r])));
+            Float new_extent = Ops::mulAdd(absolute[0][r], extent[0], Ops::mulAdd(absolute[1][r], extent[1],
+                    Ops::mul(absolute[2][r], extent[2])));
+            Ops::store(out[r] + i, Ops::sub(new_center, new_extent));
+            Ops::store(out[r + 3] + i, Ops::add(new_center, new_extent));
+        }
+    }
+    return i;
+}
+
+template<class Ops>
+void transformBoundsKernel(const float *m, const float *const *bounds, size_t n, float *const *out) {
+    size_t i = transformBoundsBody<Ops>(m, bounds, n, out);
+    const float *bounds_tail[6];
+    float *out_tail[6];
+    for (int k = 0; k < 6; ++k) {
+        bounds_tail[k] = bounds[k] + i;
+        out_tail[k] = out[k] + i;
+    }
+    transformBoundsBody<ScalarOps>(m, bounds_tail, n - i, out_tail);
+}
+
+// Per axis, the two planes through the eye tangent to the sphere bound its projection. In the plane of that
+// axis and depth they are the tangent lines from the origin to a circle, which rotating the direction to the
+// center by the tangent angle gives without trigonometry
+template<class Ops>
+size_t projectSpheresBody(const float *view, const float *projection, const float *const *spheres, size_t n,
+                          float *const *rects, unsigned char *visibility) {
+    typedef typename Ops::Float Float;
+    Float rows[3][4];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            rows[r][c] = Ops::set(view[c * 4 + r]);
+    // The camera looks down -z: ndc x = P00 x / depth - P02 with depth = -z, the same for y
+    Float scale[2] = {Ops::set(projection[0]), Ops::set(projection[5])};
+    Float offset[2] = {Ops::set(projection[8]), Ops::set(projection[9])};
+    Float z_near = Ops::set(projection[14] / (projection[10] - 1.0f));
+    Float zero = Ops::set(0.0f), one = Ops::set(1.0f), minus_one = Ops::set(-1.0f);
+    Float projected = Ops::set(1.0f), clipped = Ops::set(2.0f); // SphereVisibility values
+
+    size_t i = 0;
+    for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+        Float x = Ops::load(spheres[0] + i), y = Ops::load(spheres[1] + i), z = Ops::load(spheres[2] + i);
+        Float radius = Ops::load(spheres[3] + i);
+        Float center[3];
+        for (int r = 0; r < 3; ++r)
+            center[r] = Ops::mulAdd(rows[r][0], x, Ops::mulAdd(rows[r][1], y, Ops::mulAdd(rows[r][2], z, rows[r][3])));
+        Float depth = Ops::sub(zero, center[2]);
+        Float radius_squared = Ops::mul(radius, radius);
+        Float depth_squared = Ops::mul(depth, depth);
+
+        for (int a = 0; a < 2; ++a) {
+            Float c = center[a];
+            Float tangent = Ops::sqrt(Ops::max(Ops::sub(Ops::mulAdd(c, c, depth_squared), radius_squared), zero));
+            Float tangent_c = Ops::mul(tangent, c), tangent_depth = Ops::mul(tangent, depth);
+            Float radius_c = Ops::mul(radius, c), radius_depth = Ops::mul(radius, depth);
+            Float low = Ops::div(Ops::sub(tangent_c, radius_depth), Ops::add(tangent_depth, radius_c));
+            Float high = Ops::div(Ops::add(tangent_c, radius_depth), Ops::sub(tangent_depth, radius_c));
+            low = Ops::sub(Ops::mul(scale[a], low), offset[a]);
+            high = Ops::sub(Ops::mul(scale[a], high), offset[a]);
+
+            Ops::store(rects[a] + i, low);
+            Ops::store(rects[a + 2] + i, high);
+        }
+
+        // Near plane cases, after the rects so they can be overwritten
+        auto is_behind = Ops::lessEqual(Ops::add(depth, radius), z_near);
+        auto is_clipped = Ops::lessEqual(Ops::sub(depth, radius), z_near);
+        Float state = Ops::select(is_behind, zero, Ops::select(is_clipped, clipped, projected));
+        for (int k = 0; k < 4; ++k) {
+            Float fill = k < 2 ? minus_one : one;
+            Float value = Ops::select(is_clipped, fill, Ops::load(rects[k] + i));
+            Ops::store(rects[k] + i, Ops::select(is_behind, zero, value));
+        }
+        float lanes[Ops::WIDTH];
+        Ops::store(lanes, state);
+        for (size_t lane = 0; lane < Ops::WIDTH; ++lane)
+            visibility[i + lane] = static_cast<unsigned char>(lanes[lane]);
+    }
+    return i;
+}
+
+template<class Ops>
+void projectSpheresKernel(const float *view, const float *projection, const float *const *spheres, size_t n,
+                          float *const *rects, unsigned char *visibility) {
+    size_t i = projectSpheresBody<Ops>(view, projection, spheres, n, rects, visibility);
+    const float *spheres_tail[4];
+    float *rects_tail[4];
+    for (int k = 0; k < 4; ++k) {
+        spheres_tail[k] = spheres[k] + i;
+        rects_tail[k] = rects[k] + i;
+    }
+    projectSpheresBody<ScalarOps>(view, projection, spheres_tail, n - i, rects_tail, visibility + i);
+}
+
+template<class Ops>
+void crossVectors(const typename Ops::Float *a, const typename Ops::Float *b, typename Ops::Float *result) {
+    result[0] = Ops::sub(Ops::mul(a[1], b[2]), Ops::mul(a[2], b[1]));
+    result[1] = Ops::sub(Ops::mul(a[2], b[0]), Ops::mul(a[0], b[2]));
+    result[2] = Ops::sub(Ops::mul(a[0], b[1]), Ops::mul(a[1], b[0]));
+}
+
+template<class Ops>
+typename Ops::Float dotVectors(const typename Ops::Float *a, const typename Ops::Float *b) {
+    return Ops::mulAdd(a[0], b[0], Ops::mulAdd(a[1], b[1], Ops::mul(a[2], b[2])));
+}
+
+// Moller and Trumbore, without culling back faces. Comparisons with NaN are false, so rays parallel to a
+// triangle and degenerate triangles come out as misses without a separate test
+template<class Ops>
+size_t intersectTrianglesBody(const float *ray, const float *const *triangles, size_t n, float *const *hits) {
+    typedef typename Ops::Float Float;
+    Float origin[3], direction[3];
+    for (int a = 0; a < 3; ++a) {
+        origin[a] = Ops::set(ray[a]);
+        direction[a] = Ops::set(ray[a + 3]);
+    }
+    Float zero = Ops::set(0.0f), one = Ops::set(1.0f), miss = Ops::set(INFINITY);
+
+    size_t i = 0;
+    for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+        Float corner[3], edge1[3], edge2[3];
+        for (int a = 0; a < 3; ++a) {
+            corner[a] = Ops::load(triangles[a] + i);
+            edge1[a] = Ops::load(triangles[a + 3] + i);
+            edge2[a] = Ops::load(triangles[a + 6] + i);
+        }
+        Float p[3], q[3], s[3];
+        crossVectors<Ops>(direction, edge2, p);
+        Float inverse_determinant = Ops::div(one, dotVectors<Ops>(edge1, p));
+        for (int a = 0; a < 3; ++a)
+            s[a] = Ops::sub(origin[a], corner[a]);
+        crossVectors<Ops>(s, edge1, q);
+        Float u = Ops::mul(dotVectors<Ops>(s, p), inverse_determinant);
+        Float v = Ops::mul(dotVectors<Ops>(direction, q), inverse_determinant);
+        Float t = Ops::mul(dotVectors<Ops>(edge2, q), inverse_determinant);
+
+        Float distance = Ops::select(Ops::lessEqual(zero, t), t, miss);
+        distance = Ops::select(Ops::lessEqual(zero, u), distance, miss);
+        distance = Ops::select(Ops::lessEqual(zero, v), distance, miss);
+        distance = Ops::select(Ops::lessEqual(Ops::add(u, v), one), distance, miss);
+        Ops::store(hits[0] + i, distance);
+        Ops::store(hits[1] + i, u);
+        Ops::store(hits[2] + i, v);
+    }
+    return i;
+}
+
+template<class Ops>
+void intersectTrianglesKernel(const float *ray, const float *const *triangles, size_t n, float *const *hits) {
+    size_t i = intersectTrianglesBody<Ops>(ray, triangles, n, hits);
+    const float *triangles_tail[9];
+    float *hits_tail[3];
+    for (int k = 0; k < 9; ++k)
+        triangles_tail[k] = triangles[k] + i;
+    for (int k = 0; k < 3; ++k)
+        hits_tail[k] = hits[k] + i;
+    intersectTrianglesBody<ScalarOps>(ray, triangles_tail, n - i, hits_tail);
+}
+
+template<class Ops>
+size_t projectChannelsBody(const float *const *values, const float *origin, const float *direction, size_t n,
+                           float *out) {
+    typedef typename Ops::Float Float;
+    Float offset[4], scale[4];
+    for (int c = 0; c < 4; ++c) {
+        offset[c] = Ops::set(origin[c]);
+        scale[c] = Ops::set(direction[c]);
+    }
+    size_t i = 0;
+    for (; i + Ops::WIDTH <= n; i += Ops::WIDTH) {
+        Float sum = Ops::mul(Ops::sub(Ops::load(values[0] + i), offset[0]), scale[0]);
+        for (int c = 1; c < 4; ++c)
+            sum = Ops::mulAdd(Ops::sub(Ops::load(values[c] + i), offset[c]), scale[c], sum);
+        Ops::store(out + i, sum);
+    }
+    return i;
+}
+
+template<class Ops>
+void projectChannelsKernel(const float *const *values, const float *origin, const float *direction, size_t n,
+                           float *out) {
+    size_t i = projectChannelsBody<Ops>(values, origin, direction, n, out);
+    const float *values_tail[4] = {values[0] + i, values[1] + i, values[2] + i, values[3] + i};
+    projectChannelsBody<ScalarOps>(values_tail, origin, direction, n - i, out + i);
+}
+
+template<class Ops>
+BatchKernels makeBatchKernels() {
+    return BatchKernels{&transformPointsKernel<Ops>, &computeBoundsKernel<Ops>, &transformBoundsKernel<Ops>,
+                        &projectSpheresKernel<Ops>, &intersectTrianglesKernel<Ops>, &projectChannelsKernel<Ops>};
+}
+
+}
+
+#endif //EMPTYGL_BATCH_GEOMETRY_KERNELS_H
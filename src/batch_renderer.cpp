@@ -0,0 +1,241 @@
+//
+// Created by Andrew on 4/30/2021.
+//
+
+#include "batch_renderer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "frame_view.h"
+#include "profiler.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+
+ImageWriter::ImageWriter(unsigned int max_pending) : max_pending(std::max(max_pending, 1u)) {}
+
+ImageWriter::~ImageWriter() {
+    flush();
+}
+
+void ImageWriter::submit(const string &path, unsigned int width, unsigned int height,
+                         vector<unsigned char> &&pixels) {
+    JobSystem::instance().wait(pending, max_pending - 1);
+    auto image = std::make_shared<Image>(Image{path, width, height, std::move(pixels)});
+    JobSystem::instance().run("ImageWriter::writeTGA", [this, image] {
+        if (writeTGA(*image))
+            ++n_written;
+        else
+            cerr << "Failed to write image: " << image->path << endl;
+    }, &pending);
+}
+
+void ImageWriter::flush() {
+    JobSystem::instance().wait(pending);
+}
+
+bool ImageWriter::writeTGA(const Image &image) {
+    // Uncompressed true-color TGA stores bottom-up BGRA, which is exactly what glReadPixels returns
+    unsigned char header[18] = {0};
+    header[2] = 2;
+    header[12] = image.width & 0xFF;
+    header[13] = (image.width >> 8) & 0xFF;
+    header[14] = image.height & 0xFF;
+    header[15] = (image.height >> 8) & 0xFF;
+    header[16] = 32;
+    header[17] = 8; // 8 alpha bits, bottom-left origin
+
+    FILE *file = std::fopen(image.path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool success = std::fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+                   std::fwrite(image.pixels.data(), 1, image.pixels.size(), file) == image.pixels.size();
+    return std::fclose(file) == 0 && success;
+}
+
+BatchRenderer::BatchRenderer(unsigned int width, unsigned int height, unsigned int n_views) :
+        width(width), height(height) {
+    // Offscreen framebuffer, the multi-view renderer brings its own
+    if (n_views > 1) {
+        multi_view.reset(new MultiViewRenderer(width, height, n_views));
+    } else {
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(1, &color_RBO);
+        glGenRenderbuffers(1, &depth_RBO);
+
+        glBindRenderbuffer(GL_RENDERBUFFER, color_RBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_RBO);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color_RBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth_RBO);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::FRAMEBUFFER::INCOMPLETE" << endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Readback ring
+    unsigned int ring_size = PBO_RING_SIZE * (multi_view ? multi_view->viewCount() : 1);
+    PBOs.resize(ring_size);
+    fences.assign(ring_size, nullptr);
+    pending_paths.resize(ring_size);
+    glGenBuffers(ring_size, PBOs.data());
+    for (unsigned int i = 0; i < ring_size; ++i) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    MemoryUsage usage;
+    usage.gpu_bytes = static_cast<size_t>(width) * height * 4 * ring_size;
+    MemoryTracker::instance().track(MEMORY_BUFFER, PBOs[0], "batch readback ring", usage);
+    if (FBO) {
+        usage.gpu_bytes = static_cast<size_t>(width) * height * (4 + 4);
+        MemoryTracker::instance().track(MEMORY_FRAMEBUFFER, FBO, "batch framebuffer", usage);
+    }
+}
+
+BatchRenderer::~BatchRenderer() {
+    MemoryTracker::instance().untrack(MEMORY_BUFFER, PBOs[0]);
+    if (FBO)
+        MemoryTracker::instance().untrack(MEMORY_FRAMEBUFFER, FBO);
+    for (auto &fence: fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    glDeleteBuffers(static_cast<int>(PBOs.size()), PBOs.data());
+    if (FBO) {
+        glDeleteRenderbuffers(1, &color_RBO);
+        glDeleteRenderbuffers(1, &depth_RBO);
+        glDeleteFramebuffers(1, &FBO);
+    }
+}
+
+unsigned int BatchRenderer::render(Scene *scene, Shader *shader, const vector<CameraPose> &poses,
+                                   const string &output_dir) {
+    if (multi_view) {
+        cerr << "BatchRenderer was created with multiple views" << endl;
+        return 0;
+    }
+    Camera camera;
+    FrameView frame_view(0.1f, 1000.0f);
+    Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+    unsigned int written_before = writer.written();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glViewport(0, 0, width, height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    for (unsigned int i = 0; i < poses.size(); ++i) {
+        applyCameraPose(poses[i], &camera);
+
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        shader->use();
+        shader->setMat4("model", model_matrix);
+        frame_view.update(camera, width, height);
+        shader->setMat4("view", frame_view.view());
+        shader->setMat4("projection", frame_view.projection());
+        scene->draw(shader);
+
+        readBack(i, output_dir);
+        Profiler::instance().newFrame();
+    }
+
+    drain(static_cast<unsigned int>(poses.size()));
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    writer.flush();
+    return writer.written() - written_before;
+}
+
+unsigned int BatchRenderer::render(Scene *scene, ShaderVariants *variants, unsigned int extra_features,
+                                   const vector<CameraPose> &poses, const string &output_dir) {
+    if (!multi_view) {
+        cerr << "BatchRenderer was created without multiple views" << endl;
+        return 0;
+    }
+    Camera camera;
+    FrameView frame_view(0.1f, 1000.0f);
+    Eigen::Matrix4f model_matrix = Eigen::Matrix4f::Identity();
+    vector<Eigen::Matrix4f> view_projections;
+    unsigned int written_before = writer.written();
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    auto n_poses = static_cast<unsigned int>(poses.size());
+    for (unsigned int first = 0; first < n_poses; first += multi_view->viewCount()) {
+        unsigned int count = std::min(multi_view->viewCount(), n_poses - first);
+        view_projections.clear();
+        for (unsigned int i = first; i < first + count; ++i) {
+            applyCameraPose(poses[i], &camera);
+            frame_view.update(camera, width, height);
+            view_projections.push_back(frame_view.viewProjection());
+        }
+        multi_view->render(scene, variants, view_projections, model_matrix, extra_features);
+
+        for (unsigned int view = 0; view < count; ++view) {
+            multi_view->bindLayerForRead(view);
+            readBack(first + view, output_dir);
+        }
+        Profiler::instance().newFrame();
+    }
+
+    drain(n_poses);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    writer.flush();
+    return writer.written() - written_before;
+}
+
+void BatchRenderer::readBack(unsigned int image_index, const string &output_dir) {
+    auto slot = static_cast<unsigned int>(image_index % PBOs.size());
+    if (fences[slot]) // Ring is full, the oldest frame must leave before its buffer is reused
+        retire(slot);
+
+    // Asynchronous copy into the slot's PBO, returns without waiting for the GPU
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[slot]);
+    glReadPixels(0, 0, width, height, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    char file_name[32];
+    std::snprintf(file_name, sizeof(file_name), "%06u.tga", image_index);
+    pending_paths[slot] = output_dir + '/' + file_name;
+}
+
+void BatchRenderer::drain(unsigned int n_images) {
+    // In submission order
+    for (size_t i = 0; i < PBOs.size(); ++i) {
+        size_t slot = (n_images + i) % PBOs.size();
+        if (fences[slot])
+            retire(static_cast<unsigned int>(slot));
+    }
+}
+
+void BatchRenderer::retire(unsigned int slot) {
+    PROFILE_SCOPE("BatchRenderer::retire");
+    glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(fences[slot]);
+    fences[slot] = nullptr;
+
+    size_t image_size = static_cast<size_t>(width) * height * 4;
+    vector<unsigned char> pixels(image_size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, PBOs[slot]);
+    void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image_size, GL_MAP_READ_BIT);
+    if (mapped) {
+        std::memcpy(pixels.data(), mapped, image_size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        writer.submit(pending_paths[slot], width, height, std::move(pixels));
+    } else {
+        cerr << "Failed to map readback buffer for " << pending_paths[slot] << endl;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
@@ -0,0 +1,171 @@
+//
+// Created by Andrew on 6/11/2021.
+//
+
+#include "bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "job_system.h"
+#include "profiler.h"
+
+namespace {
+
+const unsigned int BIN_COUNT = 16;
+// Cost of visiting a node relative to testing one primitive
+const float TRAVERSAL_COST = 1.0f;
+// Subtrees with more primitives than this are built as separate jobs
+const unsigned int PARALLEL_SUBTREE_SIZE = 1u << 14;
+
+float surfaceArea(const Eigen::AlignedBox3f &box) {
+    Eigen::Vector3f size = box.sizes();
+    return 2.0f * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+struct Bin {
+    Eigen::AlignedBox3f bounds;
+    unsigned int count = 0;
+};
+
+}
+
+void Bvh::build(const vector<Eigen::AlignedBox3f> &boxes) {
+    PROFILE_SCOPE("Bvh::build");
+    nodes.clear();
+    primitives.clear();
+    for (unsigned int i = 0; i < boxes.size(); ++i) {
+        if (!boxes[i].isEmpty())
+            primitives.push_back(i);
+    }
+    if (primitives.empty())
+        return;
+    buildNode(boxes, 0, static_cast<unsigned int>(primitives.size()), 0, nodes);
+    nodes.shrink_to_fit();
+    primitives.shrink_to_fit();
+}
+
+void Bvh::buildNode(const vector<Eigen::AlignedBox3f> &boxes, unsigned int begin, unsigned int end,
+                     unsigned int depth, vector<Node> &out) {
+    unsigned int index = static_cast<unsigned int>(out.size());
+    out.emplace_back();
+    Eigen::AlignedBox3f bounds, centroids;
+    for (unsigned int i = begin; i < end; ++i) {
+        bounds.extend(boxes[primitives[i]]);
+        centroids.extend(boxes[primitives[i]].center());
+    }
+    Eigen::Map<Eigen::Vector3f>(out[index].min) = bounds.min();
+    Eigen::Map<Eigen::Vector3f>(out[index].max) = bounds.max();
+    out[index].first = begin;
+    out[index].count = 0;
+
+    // Binned surface area heuristic over the box centers, all three axes binned in one pass
+    unsigned int count = end - begin;
+    int best_axis = -1;
+    unsigned int best_split = 0;
+    float best_cost = INFINITY;
+    Eigen::Vector3f extent = centroids.sizes();
+    Eigen::Vector3f scale = Eigen::Vector3f::Zero();
+    bool binned[3] = {false, false, false};
+    for (int axis = 0; axis < 3 && count > 1 && depth < MAX_SAH_DEPTH; ++axis) {
+        scale[axis] = static_cast<float>(BIN_COUNT) / extent[axis];
+        binned[axis] = extent[axis] > 0.0f && std::isfinite(scale[axis]);
+    }
+    if (binned[0] || binned[1] || binned[2]) {
+        Bin bins[3][BIN_COUNT];
+        for (unsigned int i = begin; i < end; ++i) {
+            const Eigen::AlignedBox3f &box = boxes[primitives[i]];
+            Eigen::Vector3f offset = box.center() - centroids.min();
+            for (int axis = 0; axis < 3; ++axis) {
+                if (!binned[axis])
+                    continue;
+                auto bin = std::min(static_cast<unsigned int>(offset[axis] * scale[axis]), BIN_COUNT - 1);
+                bins[axis][bin].bounds.extend(box);
+                ++bins[axis][bin].count;
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis) {
+            if (!binned[axis])
+                continue;
+            float right_area[BIN_COUNT];
+            unsigned int right_count[BIN_COUNT];
+            Eigen::AlignedBox3f right;
+            unsigned int n_right = 0;
+            for (unsigned int bin = BIN_COUNT - 1; bin > 0; --bin) {
+                right.extend(bins[axis][bin].bounds);
+                n_right += bins[axis][bin].count;
+                right_area[bin] = n_right > 0 ? surfaceArea(right) : 0.0f;
+                right_count[bin] = n_right;
+            }
+            Eigen::AlignedBox3f left;
+            unsigned int n_left = 0;
+            for (unsigned int split = 1; split < BIN_COUNT; ++split) {
+                left.extend(bins[axis][split - 1].bounds);
+                n_left += bins[axis][split - 1].count;
+                if (n_left == 0 || right_count[split] == 0)
+                    continue;
+                float cost = surfaceArea(left) * n_left + right_area[split] * right_count[split];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+    }
+    float area = surfaceArea(bounds);
+    best_cost += TRAVERSAL_COST * area;
+    if (count <= LEAF_SIZE && (best_axis < 0 || static_cast<float>(count) * area <= best_cost)) {
+        out[index].count = count;
+        return;
+    }
+
+    unsigned int middle = begin;
+    if (best_axis >= 0) {
+        // Same arithmetic as the binning, so every primitive lands on the side its bin is on
+        auto split = std::partition(primitives.begin() + begin, primitives.begin() + end, [&](unsigned int primitive) {
+            Eigen::Vector3f offset = boxes[primitive].center() - centroids.min();
+            return std::min(static_cast<unsigned int>(offset[best_axis] * scale[best_axis]), BIN_COUNT - 1) <
+                   best_split;
+        });
+        middle = static_cast<unsigned int>(split - primitives.begin());
+    }
+    if (best_axis < 0 || middle == begin || middle == end) {
+        // Every centroid in one spot, or too deep: halving the range still bounds the leaf size and the depth
+        middle = begin + count / 2;
+    }
+
+    if (count > PARALLEL_SUBTREE_SIZE) {
+        vector<Node> second;
+        JobCounter built;
+        JobSystem::instance().run("Bvh::buildNode", [&] {
+            buildNode(boxes, middle, end, depth + 1, second);
+        }, &built);
+        buildNode(boxes, begin, middle, depth + 1, out);
+        JobSystem::instance().wait(built);
+        // The second subtree was built with its own node indices
+        auto offset = static_cast<unsigned int>(out.size());
+        for (Node &node: second) {
+            if (node.count == 0)
+                node.first += offset;
+        }
+        out.insert(out.end(), second.begin(), second.end());
+        out[index].first = offset;
+    } else {
+        buildNode(boxes, begin, middle, depth + 1, out);
+        out[index].first = static_cast<unsigned int>(out.size());
+        buildNode(boxes, middle, end, depth + 1, out);
+    }
+}
+
+bool Bvh::bounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) const {
+    if (nodes.empty())
+        return false;
+    min_corner = Eigen::Map<const Eigen::Vector3f>(nodes[0].min);
+    max_corner = Eigen::Map<const Eigen::Vector3f>(nodes[0].max);
+    return true;
+}
+
+size_t Bvh::memoryBytes() const {
+    return nodes.capacity() * sizeof(Node) + primitives.capacity() * sizeof(unsigned int);
+}
@@ -5,7 +5,7 @@
 #include "camera.h"
 #include "geometry.h"
 
-Eigen::Matrix4f Camera::getViewMatrix() {
+Eigen::Matrix4f Camera::getViewMatrix() const {
     return lookAt(position, position + front, world_up);
 }
 
@@ -46,6 +46,13 @@ void Camera::processMouseScroll(float y_offset) {
     if (zoom > 45.0f) zoom = 45.0f;
 }
 
+void Camera::setPose(const Vector3f &position, float yaw, float pitch) {
+    this->position = position;
+    this->yaw = yaw;
+    this->pitch = pitch;
+    updateCameraVectors();
+}
+
 void Camera::updateCameraVectors() {
     // Calculate the new Front vector
     float yaw_from_z = yaw - 180.0f; // Minus 180 degrees since raw yaw is along +z
@@ -0,0 +1,73 @@
+//
+// Created by Andrew on 6/11/2021.
+//
+
+#include "camera_collider.h"
+
+#include <algorithm>
+
+#include "profiler.h"
+
+namespace {
+
+// Longer frames, like the first one after loading, fall as if they were this long
+const float MAX_FALL_STEP = 0.1f;
+
+}
+
+CameraCollider::CameraCollider(Scene *scene, CollisionMode mode, float radius, float eye_height) :
+        scene(scene), mode(mode), radius(radius), eye_height(std::max(eye_height, radius)) {}
+
+void CameraCollider::constrain(Camera *camera, const Eigen::Vector3f &previous_position, float delta_time) {
+    PROFILE_SCOPE("CameraCollider::constrain");
+    Eigen::Vector3f motion = camera->position - previous_position;
+    if (mode == COLLISION_FLY) {
+        camera->position = slide(previous_position, motion);
+        return;
+    }
+    camera->position = walk(camera->world_up.normalized(), previous_position, motion, delta_time);
+}
+
+Eigen::Vector3f CameraCollider::slide(Eigen::Vector3f position, Eigen::Vector3f motion) {
+    // Stopping this short of contacts keeps the next sweep from starting on the surface
+    const float skin = 0.01f * radius;
+    for (int i = 0; i < MAX_SLIDES && motion.squaredNorm() > skin * skin * 1e-4f; ++i) {
+        SphereSweepHit hit;
+        if (!scene->sweepSphere(model, position, radius, motion, hit))
+            return position + motion;
+        float length = motion.norm();
+        position += motion * (std::max(hit.fraction * length - skin, 0.0f) / length);
+        // What is left of the move, without the part into the surface
+        Eigen::Vector3f remaining = motion * (1.0f - hit.fraction);
+        motion = remaining - remaining.dot(hit.normal) * hit.normal;
+    }
+    return position;
+}
+
+Eigen::Vector3f CameraCollider::walk(const Eigen::Vector3f &up, const Eigen::Vector3f &previous_position,
+                                     const Eigen::Vector3f &motion, float delta_time) {
+    // Looking up or down does not slow walking
+    Eigen::Vector3f horizontal = motion - motion.dot(up) * up;
+    if (!horizontal.isZero(0.0f))
+        horizontal *= motion.norm() / horizontal.norm();
+    Eigen::Vector3f position = slide(previous_position, horizontal);
+
+    delta_time = std::min(delta_time, MAX_FALL_STEP);
+    fall_speed = std::min(fall_speed + gravity * delta_time, terminal_speed);
+    float drop = fall_speed * delta_time;
+    // Down from the eye to the floor, past standing height by what this frame falls. On the ground it also
+    // reaches a step down, so walking down stairs does not turn into falling
+    float reach = eye_height - radius + std::max(drop, grounded ? max_step_height : 0.0f);
+    SphereSweepHit floor;
+    if (!scene->sweepSphere(model, position, radius, -reach * up, floor)) {
+        grounded = false;
+        return slide(position, -drop * up);
+    }
+    float rise = eye_height - (floor.fraction * reach + radius);
+    // Too high to step onto: only refuse a move that led there, standing still lets the camera climb out
+    if (rise > max_step_height && position != previous_position)
+        return previous_position;
+    grounded = true;
+    fall_speed = 0.0f;
+    return rise > 0.0f ? slide(position, rise * up) : Eigen::Vector3f(position + rise * up);
+}
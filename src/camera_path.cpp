@@ -0,0 +1,65 @@
+//
+// Created by Andrew on 5/6/2021.
+//
+
+#include "camera_path.h"
+
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+using std::cerr;
+using std::endl;
+
+CameraPose captureCameraPose(const Camera &camera) {
+    return CameraPose{camera.position, camera.yaw, camera.pitch, camera.zoom};
+}
+
+void applyCameraPose(const CameraPose &pose, Camera *camera) {
+    camera->setPose(pose.position, pose.yaw, pose.pitch);
+    camera->zoom = pose.fov;
+}
+
+vector<CameraPose> loadCameraPoses(const string &path) {
+    vector<CameraPose> poses;
+    std::ifstream pose_stream(path);
+    if (!pose_stream.is_open()) {
+        cerr << "Failed to open file: " << path << endl;
+        return poses;
+    }
+
+    string line;
+    unsigned int line_number = 0;
+    while (std::getline(pose_stream, line)) {
+        ++line_number;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream line_stream(line);
+        CameraPose pose;
+        if (line_stream >> pose.position[0] >> pose.position[1] >> pose.position[2]
+                        >> pose.yaw >> pose.pitch >> pose.fov) {
+            poses.push_back(pose);
+        } else {
+            cerr << "Malformed pose at " << path << ":" << line_number << endl;
+        }
+    }
+    return poses;
+}
+
+bool CameraPathRecorder::open(const string &path) {
+    stream.open(path);
+    if (!stream.is_open()) {
+        cerr << "Failed to open file: " << path << endl;
+        return false;
+    }
+    // Full float precision so replays hit exactly the recorded views
+    stream.precision(std::numeric_limits<float>::max_digits10);
+    stream << "# x y z yaw pitch fov\n";
+    return true;
+}
+
+void CameraPathRecorder::record(const Camera &camera) {
+    CameraPose pose = captureCameraPose(camera);
+    stream << pose.position[0] << ' ' << pose.position[1] << ' ' << pose.position[2] << ' '
+           << pose.yaw << ' ' << pose.pitch << ' ' << pose.fov << '\n';
+}
@@ -0,0 +1,91 @@
+//
+// Created by Andrew on 6/6/2021.
+//
+
+#include "draw_list.h"
+
+#include <glad/glad.h>
+
+#include "dynamic_vertex_buffer.h"
+#include "job_system.h"
+#include "profiler.h"
+
+void replayDrawLists(const vector<DrawList> &lists, unsigned int draw_data_buffer) {
+    PROFILE_SCOPE("replayDrawLists");
+    PROFILE_GPU_SCOPE("replayDrawLists");
+    unsigned int program = 0;
+    unsigned int bound_textures[DrawPacket::MAX_TEXTURES] = {};
+    for (const DrawList &list: lists) {
+        for (const DrawPacket &packet: list.packets) {
+            if (packet.program != program) {
+                glUseProgram(packet.program);
+                program = packet.program;
+            }
+            for (unsigned int i = 0; i < packet.n_textures; ++i) {
+                if (bound_textures[i] != packet.textures[i]) {
+                    glActiveTexture(GL_TEXTURE0 + i);
+                    glBindTexture(GL_TEXTURE_2D, packet.textures[i]);
+                    bound_textures[i] = packet.textures[i];
+                }
+                if (packet.sampler_locations[i] >= 0)
+                    glUniform1i(packet.sampler_locations[i], static_cast<int>(i));
+            }
+            if (packet.draw_data_size > 0) {
+                glBindBufferRange(GL_UNIFORM_BUFFER, 1, draw_data_buffer,
+                                  static_cast<GLintptr>(packet.draw_data_offset),
+                                  static_cast<GLsizeiptr>(packet.draw_data_size));
+            }
+
+            glBindVertexArray(packet.vao);
+            if (packet.dynamic_vertices) {
+                packet.dynamic_vertices->prepareDraw();
+                glDrawElementsBaseVertex(GL_TRIANGLES, packet.index_count, GL_UNSIGNED_INT, 0,
+                                         packet.dynamic_vertices->baseVertex());
+                packet.dynamic_vertices->fenceDraw();
+            } else {
+                glDrawElements(GL_TRIANGLES, packet.index_count, GL_UNSIGNED_INT, 0);
+            }
+        }
+    }
+    glBindVertexArray(0);
+    for (unsigned int i = 0; i < DrawPacket::MAX_TEXTURES; ++i) {
+        if (bound_textures[i]) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void DrawListRecorder::draw(Scene *scene, ShaderVariants *variants, DynamicRingBuffer *draw_buffer,
+                            const FrameView &view, const Eigen::Matrix4f &model, unsigned int extra_features) {
+    PROFILE_SCOPE("DrawListRecorder::draw");
+    SceneRecording recording;
+    scene->prepareRecording(variants, draw_buffer, model, view, extra_features, recording);
+
+    record(scene, recording, lists);
+    if (draw_buffer)
+        draw_buffer->flush(recording.draw_data);
+    replay(lists, draw_buffer ? draw_buffer->bufferID() : 0);
+}
+
+void DrawListRecorder::record(const Scene *scene, const SceneRecording &recording, vector<DrawList> &lists) {
+    PROFILE_SCOPE("DrawListRecorder::record");
+    // Contiguous ranges, so the lists concatenate back into the draw order
+    JobSystem &jobs = JobSystem::instance();
+    lists.resize((jobs.workerCount() + 1) * LISTS_PER_THREAD);
+    size_t n = recording.draw_order.size();
+    jobs.parallelFor("DrawListRecorder::record", lists.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            lists[i].packets.clear();
+            scene->recordDraws(recording, n * i / lists.size(), n * (i + 1) / lists.size(), lists[i]);
+        }
+    });
+}
+
+void DrawListRecorder::replay(const vector<DrawList> &lists, unsigned int draw_data_buffer) {
+    n_draws = 0;
+    for (auto &list: lists)
+        n_draws += list.packets.size();
+    replayDrawLists(lists, draw_data_buffer);
+}
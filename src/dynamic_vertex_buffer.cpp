@@ -0,0 +1,259 @@
+//
+// Created by Andrew on 5/19/2021.
+//
+
+#include "dynamic_vertex_buffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "profiler.h"
+
+using std::cout;
+using std::endl;
+
+void DynamicVertexBuffer::Range::add(unsigned int b, unsigned int e) {
+    if (b >= e)
+        return;
+    if (begin >= end) {
+        begin = b;
+        end = e;
+    } else {
+        begin = std::min(begin, b);
+        end = std::max(end, e);
+    }
+}
+
+DynamicVertexBuffer::Writer::Writer(DynamicVertexBuffer *owner) :
+        owner(owner), lock(owner->writer_mutex), dirty_begin(0), dirty_end(0) {}
+
+DynamicVertexBuffer::Writer::~Writer() {
+    // Changes nobody committed would otherwise be lost, their range is not remembered
+    if (lock.owns_lock() && dirty_begin < dirty_end)
+        commit();
+}
+
+unsigned int DynamicVertexBuffer::Writer::vertexCount() const {
+    return owner->vertex_count;
+}
+
+void DynamicVertexBuffer::Writer::markDirty(unsigned int first, unsigned int count) {
+    if (dirty_begin >= dirty_end) {
+        dirty_begin = first;
+        dirty_end = first + count;
+    } else {
+        dirty_begin = std::min(dirty_begin, first);
+        dirty_end = std::max(dirty_end, first + count);
+    }
+}
+
+void DynamicVertexBuffer::Writer::setPositions(unsigned int first, const Eigen::Vector3f *positions,
+                                               unsigned int count) {
+    count = std::min(count, owner->vertex_count - std::min(first, owner->vertex_count));
+    for (unsigned int i = 0; i < count; ++i)
+        owner->shadow[first + i].position = positions[i];
+    markDirty(first, count);
+}
+
+void DynamicVertexBuffer::Writer::setNormals(unsigned int first, const Eigen::Vector3f *normals,
+                                             unsigned int count) {
+    count = std::min(count, owner->vertex_count - std::min(first, owner->vertex_count));
+    for (unsigned int i = 0; i < count; ++i)
+        owner->shadow[first + i].normal = normals[i];
+    markDirty(first, count);
+}
+
+void DynamicVertexBuffer::Writer::setVertices(unsigned int first, const Mesh::Vertex *vertices,
+                                              unsigned int count) {
+    count = std::min(count, owner->vertex_count - std::min(first, owner->vertex_count));
+    std::copy(vertices, vertices + count, owner->shadow.begin() + first);
+    markDirty(first, count);
+}
+
+void DynamicVertexBuffer::Writer::commit() {
+    if (dirty_begin < dirty_end)
+        owner->commit(dirty_begin, dirty_end);
+    dirty_begin = dirty_end = 0;
+}
+
+DynamicVertexBuffer::DynamicVertexBuffer(const vector<Mesh::Vertex> &vertices) :
+        vertex_count(static_cast<unsigned int>(vertices.size())), shadow(vertices) {
+    size_t region_size = vertices.size() * sizeof(Mesh::Vertex);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    if (glBufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(region_size * REGION_COUNT), nullptr, flags);
+        mapped = static_cast<Mesh::Vertex *>(glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                static_cast<GLsizeiptr>(region_size * REGION_COUNT), flags));
+        if (!mapped)
+            cout << "ERROR::DYNAMIC_VERTEX_BUFFER::MAPPING_FAILED" << endl;
+    }
+    if (mapped) {
+        for (unsigned int i = 0; i < REGION_COUNT; ++i)
+            std::copy(vertices.begin(), vertices.end(), mapped + i * vertex_count);
+    } else {
+        if (glBufferStorage) {
+            // Immutable storage can't be orphaned, start over with a mutable buffer
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        }
+        // Single region, replaced as a whole on every upload
+        glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(region_size), vertices.data(), GL_STREAM_DRAW);
+        staging = vertices;
+    }
+    for (auto &state: states)
+        state = REGION_FREE;
+    states[0] = REGION_CURRENT;
+    shadowBounds(committed_min, committed_max);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void DynamicVertexBuffer::release() {
+    for (auto &fence: fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    if (mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        mapped = nullptr;
+    }
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+DynamicVertexBuffer::Writer DynamicVertexBuffer::beginWrite() {
+    return Writer(this);
+}
+
+void DynamicVertexBuffer::bounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) {
+    std::lock_guard<std::mutex> lock(state_mutex);
+    min_corner = committed_min;
+    max_corner = committed_max;
+}
+
+void DynamicVertexBuffer::shadowBounds(Eigen::Vector3f &min_corner, Eigen::Vector3f &max_corner) const {
+    min_corner = max_corner = Eigen::Vector3f::Zero();
+    if (shadow.empty())
+        return;
+    min_corner = max_corner = shadow[0].position;
+    for (auto &vertex: shadow) {
+        min_corner = min_corner.cwiseMin(vertex.position);
+        max_corner = max_corner.cwiseMax(vertex.position);
+    }
+}
+
+void DynamicVertexBuffer::commit(unsigned int dirty_begin, unsigned int dirty_end) {
+    PROFILE_SCOPE("DynamicVertexBuffer::commit");
+    // A partial write can still move the rest of the mesh out of the old box, so it covers every vertex
+    Eigen::Vector3f min_corner, max_corner;
+    shadowBounds(min_corner, max_corner);
+    std::unique_lock<std::mutex> lock(state_mutex);
+    committed_min = min_corner;
+    committed_max = max_corner;
+    if (!mapped) {
+        std::copy(shadow.begin() + dirty_begin, shadow.begin() + dirty_end, staging.begin() + dirty_begin);
+        upload_pending = true;
+        return;
+    }
+
+    for (auto &range: stale)
+        range.add(dirty_begin, dirty_end);
+    unsigned int region = writableRegion();
+    if (region == REGION_COUNT) {
+        copy_deferred = true;
+        return;
+    }
+    states[region] = REGION_WRITING;
+    lock.unlock();
+    // Draws only look at READY regions, so the copy runs without blocking the GL thread
+    copyToRegion(region);
+    lock.lock();
+    states[region] = REGION_READY;
+    copy_deferred = false;
+}
+
+unsigned int DynamicVertexBuffer::writableRegion() const {
+    // A published region nobody drew yet is overwritten, the newest vertices win
+    for (unsigned int i = 0; i < REGION_COUNT; ++i) {
+        if (states[i] == REGION_READY)
+            return i;
+    }
+    for (unsigned int i = 0; i < REGION_COUNT; ++i) {
+        if (states[i] == REGION_FREE)
+            return i;
+    }
+    return REGION_COUNT;
+}
+
+void DynamicVertexBuffer::copyToRegion(unsigned int region) {
+    Range &range = stale[region];
+    // Coherent mapping, the copy is visible to commands issued after it
+    std::copy(shadow.begin() + range.begin, shadow.begin() + range.end, mapped + region * vertex_count + range.begin);
+    range = Range();
+}
+
+void DynamicVertexBuffer::prepareDraw() {
+    std::unique_lock<std::mutex> lock(state_mutex);
+    if (!mapped) {
+        if (upload_pending) {
+            PROFILE_SCOPE("DynamicVertexBuffer::upload");
+            // Orphan the old storage so the driver hands out fresh memory instead of waiting for draws
+            size_t size = staging.size() * sizeof(Mesh::Vertex);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(size), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(size), staging.data());
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            upload_pending = false;
+        }
+        return;
+    }
+
+    for (unsigned int i = 0; i < REGION_COUNT; ++i) {
+        if (states[i] == REGION_RETIRED && glClientWaitSync(fences[i], 0, 0) != GL_TIMEOUT_EXPIRED) {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+            states[i] = REGION_FREE;
+        }
+    }
+    if (copy_deferred) {
+        // Finish a commit that found every region in flight, unless a writer is busy and commits again anyway
+        unsigned int region = writableRegion();
+        std::unique_lock<std::mutex> writer_lock(writer_mutex, std::try_to_lock);
+        if (region != REGION_COUNT && writer_lock.owns_lock()) {
+            PROFILE_SCOPE("DynamicVertexBuffer::deferredCopy");
+            copyToRegion(region);
+            states[region] = REGION_READY;
+            copy_deferred = false;
+        }
+    }
+    for (unsigned int i = 0; i < REGION_COUNT; ++i) {
+        if (states[i] != REGION_READY)
+            continue;
+        // Never drawn regions have no fence and are free right away
+        states[current] = fences[current] ? REGION_RETIRED : REGION_FREE;
+        states[i] = REGION_CURRENT;
+        current = i;
+        break;
+    }
+}
+
+void DynamicVertexBuffer::fenceDraw() {
+    if (!mapped)
+        return;
+    if (fences[current])
+        glDeleteSync(fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+MemoryUsage DynamicVertexBuffer::memoryUsage() const {
+    MemoryUsage usage;
+    size_t region_size = static_cast<size_t>(vertex_count) * sizeof(Mesh::Vertex);
+    usage.cpu_bytes = shadow.capacity() * sizeof(Mesh::Vertex) + staging.capacity() * sizeof(Mesh::Vertex);
+    usage.gpu_bytes = mapped ? region_size * REGION_COUNT : region_size;
+    return usage;
+}
@@ -0,0 +1,31 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#include "file_util.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+bool writeFileAtomically(const string &path, const std::function<bool(std::ostream &)> &write) {
+    // Random rather than the process ID, which is not portable and repeats across machines sharing a cache
+    std::random_device device;
+    char suffix[24];
+    std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", device(), device());
+    string temporary_path = path + suffix;
+    bool written;
+    {
+        std::ofstream stream(temporary_path, std::ios::binary);
+        written = stream.is_open() && write(stream) && stream.flush();
+    }
+    std::error_code error;
+    if (written) {
+        std::filesystem::rename(temporary_path, path, error);
+        written = !error;
+    }
+    if (!written)
+        std::filesystem::remove(temporary_path, error);
+    return written;
+}
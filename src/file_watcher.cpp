@@ -0,0 +1,107 @@
+//
+// Created by Andrew on 5/12/2021.
+//
+
+#include "file_watcher.h"
+
+#include <iostream>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using std::cerr;
+using std::endl;
+
+string FileWatcher::normalize(const string &path) {
+    std::error_code error;
+    std::filesystem::path absolute = std::filesystem::absolute(path, error);
+    return (error ? std::filesystem::path(path) : absolute).lexically_normal().string();
+}
+
+#ifdef __linux__
+
+FileWatcher::FileWatcher() {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0)
+        cerr << "Failed to initialize inotify, file watching disabled" << endl;
+}
+
+FileWatcher::~FileWatcher() {
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+}
+
+void FileWatcher::watch(const string &path) {
+    string normalized = normalize(path);
+    watched_files[normalized] = path;
+    if (inotify_fd < 0)
+        return;
+
+    string directory = std::filesystem::path(normalized).parent_path().string();
+    for (auto &watched: watched_directories) {
+        if (watched.second == directory)
+            return;
+    }
+    int descriptor = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (descriptor < 0) {
+        cerr << "Failed to watch directory: " << directory << endl;
+        return;
+    }
+    watched_directories[descriptor] = directory;
+}
+
+vector<string> FileWatcher::poll() {
+    std::set<string> changed;
+    if (inotify_fd >= 0) {
+        alignas(inotify_event) char buffer[4096];
+        while (true) {
+            ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+            if (length <= 0)
+                break; // EAGAIN, nothing left
+            for (char *event_ptr = buffer; event_ptr < buffer + length;) {
+                auto *event = reinterpret_cast<inotify_event *>(event_ptr);
+                event_ptr += sizeof(inotify_event) + event->len;
+                auto directory = watched_directories.find(event->wd);
+                if (directory == watched_directories.end() || event->len == 0)
+                    continue;
+                auto file = watched_files.find(directory->second + '/' + event->name);
+                if (file != watched_files.end())
+                    changed.insert(file->second);
+            }
+        }
+    }
+    return vector<string>(changed.begin(), changed.end());
+}
+
+#else
+
+FileWatcher::FileWatcher() = default;
+
+FileWatcher::~FileWatcher() = default;
+
+void FileWatcher::watch(const string &path) {
+    string normalized = normalize(path);
+    watched_files[normalized] = path;
+    std::error_code error;
+    modification_times[normalized] = std::filesystem::last_write_time(normalized, error);
+}
+
+vector<string> FileWatcher::poll() {
+    vector<string> changed;
+    for (auto &file: watched_files) {
+        std::error_code error;
+        auto modification_time = std::filesystem::last_write_time(file.first, error);
+        if (error)
+            continue; // Mid-save, try again next poll
+        auto &last_time = modification_times[file.first];
+        if (modification_time != last_time) {
+            last_time = modification_time;
+            changed.push_back(file.second);
+        }
+    }
+    return changed;
+}
+
+#endif
@@ -0,0 +1,92 @@
+//
+// Created by Andrew on 6/4/2021.
+//
+
+#include "frame_pacer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "profiler.h"
+
+FramePacer::FramePacer(unsigned int max_frames_in_flight, float max_fps) :
+        max_frames_in_flight(max_frames_in_flight),
+        frame_period_ns(max_fps > 0.0f ? static_cast<uint64_t>(1e9 / max_fps) : 0) {}
+
+FramePacer::~FramePacer() {
+    for (auto &frame: pending) {
+        glDeleteSync(frame.fence);
+        if (frame.timestamp_query)
+            free_queries.push_back(frame.timestamp_query);
+    }
+    if (!free_queries.empty())
+        glDeleteQueries(static_cast<int>(free_queries.size()), free_queries.data());
+}
+
+bool FramePacer::retire(bool wait) {
+    PendingFrame &frame = pending.front();
+    GLenum status = glClientWaitSync(frame.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+        return false;
+    if (frame.timestamp_query) {
+        // Written before the fence, so the result is in by now
+        if (status != GL_WAIT_FAILED) {
+            GLuint64 gpu_time = 0;
+            glGetQueryObjectui64v(frame.timestamp_query, GL_QUERY_RESULT, &gpu_time);
+            auto present_ns = static_cast<int64_t>(gpu_time) + gpu_clock_offset;
+            auto input_ns = static_cast<int64_t>(frame.input_time_ns);
+            latency.addFrameTime(static_cast<double>(std::max(present_ns - input_ns, int64_t(0))) * 1e-6);
+        }
+        free_queries.push_back(frame.timestamp_query);
+    }
+    glDeleteSync(frame.fence);
+    pending.pop_front();
+    return true;
+}
+
+void FramePacer::waitUntil(uint64_t time_ns) const {
+    uint64_t now = Profiler::now();
+    if (now + SPIN_NS < time_ns)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(time_ns - now - SPIN_NS));
+    while (Profiler::now() < time_ns)
+        std::this_thread::yield();
+}
+
+void FramePacer::beginFrame() {
+    PROFILE_SCOPE("FramePacer::beginFrame");
+    // Finished frames first, so their latency is measured close to when they completed
+    while (!pending.empty() && retire(false)) {}
+    while (max_frames_in_flight > 0 && pending.size() >= max_frames_in_flight)
+        retire(true);
+
+    if (frame_period_ns > 0) {
+        uint64_t now = Profiler::now();
+        if (next_frame_ns > now)
+            waitUntil(next_frame_ns);
+        // A frame that ran long starts the schedule over instead of being followed by a burst
+        next_frame_ns = next_frame_ns + frame_period_ns > now ? next_frame_ns + frame_period_ns
+                                                              : now + frame_period_ns;
+    }
+}
+
+void FramePacer::endFrame(uint64_t input_time_ns) {
+    unsigned int query = 0;
+    if (input_time_ns != 0) {
+        if (!gpu_calibrated) {
+            // Map GPU timestamps onto the clock input times come from
+            GLint64 gpu_time = 0;
+            glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+            gpu_clock_offset = static_cast<int64_t>(Profiler::now()) - gpu_time;
+            gpu_calibrated = true;
+        }
+        if (free_queries.empty()) {
+            free_queries.resize(1);
+            glGenQueries(1, free_queries.data());
+        }
+        query = free_queries.back();
+        free_queries.pop_back();
+        glQueryCounter(query, GL_TIMESTAMP);
+    }
+    pending.push_back(PendingFrame{glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), query, input_time_ns});
+}
@@ -0,0 +1,66 @@
+//
+// Created by Andrew on 5/6/2021.
+//
+
+#include "frame_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <string>
+
+void FrameTimeStats::tick() {
+    auto now = std::chrono::steady_clock::now();
+    if (started)
+        addFrameTime(std::chrono::duration<double, std::milli>(now - last_tick).count());
+    last_tick = now;
+    started = true;
+}
+
+void FrameTimeStats::addFrameTime(double milliseconds) {
+    frame_times.push_back(milliseconds);
+}
+
+double FrameTimeStats::average() const {
+    if (frame_times.empty())
+        return 0.0;
+    return std::accumulate(frame_times.begin(), frame_times.end(), 0.0) / static_cast<double>(frame_times.size());
+}
+
+double FrameTimeStats::percentile(double p) const {
+    if (frame_times.empty())
+        return 0.0;
+    vector<double> sorted(frame_times);
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * static_cast<double>(sorted.size())));
+    rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+    std::nth_element(sorted.begin(), sorted.begin() + (rank - 1), sorted.end());
+    return sorted[rank - 1];
+}
+
+void FrameTimeStats::report(std::ostream &out, double bucket_ms, unsigned int n_buckets) const {
+    out << std::fixed << std::setprecision(3)
+        << "Frames: " << frame_times.size() << '\n'
+        << "Average: " << average() << " ms\n"
+        << "p50: " << percentile(50.0) << " ms\n"
+        << "p95: " << percentile(95.0) << " ms\n"
+        << "p99: " << percentile(99.0) << " ms\n";
+    if (frame_times.empty())
+        return;
+
+    // Last bucket collects everything slower
+    vector<size_t> buckets(n_buckets, 0);
+    for (double frame_time: frame_times) {
+        auto bucket = static_cast<size_t>(frame_time / bucket_ms);
+        ++buckets[std::min(bucket, buckets.size() - 1)];
+    }
+    size_t max_count = *std::max_element(buckets.begin(), buckets.end());
+    out << "Histogram (" << bucket_ms << " ms buckets):\n";
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        if (buckets[i] == 0)
+            continue;
+        out << std::setw(8) << bucket_ms * static_cast<double>(i) << (i + 1 == buckets.size() ? "+ " : "  ")
+            << std::setw(8) << buckets[i] << ' ' << std::string(buckets[i] * 50 / max_count, '#') << '\n';
+    }
+    out << std::defaultfloat;
+}
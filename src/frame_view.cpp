@@ -0,0 +1,66 @@
+//
+// Created by Andrew on 5/28/2021.
+//
+
+#include "frame_view.h"
+
+#include <cmath>
+
+FrameView::FrameView(float z_near, float z_far) : z_near(z_near), z_far(z_far) {
+    view_matrix = projection_matrix = view_projection_matrix = Eigen::Matrix4f::Identity();
+    inverse_view_matrix = inverse_projection_matrix = inverse_view_projection_matrix = Eigen::Matrix4f::Identity();
+    planes.fill(Eigen::Vector4f::Zero());
+    corners.fill(Eigen::Vector3f::Zero());
+}
+
+bool FrameView::update(const Camera &camera, unsigned int viewport_width, unsigned int viewport_height) {
+    float camera_fov_y = degree2Radian(camera.zoom);
+    if (viewport_width == 0 || viewport_height == 0) // Minimized window, keep the last view
+        return false;
+    if (view_version > 0 && camera.position == eye && camera.front == front && camera.world_up == world_up &&
+        camera_fov_y == fov_y && viewport_width == width && viewport_height == height)
+        return false;
+    eye = camera.position;
+    front = camera.front;
+    world_up = camera.world_up;
+    fov_y = camera_fov_y;
+    width = viewport_width;
+    height = viewport_height;
+    ++view_version;
+
+    view_matrix = camera.getViewMatrix();
+    projection_matrix = perspective(fov_y, aspectRatio(), z_near, z_far);
+    view_projection_matrix = projection_matrix * view_matrix;
+    // The view is a rigid transform, its inverse needs no general inversion
+    inverse_view_matrix = Eigen::Matrix4f::Identity();
+    inverse_view_matrix.topLeftCorner<3, 3>() = view_matrix.topLeftCorner<3, 3>().transpose();
+    inverse_view_matrix.topRightCorner<3, 1>() = eye;
+    inverse_projection_matrix = projection_matrix.inverse();
+    inverse_view_projection_matrix = inverse_view_matrix * inverse_projection_matrix;
+
+    planes = ::frustumPlanes(view_projection_matrix);
+
+    // From the camera axes rather than the inverse, which loses precision at the far plane
+    Eigen::Vector3f right = view_matrix.block<1, 3>(0, 0).transpose();
+    Eigen::Vector3f up = view_matrix.block<1, 3>(1, 0).transpose();
+    Eigen::Vector3f forward = -view_matrix.block<1, 3>(2, 0).transpose();
+    float half_height = std::tan(fov_y / 2.0f), half_width = half_height * aspectRatio();
+    for (int i = 0; i < 2; ++i) {
+        float distance = i == 0 ? z_near : z_far;
+        Eigen::Vector3f center = eye + forward * distance;
+        Eigen::Vector3f half_up = up * (distance * half_height), half_right = right * (distance * half_width);
+        corners[i * 4] = center - half_right - half_up;
+        corners[i * 4 + 1] = center + half_right - half_up;
+        corners[i * 4 + 2] = center + half_right + half_up;
+        corners[i * 4 + 3] = center - half_right + half_up;
+    }
+    return true;
+}
+
+bool FrameView::intersectsSphere(const Eigen::Vector3f &center, float radius) const {
+    return sphereInFrustum(planes, center, radius);
+}
+
+bool FrameView::intersectsBox(const Eigen::Vector3f &min_corner, const Eigen::Vector3f &max_corner) const {
+    return boxInFrustum(planes, min_corner, max_corner);
+}
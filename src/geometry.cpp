@@ -39,3 +39,50 @@ Eigen::Matrix4f orthographic(float left, float right, float bottom, float top, f
                            0, 0, 0, 1;
     return orthographic_matrix;
 }
+
+std::array<Eigen::Vector4f, 6> frustumPlanes(const Eigen::Matrix4f &view_projection) {
+    // Gribb and Hartmann: each clip space bound -w <= x <= w is a row combination of the matrix
+    const Eigen::Matrix4f &m = view_projection;
+    std::array<Eigen::Vector4f, 6> planes;
+    planes[FRUSTUM_LEFT] = (m.row(3) + m.row(0)).transpose();
+    planes[FRUSTUM_RIGHT] = (m.row(3) - m.row(0)).transpose();
+    planes[FRUSTUM_BOTTOM] = (m.row(3) + m.row(1)).transpose();
+    planes[FRUSTUM_TOP] = (m.row(3) - m.row(1)).transpose();
+    planes[FRUSTUM_NEAR] = (m.row(3) + m.row(2)).transpose();
+    planes[FRUSTUM_FAR] = (m.row(3) - m.row(2)).transpose();
+    for (auto &plane: planes)
+        plane /= plane.head<3>().norm();
+    return planes;
+}
+
+bool sphereInFrustum(const std::array<Eigen::Vector4f, 6> &planes, const Eigen::Vector3f &center, float radius) {
+    for (auto &plane: planes) {
+        if (plane.head<3>().dot(center) + plane[3] < -radius)
+            return false;
+    }
+    return true;
+}
+
+bool boxInFrustum(const std::array<Eigen::Vector4f, 6> &planes, const Eigen::Vector3f &min_corner,
+                  const Eigen::Vector3f &max_corner) {
+    for (auto &plane: planes) {
+        // The corner furthest along the plane normal
+        Eigen::Vector3f positive = (plane.head<3>().array() >= 0.0f).select(max_corner.array(), min_corner.array());
+        if (plane.head<3>().dot(positive) + plane[3] < 0.0f)
+            return false;
+    }
+    return true;
+}
+
+Ray screenRay(const Eigen::Matrix4f &view, const Eigen::Matrix4f &projection, float x, float y, float width,
+              float height) {
+    Eigen::Matrix4f inverse = (projection * view).inverse();
+    float ndc_x = 2.0f * x / width - 1.0f;
+    float ndc_y = 1.0f - 2.0f * y / height;
+    Eigen::Vector4f near_point = inverse * Eigen::Vector4f(ndc_x, ndc_y, -1.0f, 1.0f);
+    Eigen::Vector4f far_point = inverse * Eigen::Vector4f(ndc_x, ndc_y, 1.0f, 1.0f);
+    Ray ray;
+    ray.origin = near_point.head<3>() / near_point[3];
+    ray.direction = (far_point.head<3>() / far_point[3] - ray.origin).normalized();
+    return ray;
+}
@@ -0,0 +1,25 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#include "gl_util.h"
+
+#include <string>
+#include <unordered_set>
+
+#include <glad/glad.h>
+
+bool hasGLExtension(const char *name) {
+    static const std::unordered_set<std::string> extensions = [] {
+        std::unordered_set<std::string> names;
+        int n_extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &n_extensions);
+        for (int i = 0; i < n_extensions; ++i) {
+            auto extension = reinterpret_cast<const char *>(glGetStringi(GL_EXTENSIONS, i));
+            if (extension)
+                names.insert(extension);
+        }
+        return names;
+    }();
+    return extensions.count(name) > 0;
+}
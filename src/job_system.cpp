@@ -0,0 +1,230 @@
+//
+// Created by Andrew on 6/8/2021.
+//
+
+#include "job_system.h"
+
+#include <algorithm>
+
+#include "profiler.h"
+
+namespace {
+
+// Index of the worker running on this thread, -1 on every other thread
+thread_local int current_worker = -1;
+
+}
+
+JobSystem &JobSystem::instance() {
+    static JobSystem job_system;
+    return job_system;
+}
+
+void JobSystem::start(unsigned int n_workers) {
+    if (isRunning())
+        return;
+    if (n_workers == 0)
+        n_workers = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    // Asynchronous jobs need somewhere to run besides the threads that queue them
+    n_workers = std::max(n_workers, 1u);
+    main_thread.store(std::this_thread::get_id());
+    stopping = false;
+    for (unsigned int i = 0; i < n_workers; ++i)
+        workers.emplace_back(new Worker());
+    for (unsigned int i = 0; i < n_workers; ++i)
+        workers[i]->thread = std::thread(&JobSystem::workerLoop, this, i);
+}
+
+void JobSystem::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto &worker: workers)
+        worker->thread.join();
+    workers.clear();
+    pumpMainThread();
+}
+
+void JobSystem::setMainThread() {
+    main_thread.store(std::this_thread::get_id());
+}
+
+void JobSystem::workerLoop(unsigned int index) {
+    current_worker = static_cast<int>(index);
+    while (true) {
+        Job job;
+        if (takeJob(job)) {
+            execute(job);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        if (stopping && n_queued.load() <= 0)
+            return;
+        work_ready.wait(lock, [this] { return stopping || n_queued.load() > 0; });
+    }
+}
+
+void JobSystem::run(const char *name, std::function<void()> function, JobCounter *counter,
+                    JobCounter *dependency) {
+    if (counter)
+        counter->count.fetch_add(1, std::memory_order_relaxed);
+    Job job{name, std::move(function), counter};
+    if (dependency) {
+        std::unique_lock<std::mutex> lock(dependency->mutex);
+        if (dependency->count.load(std::memory_order_acquire) > 0) {
+            dependency->continuations.push_back(std::move(job));
+            return;
+        }
+    }
+    schedule(std::move(job));
+}
+
+void JobSystem::runOnMainThread(const char *name, std::function<void()> function, JobCounter *counter) {
+    if (counter)
+        counter->count.fetch_add(1, std::memory_order_relaxed);
+    Job job{name, std::move(function), counter};
+    if (!isRunning()) {
+        execute(job);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(main_mutex);
+    main_jobs.push_back(std::move(job));
+}
+
+void JobSystem::schedule(Job job) {
+    if (!isRunning()) {
+        execute(job);
+        return;
+    }
+    if (current_worker >= 0) {
+        Worker &worker = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    } else {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        shared_jobs.push_back(std::move(job));
+    }
+    n_queued.fetch_add(1);
+    // Taking the lock orders this with a worker between checking for work and going to sleep
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    work_ready.notify_one();
+}
+
+bool JobSystem::takeJob(Job &job) {
+    if (current_worker < 0 && isMainThread()) {
+        std::lock_guard<std::mutex> lock(main_mutex);
+        if (!main_jobs.empty()) {
+            job = std::move(main_jobs.front());
+            main_jobs.pop_front();
+            return true;
+        }
+    }
+    // Own jobs newest first, they are the likeliest to still be in cache
+    if (current_worker >= 0) {
+        Worker &worker = *workers[current_worker];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+            n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(shared_mutex);
+        if (!shared_jobs.empty()) {
+            job = std::move(shared_jobs.front());
+            shared_jobs.pop_front();
+            n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    // Steal the oldest job of another worker, the one its owner would get to last
+    auto n_workers = static_cast<unsigned int>(workers.size());
+    unsigned int first = current_worker >= 0 ? static_cast<unsigned int>(current_worker) + 1 : 0;
+    for (unsigned int i = 0; i < n_workers; ++i) {
+        unsigned int victim = (first + i) % n_workers;
+        if (static_cast<int>(victim) == current_worker)
+            continue;
+        Worker &worker = *workers[victim];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.front());
+            worker.jobs.pop_front();
+            n_queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobSystem::execute(Job &job) {
+    uint64_t begin_ns = Profiler::now();
+    {
+        ProfileScope scope(job.name);
+        job.function();
+    }
+    if (observer)
+        observer(job.name, begin_ns, Profiler::now());
+    finish(job.counter);
+}
+
+void JobSystem::finish(JobCounter *counter) {
+    if (!counter)
+        return;
+    vector<Job> ready;
+    {
+        // Under the lock, so wait() can tell when the counter is no longer touched
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (counter->count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            ready.swap(counter->continuations);
+    }
+    for (auto &job: ready)
+        schedule(std::move(job));
+}
+
+void JobSystem::wait(JobCounter &counter, unsigned int target) {
+    while (counter.pending() > target) {
+        Job job;
+        if (takeJob(job))
+            execute(job);
+        else
+            std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(counter.mutex);
+}
+
+void JobSystem::pumpMainThread() {
+    std::deque<Job> jobs;
+    {
+        std::lock_guard<std::mutex> lock(main_mutex);
+        jobs.swap(main_jobs);
+    }
+    for (auto &job: jobs)
+        execute(job);
+}
+
+void JobSystem::parallelFor(const char *name, size_t n, const std::function<void(size_t, size_t)> &body,
+                            size_t min_grain) {
+    if (n == 0)
+        return;
+    size_t n_chunks = (workers.size() + 1) * CHUNKS_PER_THREAD;
+    size_t grain = std::max(std::max(min_grain, size_t(1)), (n + n_chunks - 1) / n_chunks);
+    if (!isRunning() || grain >= n) {
+        ProfileScope scope(name);
+        body(0, n);
+        return;
+    }
+    JobCounter counter;
+    for (size_t begin = grain; begin < n; begin += grain) {
+        size_t end = std::min(begin + grain, n);
+        run(name, [&body, begin, end] { body(begin, end); }, &counter);
+    }
+    {
+        ProfileScope scope(name);
+        body(0, grain);
+    }
+    wait(counter);
+}
@@ -0,0 +1,99 @@
+//
+// Created by Andrew on 5/8/2021.
+//
+
+#include "memory_tracker.h"
+
+#include <algorithm>
+#include <iomanip>
+
+MemoryTracker &MemoryTracker::instance() {
+    static MemoryTracker tracker;
+    return tracker;
+}
+
+const char *MemoryTracker::categoryName(MemoryCategory category) {
+    switch (category) {
+        case MEMORY_MESH:
+            return "mesh";
+        case MEMORY_TEXTURE:
+            return "texture";
+        case MEMORY_BUFFER:
+            return "buffer";
+        case MEMORY_FRAMEBUFFER:
+            return "framebuffer";
+    }
+    return "unknown";
+}
+
+void MemoryTracker::track(MemoryCategory category, unsigned int id, const string &name, const MemoryUsage &usage) {
+    std::lock_guard<std::mutex> lock(mutex);
+    assets[std::make_pair(category, id)] = Record{category, id, name, usage};
+}
+
+void MemoryTracker::untrack(MemoryCategory category, unsigned int id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    assets.erase(std::make_pair(category, id));
+}
+
+MemoryUsage MemoryTracker::usage(MemoryCategory category, unsigned int id) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = assets.find(std::make_pair(category, id));
+    return it == assets.end() ? MemoryUsage() : it->second.usage;
+}
+
+MemoryUsage MemoryTracker::total() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    MemoryUsage usage;
+    for (auto &asset: assets)
+        usage += asset.second.usage;
+    return usage;
+}
+
+MemoryUsage MemoryTracker::total(MemoryCategory category) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    MemoryUsage usage;
+    for (auto &asset: assets) {
+        if (asset.second.category == category)
+            usage += asset.second.usage;
+    }
+    return usage;
+}
+
+vector<MemoryTracker::Record> MemoryTracker::records() const {
+    vector<Record> sorted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &asset: assets)
+            sorted.push_back(asset.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const Record &a, const Record &b) {
+        return a.usage.cpu_bytes + a.usage.gpu_bytes > b.usage.cpu_bytes + b.usage.gpu_bytes;
+    });
+    return sorted;
+}
+
+static double toMiB(size_t bytes) {
+    return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+void MemoryTracker::report(std::ostream &out, size_t max_records) const {
+    vector<Record> sorted = records();
+    out << std::fixed << std::setprecision(2);
+    MemoryUsage sum = total();
+    out << "Memory: " << toMiB(sum.cpu_bytes) << " MiB CPU, " << toMiB(sum.gpu_bytes) << " MiB GPU\n";
+    for (MemoryCategory category: {MEMORY_MESH, MEMORY_TEXTURE, MEMORY_BUFFER, MEMORY_FRAMEBUFFER}) {
+        MemoryUsage category_usage = total(category);
+        out << "  " << std::setw(11) << categoryName(category) << ": " << toMiB(category_usage.cpu_bytes)
+            << " MiB CPU, " << toMiB(category_usage.gpu_bytes) << " MiB GPU\n";
+    }
+    for (size_t i = 0; i < sorted.size() && i < max_records; ++i) {
+        const Record &record = sorted[i];
+        out << std::setw(10) << toMiB(record.usage.cpu_bytes) << " CPU " << std::setw(10)
+            << toMiB(record.usage.gpu_bytes) << " GPU  " << categoryName(record.category) << ' '
+            << record.id << ' ' << record.name << '\n';
+    }
+    if (sorted.size() > max_records)
+        out << "  ... " << sorted.size() - max_records << " more\n";
+    out << std::defaultfloat;
+}
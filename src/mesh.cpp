@@ -4,23 +4,86 @@
 
 #include "mesh.h"
 
+#include <algorithm>
+#include <cmath>
+
 #include <glad/glad.h>
 
-Mesh::Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<Texture> &textures) {
+#include "batch_geometry.h"
+#include "draw_list.h"
+#include "dynamic_vertex_buffer.h"
+#include "profiler.h"
+
+namespace {
+
+// Sampler the shaders declare for the Nth texture of a type, 1-based. Diffuse maps are texture1, texture2...
+string samplerName(const string &type, unsigned int number) {
+    if (type == "texture_diffuse")
+        return "texture" + std::to_string(number);
+    return type + std::to_string(number);
+}
+
+}
+
+Mesh::Mesh(vector<Vertex> &vertices, vector<unsigned int> &indices, vector<Texture> &textures,
+           const string &name, bool dynamic) {
     this->vertices = vertices;
     this->indices = indices;
     this->textures = textures;
-    setup_mesh();
+    this->name = name;
+    compute_bounds();
+    setup_mesh(dynamic);
 }
 
-void Mesh::setup_mesh() {
+void Mesh::compute_bounds() {
+    if (vertices.empty())
+        return;
+    PointsSoA positions;
+    positions.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        positions.x[i] = vertices[i].position[0];
+        positions.y[i] = vertices[i].position[1];
+        positions.z[i] = vertices[i].position[2];
+    }
+    computeBounds(positions, bounds_min, bounds_max);
+    bounds_center = (bounds_min + bounds_max) / 2.0f;
+    bounds_radius = 0.0f;
+    for (auto &vertex: vertices)
+        bounds_radius = std::max(bounds_radius, (vertex.position - bounds_center).norm());
+
+    // Ratio of texture space to surface area, the texel density texture streaming estimates demand from
+    double surface_area = 0.0, uv_area = 0.0;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        const Vertex &a = vertices[indices[i]], &b = vertices[indices[i + 1]], &c = vertices[indices[i + 2]];
+        surface_area += 0.5 * (b.position - a.position).cross(c.position - a.position).norm();
+        Eigen::Vector2f ab = b.texture_coordinates - a.texture_coordinates;
+        Eigen::Vector2f ac = c.texture_coordinates - a.texture_coordinates;
+        uv_area += 0.5 * std::fabs(ab[0] * ac[1] - ab[1] * ac[0]);
+    }
+    uv_density = surface_area > 0.0 ? static_cast<float>(std::sqrt(uv_area / surface_area)) : 0.0f;
+}
+
+void Mesh::setup_mesh(bool dynamic) {
+    // Pick the shader permutation
+    shader_features = 0;
+    for (auto &texture: textures) {
+        if (texture.type == "texture_diffuse")
+            shader_features |= SHADER_FEATURE_TEXTURE;
+    }
+
     glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    if (dynamic) {
+        dynamic_vertices = std::make_shared<DynamicVertexBuffer>(vertices);
+        VBO = dynamic_vertices->bufferID();
+    } else {
+        glGenBuffers(1, &VBO);
+    }
     glGenBuffers(1, &EBO);
 
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    if (!dynamic)
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
@@ -37,53 +100,116 @@ void Mesh::setup_mesh() {
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, texture_coordinates));
 
     glBindVertexArray(0);
+
+    MemoryTracker::instance().track(MEMORY_MESH, VAO, name, memoryUsage());
+}
+
+vector<VertexAttribute> Mesh::vertexLayout() {
+    return {{"position", 0, 3},
+            {"normal", 1, 3},
+            {"texture_coordinates", 2, 2}};
+}
+
+MemoryUsage Mesh::memoryUsage() const {
+    MemoryUsage usage;
+    usage.cpu_bytes = vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int) +
+                      textures.capacity() * sizeof(Texture);
+    usage.gpu_bytes = indices.size() * sizeof(unsigned int);
+    if (dynamic_vertices)
+        usage += dynamic_vertices->memoryUsage();
+    else
+        usage.gpu_bytes += vertices.size() * sizeof(Vertex);
+    return usage;
 }
 
-void Mesh::draw(const Shader *shader) {
+void Mesh::draw(const Shader *shader, unsigned int n_instances) {
+    PROFILE_SCOPE("Mesh::draw");
+    PROFILE_GPU_SCOPE("Mesh::draw");
     unsigned int diffuse_idx = 1;
     unsigned int specular_idx = 1;
     unsigned int texture_idx = 0;
 
-    // Normal textures
-    if (textures.empty()) {
-        shader->setBool("use_texture", false);
-    } else {
-        shader->setBool("use_texture", true);
+    // Normal textures. Permutations have texture presence compiled in instead
+    if (!shader->isSpecialized()) {
+        if (textures.empty()) {
+            shader->setBool("use_texture", false);
+        } else {
+            shader->setBool("use_texture", true);
+        }
     }
 
     for (unsigned int i = 0; i < textures.size(); ++i, ++texture_idx) {
         glActiveTexture(GL_TEXTURE0 + texture_idx); // Activate proper texture unit before binding
 
-        // Retrieve texture number (the N in diffuse_textureN)
-        string number;
-        string name = textures[i].type;
-        if(name == "texture_diffuse")
-            number = std::to_string(diffuse_idx++);
-        else if(name == "texture_specular")
-            number = std::to_string(specular_idx++);
-
-//        shader->setInt("material." + name + number, static_cast<int>(i));
-        shader->setInt(name + number, static_cast<int>(texture_idx));
+        // Retrieve texture number (the N in texture_specularN)
+        const string &name = textures[i].type;
+        unsigned int number = name == "texture_diffuse" ? diffuse_idx++ : specular_idx++;
+        // Maps the shader does not sample are bound but left without a sampler
+        int location = shader->findUniform(samplerName(name, number));
+        if (location >= 0)
+            glUniform1i(location, static_cast<int>(texture_idx));
         glBindTexture(GL_TEXTURE_2D, textures[i].id);
     }
 
     // Draw call
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    draw_elements(n_instances);
 
     // Unbind
-    glBindVertexArray(0);
     for (unsigned int i = 0; i < texture_idx; i++) {
         glActiveTexture(GL_TEXTURE0 + i); // Activate proper texture unit before binding
         glBindTexture(GL_TEXTURE_2D, 0);
     }
 }
 
+void Mesh::record(const Shader *shader, DrawPacket &packet) const {
+    packet.program = shader->ID;
+    packet.vao = VAO;
+    packet.index_count = static_cast<unsigned int>(indices.size());
+    packet.dynamic_vertices = dynamic_vertices.get();
+
+    // Same sampler naming as draw(). Permutations sample at most a few maps, more are dropped
+    unsigned int diffuse_idx = 1;
+    unsigned int specular_idx = 1;
+    packet.n_textures = std::min(static_cast<unsigned int>(textures.size()), DrawPacket::MAX_TEXTURES);
+    for (unsigned int i = 0; i < packet.n_textures; ++i) {
+        const string &name = textures[i].type;
+        unsigned int number = name == "texture_diffuse" ? diffuse_idx++ : specular_idx++;
+        packet.textures[i] = textures[i].id;
+        packet.sampler_locations[i] = shader->findUniform(samplerName(name, number));
+    }
+}
+
+void Mesh::release() {
+    MemoryTracker::instance().untrack(MEMORY_MESH, VAO);
+    glDeleteVertexArrays(1, &VAO);
+    if (dynamic_vertices)
+        dynamic_vertices->release();
+    else
+        glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+}
+
 void Mesh::draw_depth() {
     // Draw call
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    draw_elements();
+}
 
-    // Unbind
+void Mesh::draw_elements(unsigned int n_instances) {
+    glBindVertexArray(VAO);
+    if (dynamic_vertices) {
+        // The base vertex picks the region holding the newest vertices
+        dynamic_vertices->prepareDraw();
+        if (n_instances == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0,
+                                     dynamic_vertices->baseVertex());
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, n_instances,
+                                              dynamic_vertices->baseVertex());
+        dynamic_vertices->fenceDraw();
+    } else if (n_instances == 1) {
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    } else {
+        glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, n_instances);
+    }
     glBindVertexArray(0);
 }
\ No newline at end of file
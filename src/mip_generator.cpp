@@ -0,0 +1,231 @@
+//
+// Created by Andrew on 5/23/2021.
+//
+
+#include "mip_generator.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "batch_geometry.h"
+#include "job_system.h"
+#include "profiler.h"
+
+namespace {
+
+// Below this many texels per pass jobs cost more than they save
+const size_t PARALLEL_THRESHOLD = 64 * 1024;
+
+// Modified Bessel function of the first kind, order 0, for the Kaiser window
+double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+struct ColorTables {
+    float srgb_to_linear[256];
+    unsigned char linear_to_srgb[4096];
+
+    ColorTables() {
+        for (int i = 0; i < 256; ++i) {
+            double value = i / 255.0;
+            srgb_to_linear[i] = static_cast<float>(value <= 0.04045 ? value / 12.92
+                                                                    : std::pow((value + 0.055) / 1.055, 2.4));
+        }
+        for (int i = 0; i < 4096; ++i) {
+            double value = i / 4095.0;
+            value = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+            linear_to_srgb[i] = static_cast<unsigned char>(std::lround(value * 255.0));
+        }
+    }
+};
+
+const ColorTables &colorTables() {
+    static ColorTables tables;
+    return tables;
+}
+
+inline float saturate(float value) {
+    return std::min(std::max(value, 0.0f), 1.0f);
+}
+
+}
+
+unsigned int MipChain::levelWidth(unsigned int level) const {
+    return std::max(1u, width >> level);
+}
+
+unsigned int MipChain::levelHeight(unsigned int level) const {
+    return std::max(1u, height >> level);
+}
+
+MipGenerator::MipGenerator(MipFilter filter, unsigned int n_threads) : n_threads(n_threads) {
+    if (filter == MIP_FILTER_BOX) {
+        tap_offsets = {0, 1};
+        tap_weights = {0.5f, 0.5f};
+        return;
+    }
+    // Destination texel x covers source texels 2x and 2x+1, its center sits between them. Cutoff at half
+    // the source frequency, window radius of three source texels
+    const double radius = 3.0, beta = 4.0, pi = 3.14159265358979323846;
+    double total = 0.0;
+    for (int offset = -2; offset <= 3; ++offset) {
+        double distance = offset - 0.5;
+        double x = distance / 2.0;
+        double sinc = std::sin(pi * x) / (pi * x);
+        double ratio = distance / radius;
+        double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - ratio * ratio))) / besselI0(beta);
+        tap_offsets.push_back(offset);
+        tap_weights.push_back(static_cast<float>(sinc * window));
+        total += sinc * window;
+    }
+    for (auto &weight: tap_weights)
+        weight = static_cast<float>(weight / total);
+}
+
+void MipGenerator::parallelRows(unsigned int n_rows, size_t row_cost,
+                                const std::function<void(unsigned int, unsigned int)> &run) const {
+    if (n_threads == 1 || n_rows * row_cost < PARALLEL_THRESHOLD) {
+        run(0, n_rows);
+        return;
+    }
+    // Every range is worth a job, and there are at most n_threads of them if that is set
+    size_t min_rows = (PARALLEL_THRESHOLD / 4 + row_cost - 1) / row_cost;
+    if (n_threads > 1)
+        min_rows = std::max<size_t>(min_rows, (n_rows + n_threads - 1) / n_threads);
+    JobSystem::instance().parallelFor("MipGenerator::rows", n_rows, [&run](size_t begin, size_t end) {
+        run(static_cast<unsigned int>(begin), static_cast<unsigned int>(end));
+    }, min_rows);
+}
+
+void MipGenerator::downsampleHorizontal(const float *source, unsigned int width, float *destination,
+                                        unsigned int row_begin, unsigned int row_end) const {
+    unsigned int next_width = std::max(1u, width / 2);
+    auto n_taps = static_cast<unsigned int>(tap_offsets.size());
+#ifdef __SSE2__
+    bool sse2 = simdLevel() != SIMD_SCALAR;
+#endif
+    for (unsigned int y = row_begin; y < row_end; ++y) {
+        const float *source_row = source + static_cast<size_t>(y) * width * 4;
+        float *destination_row = destination + static_cast<size_t>(y) * next_width * 4;
+        for (unsigned int x = 0; x < next_width; ++x) {
+#ifdef __SSE2__
+            if (sse2) {
+                // One RGBA texel per register
+                __m128 sum = _mm_setzero_ps();
+                for (unsigned int i = 0; i < n_taps; ++i) {
+                    int source_x = std::min(std::max(static_cast<int>(2 * x) + tap_offsets[i], 0),
+                                            static_cast<int>(width) - 1);
+                    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(source_row + source_x * 4),
+                                                     _mm_set1_ps(tap_weights[i])));
+                }
+                _mm_storeu_ps(destination_row + x * 4, sum);
+                continue;
+            }
+#endif
+            float sum[4] = {};
+            for (unsigned int i = 0; i < n_taps; ++i) {
+                int source_x = std::min(std::max(static_cast<int>(2 * x) + tap_offsets[i], 0),
+                                        static_cast<int>(width) - 1);
+                for (unsigned int c = 0; c < 4; ++c)
+                    sum[c] += source_row[source_x * 4 + c] * tap_weights[i];
+            }
+            std::copy(sum, sum + 4, destination_row + x * 4);
+        }
+    }
+}
+
+void MipGenerator::downsampleVertical(const float *source, unsigned int width, unsigned int height,
+                                      float *destination, unsigned int row_begin, unsigned int row_end) const {
+    auto n_taps = static_cast<unsigned int>(tap_offsets.size());
+    size_t row_floats = static_cast<size_t>(width) * 4;
+#ifdef __SSE2__
+    bool sse2 = simdLevel() != SIMD_SCALAR;
+#endif
+    for (unsigned int y = row_begin; y < row_end; ++y) {
+        float *destination_row = destination + y * row_floats;
+        std::fill(destination_row, destination_row + row_floats, 0.0f);
+        // Whole rows at a time, so the inner loop streams through memory
+        for (unsigned int i = 0; i < n_taps; ++i) {
+            int source_y = std::min(std::max(static_cast<int>(2 * y) + tap_offsets[i], 0),
+                                    static_cast<int>(height) - 1);
+            const float *source_row = source + source_y * row_floats;
+#ifdef __SSE2__
+            if (sse2) {
+                __m128 weight = _mm_set1_ps(tap_weights[i]);
+                for (size_t j = 0; j < row_floats; j += 4) {
+                    __m128 sum = _mm_add_ps(_mm_loadu_ps(destination_row + j),
+                                            _mm_mul_ps(_mm_loadu_ps(source_row + j), weight));
+                    _mm_storeu_ps(destination_row + j, sum);
+                }
+                continue;
+            }
+#endif
+            for (size_t j = 0; j < row_floats; ++j)
+                destination_row[j] += source_row[j] * tap_weights[i];
+        }
+    }
+}
+
+void MipGenerator::generate(const unsigned char *rgba, unsigned int width, unsigned int height,
+                            bool gamma_correct, MipChain &chain) const {
+    PROFILE_SCOPE("MipGenerator::generate");
+    const ColorTables &tables = colorTables();
+    chain.width = width;
+    chain.height = height;
+    chain.levels.clear();
+    chain.levels.emplace_back(rgba, rgba + static_cast<size_t>(width) * height * 4);
+
+    // Filtering happens in linear floating point, only the stored levels are quantized
+    vector<float> level(static_cast<size_t>(width) * height * 4);
+    for (size_t i = 0; i < level.size(); ++i) {
+        bool color = gamma_correct && i % 4 != 3;
+        level[i] = color ? tables.srgb_to_linear[rgba[i]] : rgba[i] / 255.0f;
+    }
+
+    vector<float> horizontal, next;
+    unsigned int level_width = width, level_height = height;
+    while (level_width > 1 || level_height > 1) {
+        unsigned int next_width = std::max(1u, level_width / 2), next_height = std::max(1u, level_height / 2);
+        horizontal.resize(static_cast<size_t>(next_width) * level_height * 4);
+        next.resize(static_cast<size_t>(next_width) * next_height * 4);
+
+        const float *source = level.data();
+        parallelRows(level_height, level_width, [&](unsigned int begin, unsigned int end) {
+            if (level_width > 1)
+                downsampleHorizontal(source, level_width, horizontal.data(), begin, end);
+            else
+                std::copy(source + begin * 4, source + end * 4, horizontal.data() + begin * 4);
+        });
+        parallelRows(next_height, next_width * 2, [&](unsigned int begin, unsigned int end) {
+            if (level_height > 1) {
+                downsampleVertical(horizontal.data(), next_width, level_height, next.data(), begin, end);
+            } else {
+                size_t row_floats = static_cast<size_t>(next_width) * 4;
+                std::copy(horizontal.data() + begin * row_floats, horizontal.data() + end * row_floats,
+                          next.data() + begin * row_floats);
+            }
+        });
+
+        chain.levels.emplace_back(next.size());
+        vector<unsigned char> &stored = chain.levels.back();
+        for (size_t i = 0; i < next.size(); ++i) {
+            float value = saturate(next[i]); // Sinc lobes overshoot
+            bool color = gamma_correct && i % 4 != 3;
+            stored[i] = color ? tables.linear_to_srgb[std::lround(value * 4095.0f)]
+                              : static_cast<unsigned char>(std::lround(value * 255.0f));
+        }
+
+        level.swap(next);
+        level_width = next_width;
+        level_height = next_height;
+    }
+}
@@ -0,0 +1,123 @@
+//
+// Created by Andrew on 5/31/2021.
+//
+
+#include "multi_view_renderer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "gl_util.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+
+using std::cout;
+using std::endl;
+
+MultiViewRenderer::MultiViewRenderer(unsigned int width, unsigned int height, unsigned int n_views) :
+        width(width), height(height), n_views(std::min(std::max(n_views, 1u), MAX_VIEWS)),
+        single_pass(layeredVertexOutput()) {
+    glGenTextures(1, &color_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, color_texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, static_cast<int>(width), static_cast<int>(height),
+                   static_cast<int>(this->n_views));
+    glGenTextures(1, &depth_texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT24, static_cast<int>(width), static_cast<int>(height),
+                   static_cast<int>(this->n_views));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    attachLayer(-1);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        cout << "ERROR::MULTI_VIEW::FRAMEBUFFER_INCOMPLETE" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGenFramebuffers(1, &read_framebuffer);
+
+    glGenBuffers(1, &view_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, view_buffer);
+    glBufferData(GL_UNIFORM_BUFFER, MAX_VIEWS * sizeof(Eigen::Matrix4f), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    MemoryUsage usage;
+    usage.gpu_bytes = static_cast<size_t>(width) * height * (4 + 4) * this->n_views;
+    MemoryTracker::instance().track(MEMORY_TEXTURE, color_texture, "multi-view framebuffer", usage);
+    usage.gpu_bytes = MAX_VIEWS * sizeof(Eigen::Matrix4f);
+    MemoryTracker::instance().track(MEMORY_BUFFER, view_buffer, "multi-view view matrices", usage);
+    if (!single_pass)
+        cout << "Multi-view: no layered vertex output, rendering one pass per view" << endl;
+}
+
+MultiViewRenderer::~MultiViewRenderer() {
+    MemoryTracker::instance().untrack(MEMORY_TEXTURE, color_texture);
+    MemoryTracker::instance().untrack(MEMORY_BUFFER, view_buffer);
+    glDeleteBuffers(1, &view_buffer);
+    glDeleteFramebuffers(1, &read_framebuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &depth_texture);
+    glDeleteTextures(1, &color_texture);
+}
+
+bool MultiViewRenderer::layeredVertexOutput() {
+    return hasGLExtension("GL_ARB_shader_viewport_layer_array") || hasGLExtension("GL_AMD_vertex_shader_layer");
+}
+
+void MultiViewRenderer::attachLayer(int layer) {
+    // The framebuffer has to be bound. Negative attaches every layer
+    if (layer < 0) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0);
+    } else {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0, layer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0, layer);
+    }
+    layered_attachment = layer < 0;
+}
+
+void MultiViewRenderer::render(Scene *scene, ShaderVariants *variants, const vector<Eigen::Matrix4f> &view_projections,
+                               const Eigen::Matrix4f &model, unsigned int extra_features) {
+    PROFILE_SCOPE("MultiViewRenderer::render");
+    PROFILE_GPU_SCOPE("MultiViewRenderer::render");
+    auto count = static_cast<unsigned int>(std::min<size_t>(view_projections.size(), n_views));
+    if (count == 0)
+        return;
+    extra_features |= SHADER_FEATURE_MULTIVIEW;
+    // Uniforms below only reach variants that exist
+    for (unsigned int features: scene->shaderFeatureSets())
+        variants->prepare(features | extra_features);
+    variants->wait();
+
+    // Eigen matrices are 16 contiguous floats, the same as std140 mat4 array elements
+    glBindBuffer(GL_UNIFORM_BUFFER, view_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, count * sizeof(Eigen::Matrix4f), view_projections[0].data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, VIEW_BINDING, view_buffer);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, static_cast<int>(width), static_cast<int>(height));
+    variants->setMat4("model", model);
+    if (single_pass) {
+        if (!layered_attachment)
+            attachLayer(-1);
+        // A layered clear covers every layer
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        variants->setInt("view_count", static_cast<int>(count));
+        scene->draw(variants, extra_features, count);
+    } else {
+        for (unsigned int view = 0; view < count; ++view) {
+            attachLayer(static_cast<int>(view));
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            variants->setInt("view_index", static_cast<int>(view));
+            scene->draw(variants, extra_features);
+        }
+    }
+}
+
+void MultiViewRenderer::bindLayerForRead(unsigned int view) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0, static_cast<int>(view));
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+}
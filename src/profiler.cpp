@@ -0,0 +1,175 @@
+//
+// Created by Andrew on 5/2/2021.
+//
+
+#include "profiler.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include <glad/glad.h>
+
+using std::cerr;
+using std::endl;
+
+Profiler &Profiler::instance() {
+    static Profiler profiler;
+    return profiler;
+}
+
+uint64_t Profiler::now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void Profiler::setEnabled(bool enabled) {
+    this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+Profiler::ThreadBuffer *Profiler::threadBuffer() {
+    thread_local ThreadBuffer *buffer = nullptr;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        thread_buffers.emplace_back(new ThreadBuffer());
+        buffer = thread_buffers.back().get();
+        buffer->thread_id = static_cast<uint32_t>(thread_buffers.size()); // 0 is reserved for the GPU
+    }
+    return buffer;
+}
+
+void Profiler::recordCPU(const char *name, uint64_t begin_ns, uint64_t end_ns) {
+    // Single producer ring, only this thread ever moves head
+    ThreadBuffer *buffer = threadBuffer();
+    size_t head = buffer->head.load(std::memory_order_relaxed);
+    if (head - buffer->tail.load(std::memory_order_acquire) >= ThreadBuffer::CAPACITY) {
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer->events[head % ThreadBuffer::CAPACITY] = Event{name, begin_ns, end_ns, buffer->thread_id};
+    buffer->head.store(head + 1, std::memory_order_release);
+}
+
+unsigned int Profiler::acquireQuery() {
+    if (free_queries.empty()) {
+        unsigned int queries[64];
+        glGenQueries(64, queries);
+        free_queries.insert(free_queries.end(), queries, queries + 64);
+    }
+    unsigned int query = free_queries.back();
+    free_queries.pop_back();
+    return query;
+}
+
+int64_t Profiler::beginGPU(const char *name) {
+    if (!gpu_calibrated) {
+        // Map GPU timestamps onto the CPU clock so both timelines line up in the trace
+        GLint64 gpu_time = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+        gpu_clock_offset = static_cast<int64_t>(now()) - gpu_time;
+        gpu_calibrated = true;
+    }
+    GPUScope scope{name, acquireQuery(), acquireQuery(), false};
+    glQueryCounter(scope.begin_query, GL_TIMESTAMP);
+    gpu_pending.push_back(scope);
+    return gpu_first_scope + static_cast<int64_t>(gpu_pending.size()) - 1;
+}
+
+void Profiler::endGPU(int64_t scope) {
+    GPUScope &gpu_scope = gpu_pending[scope - gpu_first_scope];
+    glQueryCounter(gpu_scope.end_query, GL_TIMESTAMP);
+    gpu_scope.ended = true;
+}
+
+void Profiler::newFrame() {
+    drainThreadBuffers();
+    readbackGPU();
+}
+
+void Profiler::drainThreadBuffers() {
+    std::lock_guard<std::mutex> registry_lock(registry_mutex);
+    std::lock_guard<std::mutex> events_lock(events_mutex);
+    for (auto &buffer: thread_buffers) {
+        size_t tail = buffer->tail.load(std::memory_order_relaxed);
+        size_t head = buffer->head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            if (events.size() < MAX_EVENTS)
+                events.push_back(buffer->events[tail % ThreadBuffer::CAPACITY]);
+            else
+                ++dropped_events;
+        }
+        buffer->tail.store(head, std::memory_order_release);
+    }
+}
+
+void Profiler::readbackGPU(bool wait) {
+    // Queries complete in submission order, so stop at the first one still in flight instead of waiting
+    size_t n_done = 0;
+    std::lock_guard<std::mutex> events_lock(events_mutex);
+    for (auto &scope: gpu_pending) {
+        if (!scope.ended)
+            break;
+        GLint available = 0;
+        if (!wait)
+            glGetQueryObjectiv(scope.end_query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!wait && !available)
+            break;
+        GLuint64 begin_time = 0, end_time = 0;
+        glGetQueryObjectui64v(scope.begin_query, GL_QUERY_RESULT, &begin_time);
+        glGetQueryObjectui64v(scope.end_query, GL_QUERY_RESULT, &end_time);
+        if (events.size() < MAX_EVENTS) {
+            events.push_back(Event{scope.name,
+                                   static_cast<uint64_t>(static_cast<int64_t>(begin_time) + gpu_clock_offset),
+                                   static_cast<uint64_t>(static_cast<int64_t>(end_time) + gpu_clock_offset),
+                                   GPU_THREAD_ID});
+        } else {
+            ++dropped_events;
+        }
+        free_queries.push_back(scope.begin_query);
+        free_queries.push_back(scope.end_query);
+        ++n_done;
+    }
+    gpu_pending.erase(gpu_pending.begin(), gpu_pending.begin() + n_done);
+    gpu_first_scope += static_cast<int64_t>(n_done);
+}
+
+bool Profiler::exportChromeTrace(const string &path) {
+    drainThreadBuffers();
+    readbackGPU(true);
+
+    FILE *file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        cerr << "Failed to open file: " << path << endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> registry_lock(registry_mutex);
+    std::lock_guard<std::mutex> events_lock(events_mutex);
+    uint64_t origin = events.empty() ? 0 : events.front().begin_ns;
+    for (auto &event: events) {
+        if (event.begin_ns < origin)
+            origin = event.begin_ns;
+    }
+
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}",
+                 GPU_THREAD_ID);
+    for (auto &buffer: thread_buffers) {
+        std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                           "\"args\":{\"name\":\"CPU %u\"}}", buffer->thread_id, buffer->thread_id);
+        uint64_t dropped = buffer->dropped.load(std::memory_order_relaxed);
+        if (dropped)
+            cerr << "Profiler dropped " << dropped << " events on thread " << buffer->thread_id << endl;
+    }
+    if (dropped_events)
+        cerr << "Profiler dropped " << dropped_events << " events past its limit of " << MAX_EVENTS << endl;
+    for (auto &event: events) {
+        std::fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                           "\"ts\":%.3f,\"dur\":%.3f}",
+                     event.name, event.thread_id == GPU_THREAD_ID ? "gpu" : "cpu", event.thread_id,
+                     static_cast<double>(event.begin_ns - origin) / 1000.0,
+                     static_cast<double>(event.end_ns - event.begin_ns) / 1000.0);
+    }
+    std::fprintf(file, "\n]}\n");
+    return std::fclose(file) == 0;
+}
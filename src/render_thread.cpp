@@ -0,0 +1,64 @@
+//
+// Created by Andrew on 6/2/2021.
+//
+
+#include "render_thread.h"
+
+#include "profiler.h"
+
+RenderThread::RenderThread(std::function<void()> acquire_context,
+                           std::function<void(const FrameSnapshot &)> render_frame,
+                           std::function<void()> release_context, FramePacer *pacer) :
+        acquire_context(std::move(acquire_context)), render_frame(std::move(render_frame)),
+        release_context(std::move(release_context)), pacer(pacer), thread(&RenderThread::loop, this) {}
+
+RenderThread::~RenderThread() {
+    stop();
+}
+
+void RenderThread::submit(FrameSnapshot &snapshot) {
+    snapshots.post(snapshot);
+    // Only this thread writes submitted, reading it unlocked is safe here
+    if (!submitted) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            submitted = true;
+        }
+        wake.notify_one();
+    }
+}
+
+void RenderThread::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        stopping.store(true, std::memory_order_release);
+    }
+    wake.notify_one();
+    if (thread.joinable())
+        thread.join();
+}
+
+void RenderThread::loop() {
+    acquire_context();
+    {
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake.wait(lock, [this] { return submitted || stopping.load(std::memory_order_acquire); });
+    }
+    FrameSnapshot snapshot;
+    while (!stopping.load(std::memory_order_acquire)) {
+        if (pacer)
+            pacer->beginFrame();
+        // Only the newest snapshot is drawn, latched as late as possible. The first one is always there
+        bool latched = snapshots.take(snapshot);
+        // Without a new snapshot the last one is drawn again, the buffer swap paces the loop
+        {
+            PROFILE_SCOPE("RenderThread::frame");
+            render_frame(snapshot);
+        }
+        if (pacer)
+            pacer->endFrame(latched ? snapshot.input_time_ns : 0);
+        last_rendered_tick.store(snapshot.tick, std::memory_order_relaxed);
+        frames_rendered.fetch_add(1, std::memory_order_relaxed);
+    }
+    release_context();
+}
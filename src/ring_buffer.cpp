@@ -0,0 +1,136 @@
+//
+// Created by Andrew on 5/18/2021.
+//
+
+#include "ring_buffer.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "memory_tracker.h"
+#include "profiler.h"
+
+using std::cout;
+using std::endl;
+
+size_t DynamicRingBuffer::offsetAlignment(GLenum target) {
+    int alignment = 1;
+    if (target == GL_UNIFORM_BUFFER)
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    else if (target == GL_SHADER_STORAGE_BUFFER)
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return static_cast<size_t>(std::max(alignment, 1));
+}
+
+DynamicRingBuffer::DynamicRingBuffer(size_t frame_size, GLenum target, unsigned int n_frames) :
+        target(target), alignment(offsetAlignment(target)), n_frames(std::min(std::max(n_frames, 1u), MAX_FRAMES)) {
+    // Regions start on an aligned offset
+    this->frame_size = (frame_size + alignment - 1) / alignment * alignment;
+    size_t total_size = this->frame_size * this->n_frames;
+    // Start on the last region so the first beginFrame lands on region 0
+    frame = this->n_frames - 1;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer);
+    // Immutable storage is core since 4.4, the context asks for 4.3
+    if (glBufferStorage) {
+        glBindBuffer(target, buffer);
+        glBufferStorage(target, static_cast<GLsizeiptr>(total_size), nullptr, flags);
+        mapped = static_cast<unsigned char *>(glMapBufferRange(target, 0, static_cast<GLsizeiptr>(total_size),
+                                                               flags));
+        glBindBuffer(target, 0);
+        persistent = mapped != nullptr;
+        if (!persistent) {
+            cout << "ERROR::RING_BUFFER::MAPPING_FAILED" << endl;
+            // Immutable storage cannot be respecified, start over with a mutable buffer
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+        }
+    }
+    if (!persistent) {
+        cout << "Ring buffer: no persistent mapping, uploading every frame" << endl;
+        staging.resize(total_size);
+        mapped = staging.data();
+        glBindBuffer(target, buffer);
+        glBufferData(target, static_cast<GLsizeiptr>(total_size), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+    }
+
+    MemoryUsage usage;
+    usage.cpu_bytes = staging.size();
+    usage.gpu_bytes = total_size;
+    MemoryTracker::instance().track(MEMORY_BUFFER, buffer, "dynamic ring buffer", usage);
+}
+
+DynamicRingBuffer::~DynamicRingBuffer() {
+    for (auto &fence: fences) {
+        if (fence)
+            glDeleteSync(fence);
+    }
+    MemoryTracker::instance().untrack(MEMORY_BUFFER, buffer);
+    if (persistent) {
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+void DynamicRingBuffer::beginFrame() {
+    frame = (frame + 1) % n_frames;
+    frame_offset = 0;
+    if (!persistent) {
+        // Orphan: the driver hands out fresh storage while the GPU finishes reading the old one
+        glBindBuffer(target, buffer);
+        glBufferData(target, static_cast<GLsizeiptr>(frame_size * n_frames), nullptr, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+        return;
+    }
+    GLsync &fence = fences[frame];
+    if (fence) {
+        PROFILE_SCOPE("DynamicRingBuffer::wait");
+        // Usually signaled long ago, then this returns immediately
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        while (result == GL_TIMEOUT_EXPIRED)
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+}
+
+void DynamicRingBuffer::endFrame() {
+    if (!persistent)
+        return;
+    if (fences[frame])
+        glDeleteSync(fences[frame]);
+    fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+DynamicRingBuffer::Allocation DynamicRingBuffer::allocate(size_t size) {
+    size_t aligned_offset = (frame_offset + alignment - 1) / alignment * alignment;
+    if (aligned_offset + size > frame_size) {
+        if (!overflow_reported) {
+            cout << "ERROR::RING_BUFFER::FRAME_REGION_FULL " << frame_size << " bytes" << endl;
+            overflow_reported = true;
+        }
+        return Allocation{nullptr, 0, 0};
+    }
+    frame_offset = aligned_offset + size;
+    size_t offset = frame * frame_size + aligned_offset;
+    return Allocation{mapped + offset, offset, size};
+}
+
+void DynamicRingBuffer::flush(const Allocation &allocation) const {
+    if (persistent || !allocation.data)
+        return;
+    glBindBuffer(target, buffer);
+    glBufferSubData(target, static_cast<GLintptr>(allocation.offset), static_cast<GLsizeiptr>(allocation.size),
+                    staging.data() + allocation.offset);
+    glBindBuffer(target, 0);
+}
+
+void DynamicRingBuffer::bindRange(unsigned int binding, const Allocation &allocation) const {
+    flush(allocation);
+    glBindBufferRange(target, binding, buffer, static_cast<GLintptr>(allocation.offset),
+                      static_cast<GLsizeiptr>(allocation.size));
+}
@@ -1,19 +1,65 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <limits>
 
 #include <Eigen/Dense>
 #include <glad/glad.h>
 #include <assimp/Importer.hpp>
+#include <assimp/material.h>
 #include <assimp/postprocess.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
+#include "batch_geometry.h"
+#include "draw_list.h"
+#include "dynamic_vertex_buffer.h"
+#include "geometry.h"
+#include "job_system.h"
+#include "profiler.h"
+#include "texture_cooker.h"
+
 using std::cout;
 using std::endl;
 typedef Mesh::Texture Texture;
 typedef Mesh::Vertex Vertex;
 
+namespace {
+
+// Matches the std140 DrawData block in the shaders
+struct DrawData {
+    float model[16];
+    float base_color[4];
+};
+
+TriangleSource triangleSource(const Mesh &mesh) {
+    TriangleSource source;
+    if (mesh.vertices.empty())
+        return source;
+    source.positions = mesh.vertices[0].position.data();
+    source.stride = sizeof(Vertex);
+    source.indices = mesh.indices.data();
+    source.n_triangles = mesh.indices.size() / 3;
+    return source;
+}
+
+// Permutation taking its matrices from uniforms, for draws the ring buffer had no room for
+Shader *uniformVariant(ShaderVariants *variants, unsigned int features, const Eigen::Matrix4f &model,
+                       const FrameView &view) {
+    Shader *shader = variants->get(features & ~SHADER_FEATURE_DRAW_DATA);
+    glProgramUniformMatrix4fv(shader->ID, shader->uniformLocation("model"), 1, GL_FALSE, model.data());
+    glProgramUniformMatrix4fv(shader->ID, shader->uniformLocation("view"), 1, GL_FALSE, view.view().data());
+    glProgramUniformMatrix4fv(shader->ID, shader->uniformLocation("projection"), 1, GL_FALSE,
+                              view.projection().data());
+    return shader;
+}
+
+}
+
+TextureStreamer *Scene::texture_streamer = nullptr;
+
 Scene::Scene(const vector<string> &path_list) {
     for (auto &path: path_list) {
         loadModel(path);
@@ -26,19 +72,394 @@ Scene::Scene(const vector<string> &path_list, bool with_texture) {
     }
 }
 
+void Scene::addMesh(const Mesh &mesh) {
+    meshes.push_back(mesh);
+    meshAdded();
+    ++geometry_version;
+}
+
+void Scene::meshAdded() {
+    const Mesh &mesh = meshes.back();
+    mesh_centers.x.push_back(mesh.bounds_center[0]);
+    mesh_centers.y.push_back(mesh.bounds_center[1]);
+    mesh_centers.z.push_back(mesh.bounds_center[2]);
+    mesh_radii.push_back(mesh.bounds_radius);
+    mesh_boxes.min_x.push_back(mesh.bounds_min[0]);
+    mesh_boxes.min_y.push_back(mesh.bounds_min[1]);
+    mesh_boxes.min_z.push_back(mesh.bounds_min[2]);
+    mesh_boxes.max_x.push_back(mesh.bounds_max[0]);
+    mesh_boxes.max_y.push_back(mesh.bounds_max[1]);
+    mesh_boxes.max_z.push_back(mesh.bounds_max[2]);
+    meshes_by_features_dirty = true;
+}
+
+const std::map<unsigned int, vector<unsigned int>> &Scene::meshesByFeatures() {
+    if (meshes_by_features_dirty) {
+        meshes_by_features.clear();
+        for (unsigned int i = 0; i < meshes.size(); ++i)
+            meshes_by_features[meshes[i].shader_features].push_back(i);
+        meshes_by_features_dirty = false;
+    }
+    return meshes_by_features;
+}
+
+vector<unsigned int> Scene::shaderFeatureSets() {
+    vector<unsigned int> feature_sets;
+    for (auto &group: meshesByFeatures())
+        feature_sets.push_back(group.first);
+    return feature_sets;
+}
+
 void Scene::draw(const Shader *shader) {
+    PROFILE_SCOPE("Scene::draw");
+    PROFILE_GPU_SCOPE("Scene::draw");
     for (auto &mesh: meshes)
         mesh.draw(shader);
 }
 
+void Scene::draw(ShaderVariants *variants, unsigned int extra_features, unsigned int n_instances) {
+    PROFILE_SCOPE("Scene::draw");
+    PROFILE_GPU_SCOPE("Scene::draw");
+    for (auto &group: meshesByFeatures()) {
+        Shader *shader = variants->get(group.first | extra_features);
+        shader->use();
+        for (unsigned int mesh_index: group.second)
+            meshes[mesh_index].draw(shader, n_instances);
+    }
+}
+
+void Scene::draw(ShaderVariants *variants, DynamicRingBuffer *draw_buffer, const Eigen::Matrix4f &model,
+                 const FrameView &view, unsigned int extra_features) {
+    PROFILE_SCOPE("Scene::draw");
+    PROFILE_GPU_SCOPE("Scene::draw");
+    for (auto &group: meshesByFeatures()) {
+        unsigned int features = group.first | extra_features | SHADER_FEATURE_DRAW_DATA;
+        Shader *shader = variants->get(features);
+        shader->use();
+        for (unsigned int mesh_index: group.second) {
+            Mesh &mesh = meshes[mesh_index];
+            DynamicRingBuffer::Allocation allocation = draw_buffer->allocate(sizeof(DrawData));
+            if (!allocation.data) {
+                // Ring buffer full, the rest of the group draws with uniforms
+                shader = uniformVariant(variants, features, model, view);
+                shader->use();
+                mesh.draw(shader);
+                continue;
+            }
+            auto *draw_data = static_cast<DrawData *>(allocation.data);
+            Eigen::Map<Eigen::Matrix4f>(draw_data->model) = model;
+            Eigen::Map<Eigen::Vector4f>(draw_data->base_color) = mesh.base_color;
+            draw_buffer->bindRange(1, allocation);
+            mesh.draw(shader);
+        }
+    }
+}
+
+void Scene::prepareRecording(ShaderVariants *variants, DynamicRingBuffer *draw_buffer, const Eigen::Matrix4f &model,
+                             const FrameView &view, unsigned int extra_features, SceneRecording &recording) {
+    PROFILE_SCOPE("Scene::prepareRecording");
+    updateRecording(model, view, recording);
+    recording.draw_order.clear();
+    recording.shaders.assign(meshes.size(), nullptr);
+    if (draw_buffer)
+        extra_features |= SHADER_FEATURE_DRAW_DATA;
+    // Variants are built here if missing, recording threads only read them
+    for (auto &group: meshesByFeatures()) {
+        const Shader *shader = variants->get(group.first | extra_features);
+        for (unsigned int mesh_index: group.second) {
+            recording.draw_order.push_back(mesh_index);
+            recording.shaders[mesh_index] = shader;
+        }
+    }
+
+    recording.draw_data = DynamicRingBuffer::Allocation{nullptr, 0, 0};
+    recording.draw_data_stride = 0;
+    if (draw_buffer && !meshes.empty()) {
+        size_t alignment = DynamicRingBuffer::offsetAlignment(GL_UNIFORM_BUFFER);
+        recording.draw_data_stride = (sizeof(DrawData) + alignment - 1) / alignment * alignment;
+        recording.draw_data = draw_buffer->allocate(recording.draw_data_stride * meshes.size());
+    }
+    if (draw_buffer && !recording.draw_data.data) {
+        // Ring buffer full, every draw sets its matrices through uniforms
+        recording.draw_data_stride = 0;
+        for (auto &group: meshesByFeatures()) {
+            const Shader *shader = uniformVariant(variants, group.first | extra_features, model, view);
+            for (unsigned int mesh_index: group.second)
+                recording.shaders[mesh_index] = shader;
+        }
+    }
+}
+
+void Scene::updateRecording(const Eigen::Matrix4f &model, const FrameView &view, SceneRecording &recording) const {
+    recording.model = model;
+    recording.planes = view.frustumPlanes();
+    recording.model_scale = model.block<3, 3>(0, 0).colwise().norm().maxCoeff();
+    transformPoints(model, mesh_centers, recording.centers);
+}
+
+void Scene::recordDraws(const SceneRecording &recording, size_t begin, size_t end, DrawList &list) const {
+    for (size_t position = begin; position < end; ++position) {
+        unsigned int mesh_index = recording.draw_order[position];
+        const Mesh &mesh = meshes[mesh_index];
+        // Dynamic meshes rewrite their vertices, their bounds from load time do not hold
+        const PointsSoA &centers = recording.centers;
+        Eigen::Vector3f center(centers.x[mesh_index], centers.y[mesh_index], centers.z[mesh_index]);
+        float radius = mesh_radii[mesh_index] * recording.model_scale;
+        if (!mesh.isDynamic() && !sphereInFrustum(recording.planes, center, radius))
+            continue;
+
+        DrawPacket packet;
+        mesh.record(recording.shaders[mesh_index], packet);
+        if (recording.draw_data.data) {
+            size_t offset = position * recording.draw_data_stride;
+            auto *draw_data = reinterpret_cast<DrawData *>(static_cast<char *>(recording.draw_data.data) + offset);
+            Eigen::Map<Eigen::Matrix4f>(draw_data->model) = recording.model;
+            Eigen::Map<Eigen::Vector4f>(draw_data->base_color) = mesh.base_color;
+            packet.draw_data_offset = recording.draw_data.offset + offset;
+            packet.draw_data_size = sizeof(DrawData);
+        }
+        list.packets.push_back(packet);
+    }
+}
+
+void Scene::requestTextureLevels(TextureStreamer *streamer, const Eigen::Matrix4f &model,
+                                 const FrameView &view) const {
+    PROFILE_SCOPE("Scene::requestTextureLevels");
+    float scale = model.block<3, 3>(0, 0).colwise().norm().maxCoeff();
+    SpheresSoA spheres;
+    spheres.resize(meshes.size());
+    PointsSoA centers;
+    transformPoints(model, mesh_centers, centers);
+    spheres.x = centers.x;
+    spheres.y = centers.y;
+    spheres.z = centers.z;
+    for (size_t i = 0; i < meshes.size(); ++i)
+        spheres.radius[i] = mesh_radii[i] * scale;
+    ScreenRectsSoA rects;
+    projectSpheres(view.view(), view.projection(), spheres, rects);
+    // World units one pixel spans at distance 1
+    float pixel_size = 2.0f * std::tan(view.fovY() / 2.0f) / static_cast<float>(view.viewportHeight());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        const Mesh &mesh = meshes[i];
+        if (mesh.textures.empty() || mesh.uv_density <= 0.0f || rects.visibility[i] == SPHERE_BEHIND)
+            continue;
+        // World units per pixel, from how many pixels the sphere diameter covers. A sphere reaching past the
+        // near plane is as close as the camera gets
+        float world_per_pixel = view.zNear() * pixel_size;
+        float rect_height = (rects.max_y[i] - rects.min_y[i]) * 0.5f * static_cast<float>(view.viewportHeight());
+        if (rects.visibility[i] == SPHERE_PROJECTED && rect_height > 0.0f)
+            world_per_pixel = std::max(2.0f * spheres.radius[i] / rect_height, world_per_pixel);
+        float uv_per_pixel = mesh.uv_density / scale * world_per_pixel;
+        for (auto &texture: mesh.textures)
+            streamer->request(texture.id, uv_per_pixel);
+    }
+}
+
+unsigned int Scene::meshCount() const {
+    return static_cast<unsigned int>(meshes.size());
+}
+
 void Scene::draw_depth() {
+    PROFILE_SCOPE("Scene::draw_depth");
+    PROFILE_GPU_SCOPE("Scene::draw_depth");
     for (auto &mesh: meshes)
         mesh.draw_depth();
 }
 
+void Scene::draw_depth(const vector<unsigned int> &mesh_indices) {
+    PROFILE_SCOPE("Scene::draw_depth");
+    PROFILE_GPU_SCOPE("Scene::draw_depth");
+    for (unsigned int mesh_index: mesh_indices)
+        meshes[mesh_index].draw_depth();
+}
+
+void Scene::cull(const Eigen::Matrix4f &model, const std::array<Eigen::Vector4f, 6> &planes,
+                 vector<unsigned int> &visible, bool *has_dynamic) const {
+    PROFILE_SCOPE("Scene::cull");
+    visible.clear();
+    if (has_dynamic)
+        *has_dynamic = false;
+    // Dynamic meshes rewrite their vertices, their boxes from load time do not hold
+    const BoundsSoA *boxes = &mesh_boxes;
+    BoundsSoA current_boxes;
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+        if (!meshes[i].isDynamic())
+            continue;
+        if (boxes == &mesh_boxes) {
+            current_boxes = mesh_boxes;
+            boxes = &current_boxes;
+        }
+        Eigen::Vector3f min_corner, max_corner;
+        meshes[i].dynamicVertices()->bounds(min_corner, max_corner);
+        current_boxes.min_x[i] = min_corner[0];
+        current_boxes.min_y[i] = min_corner[1];
+        current_boxes.min_z[i] = min_corner[2];
+        current_boxes.max_x[i] = max_corner[0];
+        current_boxes.max_y[i] = max_corner[1];
+        current_boxes.max_z[i] = max_corner[2];
+    }
+    BoundsSoA world_boxes;
+    transformBounds(model, *boxes, world_boxes);
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+        Eigen::Vector3f min_corner(world_boxes.min_x[i], world_boxes.min_y[i], world_boxes.min_z[i]);
+        Eigen::Vector3f max_corner(world_boxes.max_x[i], world_boxes.max_y[i], world_boxes.max_z[i]);
+        if (!boxInFrustum(planes, min_corner, max_corner))
+            continue;
+        visible.push_back(i);
+        if (has_dynamic && meshes[i].isDynamic())
+            *has_dynamic = true;
+    }
+}
+
+bool Scene::boundingSphere(const Eigen::Matrix4f &model, Eigen::Vector3f &center, float &radius) const {
+    if (meshes.empty())
+        return false;
+    float scale = model.block<3, 3>(0, 0).colwise().norm().maxCoeff();
+    PointsSoA centers;
+    transformPoints(model, mesh_centers, centers);
+    // Box around the mesh spheres, then a sphere around those
+    Eigen::Vector3f min_corner = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+    Eigen::Vector3f max_corner = -min_corner;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        Eigen::Vector3f mesh_center(centers.x[i], centers.y[i], centers.z[i]);
+        min_corner = min_corner.cwiseMin(mesh_center - Eigen::Vector3f::Constant(mesh_radii[i] * scale));
+        max_corner = max_corner.cwiseMax(mesh_center + Eigen::Vector3f::Constant(mesh_radii[i] * scale));
+    }
+    center = (min_corner + max_corner) / 2.0f;
+    radius = 0.0f;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        Eigen::Vector3f mesh_center(centers.x[i], centers.y[i], centers.z[i]);
+        radius = std::max(radius, (mesh_center - center).norm() + mesh_radii[i] * scale);
+    }
+    return true;
+}
+
+void Scene::prepareRayQueries() {
+    if (mesh_bvhs.size() == meshes.size())
+        return;
+    PROFILE_SCOPE("Scene::prepareRayQueries");
+    size_t first = mesh_bvhs.size();
+    mesh_bvhs.resize(meshes.size());
+    JobSystem::instance().parallelFor("Scene::buildBvh", meshes.size() - first, [&](size_t begin, size_t end) {
+        for (size_t i = first + begin; i < first + end; ++i) {
+            if (!meshes[i].isDynamic())
+                mesh_bvhs[i].build(triangleSource(meshes[i]));
+        }
+    });
+    // Meshes without triangles keep an empty box, which leaves them out
+    vector<Eigen::AlignedBox3f> boxes(meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        Eigen::Vector3f min_corner, max_corner;
+        if (mesh_bvhs[i].bounds(min_corner, max_corner))
+            boxes[i] = Eigen::AlignedBox3f(min_corner, max_corner);
+    }
+    mesh_tree.build(boxes);
+}
+
+bool Scene::raycast(const Eigen::Matrix4f &model, const Ray &ray, RayHit &hit, float max_distance) {
+    PROFILE_SCOPE("Scene::raycast");
+    prepareRayQueries();
+    // Model space ray. The direction keeps the scale of the inverse, so distances along it stay world distances
+    Eigen::Matrix4f inverse_model = model.inverse();
+    Eigen::Vector3f origin = (inverse_model * ray.origin.homogeneous()).head<3>();
+    Eigen::Vector3f direction = inverse_model.block<3, 3>(0, 0) * ray.direction;
+    bool found = false;
+    mesh_tree.traverse(origin, direction, 0.0f, max_distance, [&](const unsigned int *mesh_indices,
+                                                                  unsigned int count, float &closest) {
+        for (unsigned int k = 0; k < count; ++k) {
+            unsigned int i = mesh_indices[k];
+            TriangleHit triangle_hit;
+            if (!mesh_bvhs[i].closestHit(triangleSource(meshes[i]), origin, direction, closest, triangle_hit))
+                continue;
+            // Later meshes only count when closer
+            closest = triangle_hit.distance;
+            hit.mesh = i;
+            hit.triangle = triangle_hit.triangle;
+            hit.barycentrics = Eigen::Vector3f(1.0f - triangle_hit.u - triangle_hit.v, triangle_hit.u,
+                                               triangle_hit.v);
+            hit.distance = triangle_hit.distance;
+            found = true;
+        }
+        return true;
+    });
+    if (found)
+        hit.position = ray.origin + hit.distance * ray.direction;
+    return found;
+}
+
+bool Scene::raycastAny(const Eigen::Matrix4f &model, const Ray &ray, float max_distance) {
+    PROFILE_SCOPE("Scene::raycastAny");
+    prepareRayQueries();
+    Eigen::Matrix4f inverse_model = model.inverse();
+    Eigen::Vector3f origin = (inverse_model * ray.origin.homogeneous()).head<3>();
+    Eigen::Vector3f direction = inverse_model.block<3, 3>(0, 0) * ray.direction;
+    bool found = false;
+    mesh_tree.traverse(origin, direction, 0.0f, max_distance, [&](const unsigned int *mesh_indices,
+                                                                  unsigned int count, float &limit) {
+        for (unsigned int k = 0; k < count && !found; ++k) {
+            unsigned int i = mesh_indices[k];
+            found = mesh_bvhs[i].anyHit(triangleSource(meshes[i]), origin, direction, limit);
+        }
+        return !found;
+    });
+    return found;
+}
+
+bool Scene::sweepSphere(const Eigen::Matrix4f &model, const Eigen::Vector3f &center, float radius,
+                        const Eigen::Vector3f &motion, SphereSweepHit &hit) {
+    PROFILE_SCOPE("Scene::sweepSphere");
+    prepareRayQueries();
+    // Fractions of the motion are the same in model space, only the radius needs the scale
+    Eigen::Matrix4f inverse_model = model.inverse();
+    Eigen::Vector3f model_center = (inverse_model * center.homogeneous()).head<3>();
+    Eigen::Vector3f model_motion = inverse_model.block<3, 3>(0, 0) * motion;
+    float model_radius = radius / model.block<3, 3>(0, 0).colwise().norm().maxCoeff();
+    bool found = false;
+    TriangleSweepHit closest_hit;
+    mesh_tree.traverse(model_center, model_motion, model_radius, 1.0f, [&](const unsigned int *mesh_indices,
+                                                                           unsigned int count, float &closest) {
+        for (unsigned int k = 0; k < count; ++k) {
+            unsigned int i = mesh_indices[k];
+            TriangleSweepHit triangle_hit;
+            if (!mesh_bvhs[i].sweepSphere(triangleSource(meshes[i]), model_center, model_radius, model_motion,
+                                          closest, triangle_hit))
+                continue;
+            closest = triangle_hit.fraction;
+            closest_hit = triangle_hit;
+            hit.mesh = i;
+            found = true;
+        }
+        return true;
+    });
+    if (!found)
+        return false;
+    hit.triangle = closest_hit.triangle;
+    hit.fraction = closest_hit.fraction;
+    hit.position = (model * closest_hit.point.homogeneous()).head<3>();
+    hit.normal = (model.block<3, 3>(0, 0) * closest_hit.normal).normalized();
+    return true;
+}
+
+MemoryUsage Scene::memoryUsage() const {
+    MemoryUsage usage;
+    for (auto &mesh: meshes)
+        usage += mesh.memoryUsage();
+    for (auto &bvh: mesh_bvhs)
+        usage.cpu_bytes += bvh.memoryBytes();
+    usage.cpu_bytes += mesh_tree.memoryBytes();
+    for (auto &texture: textures_loaded)
+        usage += MemoryTracker::instance().usage(MEMORY_TEXTURE, texture.id);
+    return usage;
+}
+
 void Scene::loadModel(const string &path, bool with_texture) {
+    PROFILE_SCOPE("Scene::loadModel");
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    const aiScene *scene;
+    {
+        PROFILE_SCOPE("Assimp::ReadFile");
+        scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    }
 
     if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
@@ -46,7 +467,39 @@ void Scene::loadModel(const string &path, bool with_texture) {
     }
     directory = path.substr(0, path.find_last_of('/'));
 
+    // The streamer cooks its textures itself, keeping only the levels it needs
+    if (with_texture && !texture_streamer)
+        cookMaterialTextures(scene);
     processNode(scene->mRootNode, scene, with_texture);
+    pending_textures.clear();
+}
+
+void Scene::cookMaterialTextures(const aiScene *scene) {
+    PROFILE_SCOPE("Scene::cookMaterialTextures");
+    // The texture types processMesh loads
+    const std::pair<aiTextureType, const char *> types[] = {{aiTextureType_DIFFUSE,  "texture_diffuse"},
+                                                            {aiTextureType_SPECULAR, "texture_specular"}};
+    for (unsigned int m = 0; m < scene->mNumMaterials; ++m) {
+        for (auto &type: types) {
+            for (unsigned int i = 0; i < scene->mMaterials[m]->GetTextureCount(type.first); ++i) {
+                aiString str;
+                scene->mMaterials[m]->GetTexture(type.first, i, &str);
+                bool loaded = std::any_of(textures_loaded.begin(), textures_loaded.end(), [&str](const Texture &t) {
+                    return t.path == str.C_Str();
+                });
+                if (!loaded)
+                    pending_textures[{directory + '/' + str.C_Str(), type.second}];
+            }
+        }
+    }
+    // Decode, mip chain and encode, each texture a job. Map nodes stay put while the jobs write them
+    JobCounter counter;
+    for (auto &entry: pending_textures) {
+        JobSystem::instance().run("Scene::cookTexture", [&entry] {
+            entry.second.success = TextureCooker::cook(entry.first.first, entry.first.second, entry.second.cooked);
+        }, &counter);
+    }
+    JobSystem::instance().wait(counter);
 }
 
 void Scene::processNode(aiNode *node, const aiScene *scene, bool with_texture) {
@@ -54,6 +507,8 @@ void Scene::processNode(aiNode *node, const aiScene *scene, bool with_texture) {
     for(unsigned int i = 0; i < node->mNumMeshes; i++) {
         aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
         meshes.push_back(processMesh(mesh, scene, with_texture));
+        meshAdded();
+        ++geometry_version;
     }
     // then do the same for each of its children
     for(unsigned int i = 0; i < node->mNumChildren; i++) {
@@ -62,10 +517,37 @@ void Scene::processNode(aiNode *node, const aiScene *scene, bool with_texture) {
 }
 
 Mesh Scene::processMesh(aiMesh *mesh, const aiScene *scene, bool with_texture) {
+    PROFILE_SCOPE("Scene::processMesh");
     vector<Vertex> vertices;
     vector<unsigned int> indices;
     vector<Texture> textures;
+    readMesh(mesh, vertices, indices);
+
+    // Process material
+    Eigen::Vector4f base_color(0.8f, 0.8f, 0.8f, 1.0f);
+    if(scene && mesh->mMaterialIndex < scene->mNumMaterials) {
+        aiColor4D diffuse_color;
+        if (aiGetMaterialColor(scene->mMaterials[mesh->mMaterialIndex], AI_MATKEY_COLOR_DIFFUSE,
+                               &diffuse_color) == AI_SUCCESS)
+            base_color = Eigen::Vector4f(diffuse_color.r, diffuse_color.g, diffuse_color.b, diffuse_color.a);
+    }
+    if(mesh->mMaterialIndex >= 0 && with_texture) {
+        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+
+        vector<Texture> diffuseMaps = loadMaterialTextures(material,
+                                                           aiTextureType_DIFFUSE, "texture_diffuse");
+        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+        vector<Texture> specularMaps = loadMaterialTextures(material,
+                                                            aiTextureType_SPECULAR, "texture_specular");
+        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    }
 
+    Mesh result(vertices, indices, textures, mesh->mName.C_Str());
+    result.base_color = base_color;
+    return result;
+}
+
+void Scene::readMesh(const aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices) {
     // Process vertices
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
         Vertex vertex;
@@ -92,19 +574,6 @@ Mesh Scene::processMesh(aiMesh *mesh, const aiScene *scene, bool with_texture) {
         for(unsigned int j = 0; j < face.mNumIndices; j++)
             indices.push_back(face.mIndices[j]);
     }
-    // Process material
-    if(mesh->mMaterialIndex >= 0 && with_texture) {
-        aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-
-        vector<Texture> diffuseMaps = loadMaterialTextures(material,
-                                                           aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        vector<Texture> specularMaps = loadMaterialTextures(material,
-                                                            aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-    }
-
-    return Mesh(vertices, indices, textures);
 }
 
 vector<Texture> Scene::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const string &typeName) {
@@ -124,7 +593,9 @@ vector<Texture> Scene::loadMaterialTextures(aiMaterial *mat, aiTextureType type,
         }
         if(!skip) { // Texture hasn't been loaded already, load it
             Texture texture;
-            texture.id = generateTextureFromFile(str.C_Str(), directory);
+            auto pending = pending_textures.find({directory + '/' + str.C_Str(), typeName});
+            texture.id = generateTextureFromFile(str.C_Str(), directory, typeName,
+                                                 pending == pending_textures.end() ? nullptr : &pending->second);
             texture.type = typeName;
             texture.path = str.C_Str();
             textures.push_back(texture);
@@ -134,39 +605,42 @@ vector<Texture> Scene::loadMaterialTextures(aiMaterial *mat, aiTextureType type,
     return textures;
 }
 
-unsigned int Scene::generateTextureFromFile(const char *path, const string &directory) {
+unsigned int Scene::generateTextureFromFile(const char *path, const string &directory, const string &type,
+                                            const PendingTexture *pending) {
+    PROFILE_SCOPE("Scene::generateTextureFromFile");
     string filename = string(path);
     filename = directory + '/' + filename;
 
+    if (texture_streamer)
+        return texture_streamer->load(filename, type);
+
     // Generate texture object
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, n_channels;
-    unsigned char *texture_data = stbi_load(filename.c_str(), &width, &height, &n_channels, 0);
-    if (texture_data) {
-        GLenum format;
-        if (n_channels == 1)
-            format = GL_RED;
-        else if (n_channels == 3)
-            format = GL_RGB;
-        else if (n_channels == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, texture_data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+    // Every mip level comes precomputed, from the cache or cooked in a job or right here
+    CookedTexture cooked;
+    const CookedTexture *source = pending ? &pending->cooked : &cooked;
+    bool success = pending ? pending->success : TextureCooker::cook(filename, type, cooked);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    bool uploaded = success && TextureCooker::upload(*source);
+    if (!uploaded && TextureCooker::cookUncompressed(filename, type, cooked)) {
+        cout << "Compressed texture failed to load, uploading uncompressed: " << path << endl;
+        source = &cooked;
+        uploaded = TextureCooker::upload(cooked);
+    }
+    if (uploaded) {
+        MemoryUsage usage;
+        usage.gpu_bytes = source->byteSize();
+        MemoryTracker::instance().track(MEMORY_TEXTURE, textureID, filename, usage);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(texture_data);
     }
     else {
         std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(texture_data);
     }
 
     return textureID;
@@ -5,74 +5,232 @@
 #include "shader.h"
 
 #include <iostream>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
 #include <fstream>
+#include <vector>
 
 #include <glad/glad.h>
 
+#include "file_util.h"
+#include "gl_util.h"
+
 using std::cout;
 using std::cerr;
 using std::endl;
 using std::ifstream;
 
-unsigned int Shader::generateVertexShader(const std::string &vertex_shader_source) {
+std::string Shader::binary_cache_directory;
+
+// Part of GL_KHR_parallel_shader_compile, which the bundled loader does not generate
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+static bool checkShaderCompilation(unsigned int shader, const char *stage) {
     int success;
     char info_log[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader, 512, nullptr, info_log);
+        cout << "ERROR::SHADER::" << stage << "::COMPILATION_FAILED\n" << info_log << endl;
+    }
+    return success;
+}
+
+unsigned int Shader::generateVertexShader(const std::string &vertex_shader_source) {
     unsigned int vertex_shader = glCreateShader(GL_VERTEX_SHADER);
     const char * vertex_shader_source_char = vertex_shader_source.c_str();
 
     glShaderSource(vertex_shader, 1, &vertex_shader_source_char, nullptr);
     glCompileShader(vertex_shader);
-
-    // Compilation check
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(vertex_shader, 512, nullptr, info_log);
-        cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << info_log << endl;
-    }
     return vertex_shader;
 }
 
 unsigned int Shader::generateFragmentShader(const std::string &fragment_shader_source) {
-    int success;
-    char info_log[512];
     unsigned int fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
     const char * fragment_shader_source_char = fragment_shader_source.c_str();
 
     glShaderSource(fragment_shader, 1, &fragment_shader_source_char, nullptr);
     glCompileShader(fragment_shader);
-
-    // Compilation check
-    glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragment_shader, 512, nullptr, info_log);
-        cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << info_log << endl;
-    }
     return fragment_shader;
 }
 
 unsigned int Shader::linkShaders(unsigned int vertex_shader, unsigned int fragment_shader) {
-    int success;
-    char info_log[512];
     unsigned int shader_program = glCreateProgram();
 
     glAttachShader(shader_program, vertex_shader);
     glAttachShader(shader_program, fragment_shader);
-    glLinkProgram(shader_program); // Link
+    if (!binary_cache_directory.empty() && hasProgramBinaries())
+        glProgramParameteri(shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(shader_program); // Link, the driver waits for the stages itself
+    return shader_program;
+}
+
+void Shader::startBuild(const std::string &vertex_source, const std::string &fragment_source) {
+    if (pending_program) { // A newer build supersedes one still in flight
+        glDeleteShader(pending_vertex_shader);
+        glDeleteShader(pending_fragment_shader);
+        glDeleteProgram(pending_program);
+        pending_vertex_shader = pending_fragment_shader = pending_program = 0;
+    }
+
+    // Warm start from the binary cache
+    pending_cache_key.clear();
+    if (!binary_cache_directory.empty() && hasProgramBinaries()) {
+        pending_cache_key = binaryCacheKey(vertex_source, fragment_source);
+        unsigned int cached_program = loadProgramBinary(pending_cache_key);
+        if (cached_program) {
+            adoptProgram(cached_program, READY);
+            return;
+        }
+    }
+
+    pending_vertex_shader = generateVertexShader(vertex_source);
+    pending_fragment_shader = generateFragmentShader(fragment_source);
+    pending_program = linkShaders(pending_vertex_shader, pending_fragment_shader);
+    if (!ID)
+        build_status = PENDING;
+}
+
+void Shader::finishBuild() {
+    // Compilation check
+    checkShaderCompilation(pending_vertex_shader, "VERTEX");
+    checkShaderCompilation(pending_fragment_shader, "FRAGMENT");
 
     // Linking check
-    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    int success;
+    char info_log[512];
+    glGetProgramiv(pending_program, GL_LINK_STATUS, &success);
     if (!success) {
-        glGetProgramInfoLog(shader_program, 512, NULL, info_log);
+        glGetProgramInfoLog(pending_program, 512, NULL, info_log);
         cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << info_log << endl;
     }
 
     // Delete individual shaders
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-    return shader_program;
+    glDeleteShader(pending_vertex_shader);
+    glDeleteShader(pending_fragment_shader);
+    pending_vertex_shader = pending_fragment_shader = 0;
+
+    if (success) {
+        adoptProgram(pending_program, READY);
+        if (!pending_cache_key.empty())
+            saveProgramBinary(pending_cache_key, ID);
+    } else if (!ID) {
+        adoptProgram(pending_program, FAILED);
+    } else {
+        // A failed rebuild keeps the previous program
+        cout << "Shader rebuild failed, keeping the previous program" << endl;
+        glDeleteProgram(pending_program);
+    }
+    pending_program = 0;
+}
+
+void Shader::adoptProgram(unsigned int program, Status status) {
+    if (ID && ID != program)
+        glDeleteProgram(ID);
+    ID = program;
+    build_status = status;
+
+    // Reflect once per link so setters and layout checks never query the driver again
+    program_reflection.reflect(ID);
+    uniform_locations.clear();
+    reported_names.clear();
+    for (auto &uniform: program_reflection.uniforms) {
+        if (uniform.location < 0)
+            continue;
+        uniform_locations[uniform.name] = uniform.location;
+        size_t array_suffix = uniform.name.rfind("[0]");
+        if (array_suffix != std::string::npos && array_suffix + 3 == uniform.name.size())
+            uniform_locations[uniform.name.substr(0, array_suffix)] = uniform.location;
+    }
+}
+
+void Shader::reportOnce(const char *kind, const std::string &name) const {
+    if (reported_names.insert(name).second)
+        cout << "WARNING::SHADER::" << kind << "::NOT_ACTIVE " << name << " (" << vertex_path << ", "
+             << fragment_path << ")" << endl;
+}
+
+int Shader::uniformLocation(const std::string &name) const {
+    auto location = uniform_locations.find(name);
+    if (location != uniform_locations.end())
+        return location->second;
+    reportOnce("UNIFORM", name);
+    return -1;
+}
+
+int Shader::findUniform(const std::string &name) const {
+    auto location = uniform_locations.find(name);
+    return location == uniform_locations.end() ? -1 : location->second;
 }
 
-Shader::Shader(const std::string &vertex_path, const std::string &fragment_path) {
+bool Shader::checkVertexLayout(const std::vector<VertexAttribute> &layout) const {
+    return program_reflection.checkVertexLayout(layout, cout);
+}
+
+bool Shader::bindUniformBlock(const std::string &name, unsigned int binding) {
+    unsigned int index = glGetProgramResourceIndex(ID, GL_UNIFORM_BLOCK, name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        reportOnce("UNIFORM_BLOCK", name);
+        return false;
+    }
+    glUniformBlockBinding(ID, index, binding);
+    return true;
+}
+
+bool Shader::bindStorageBlock(const std::string &name, unsigned int binding) {
+    unsigned int index = glGetProgramResourceIndex(ID, GL_SHADER_STORAGE_BLOCK, name.c_str());
+    if (index == GL_INVALID_INDEX) {
+        reportOnce("STORAGE_BLOCK", name);
+        return false;
+    }
+    glShaderStorageBlockBinding(ID, index, binding);
+    return true;
+}
+
+bool Shader::hasParallelCompile() {
+    return hasGLExtension("GL_KHR_parallel_shader_compile") || hasGLExtension("GL_ARB_parallel_shader_compile");
+}
+
+Shader::Shader(const std::string &vertex_path, const std::string &fragment_path, bool asynchronous) :
+        vertex_path(vertex_path), fragment_path(fragment_path) {
+    reload();
+    if (!asynchronous)
+        wait();
+}
+
+Shader::Shader(const std::string &vertex_path, const std::string &fragment_path, unsigned int features,
+               bool asynchronous) :
+        vertex_path(vertex_path), fragment_path(fragment_path), specialized(true), feature_mask(features) {
+    reload();
+    if (!asynchronous)
+        wait();
+}
+
+std::string Shader::injectFeatureDefines(const std::string &source, unsigned int features) {
+    std::string defines = "#define SHADER_PERMUTATION\n";
+    if (features & SHADER_FEATURE_TEXTURE)
+        defines += "#define HAS_TEXTURE\n";
+    if (features & SHADER_FEATURE_DRAW_DATA)
+        defines += "#define USE_DRAW_DATA\n";
+    if (features & SHADER_FEATURE_SHADOWS)
+        defines += "#define USE_SHADOWS\n";
+    if (features & SHADER_FEATURE_MULTIVIEW)
+        defines += "#define USE_MULTIVIEW\n";
+
+    // #version has to stay the first directive
+    size_t version = source.find("#version");
+    if (version == std::string::npos)
+        return defines + source;
+    size_t line_end = source.find('\n', version);
+    if (line_end == std::string::npos)
+        return source + '\n' + defines;
+    return source.substr(0, line_end + 1) + defines + source.substr(line_end + 1);
+}
+
+void Shader::reload() {
     // Generate & Compile vertex shader + fragment shader
     ifstream vertex_shader_stream(vertex_path);
     if (!vertex_shader_stream.is_open()) {
@@ -80,9 +238,7 @@ Shader::Shader(const std::string &vertex_path, const std::string &fragment_path)
     }
     std::string vertex_shader_string((std::istreambuf_iterator<char>(vertex_shader_stream)),
                                       std::istreambuf_iterator<char>());
-    const char *vertex_shader_source = vertex_shader_string.c_str();
     vertex_shader_stream.close();
-    unsigned int vertex_shader = generateVertexShader(vertex_shader_source);
 
     ifstream fragment_shader_stream(fragment_path);
     if (!fragment_shader_stream.is_open()) {
@@ -90,12 +246,131 @@ Shader::Shader(const std::string &vertex_path, const std::string &fragment_path)
     }
     std::string fragment_shader_string((std::istreambuf_iterator<char>(fragment_shader_stream)),
                                   std::istreambuf_iterator<char>());
-    const char *fragment_shader_source = fragment_shader_string.c_str();
-    vertex_shader_stream.close();
-    unsigned int fragment_shader = generateFragmentShader(fragment_shader_source);
+    fragment_shader_stream.close();
+
+    if (specialized) {
+        vertex_shader_string = injectFeatureDefines(vertex_shader_string, feature_mask);
+        fragment_shader_string = injectFeatureDefines(fragment_shader_string, feature_mask);
+    }
+    startBuild(vertex_shader_string, fragment_shader_string);
+}
+
+Shader::Status Shader::poll() {
+    if (!pending_program)
+        return build_status;
+    // Without the extension any status query blocks, so the first poll simply finishes the build
+    if (hasParallelCompile()) {
+        int completed = 0;
+        glGetProgramiv(pending_program, GL_COMPLETION_STATUS_KHR, &completed);
+        if (!completed)
+            return build_status;
+    }
+    finishBuild();
+    return build_status;
+}
+
+Shader::Status Shader::wait() {
+    if (pending_program)
+        finishBuild();
+    return build_status;
+}
+
+void Shader::setBinaryCacheDirectory(const std::string &directory) {
+    binary_cache_directory = directory;
+    if (directory.empty())
+        return;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        cerr << "Failed to create shader cache directory: " << directory << endl;
+        binary_cache_directory.clear();
+    }
+}
+
+bool Shader::hasProgramBinaries() {
+    static int supported = -1;
+    if (supported < 0) {
+        int n_formats = 0;
+        if (GLAD_GL_VERSION_4_1)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_formats);
+        supported = n_formats > 0 ? 1 : 0;
+        if (!supported)
+            cerr << "Driver offers no program binary formats, shader cache disabled" << endl;
+    }
+    return supported == 1;
+}
 
-    // Link shader programs
-    ID = linkShaders(vertex_shader, fragment_shader);
+std::string Shader::binaryCacheKey(const std::string &vertex_source, const std::string &fragment_source) {
+    // 64-bit FNV-1a over the sources and the driver identity, so a driver update invalidates the cache
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const char *data) {
+        if (!data)
+            data = "";
+        for (; *data; ++data) {
+            hash ^= static_cast<unsigned char>(*data);
+            hash *= 1099511628211ull;
+        }
+        hash ^= 0xFF; // Field separator
+        hash *= 1099511628211ull;
+    };
+    mix(vertex_source.c_str());
+    mix(fragment_source.c_str());
+    mix(reinterpret_cast<const char *>(glGetString(GL_VENDOR)));
+    mix(reinterpret_cast<const char *>(glGetString(GL_RENDERER)));
+    mix(reinterpret_cast<const char *>(glGetString(GL_VERSION)));
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+unsigned int Shader::loadProgramBinary(const std::string &key) const {
+    ifstream binary_stream(binary_cache_directory + '/' + key + ".bin", std::ios::binary | std::ios::ate);
+    if (!binary_stream.is_open())
+        return 0;
+    auto file_size = static_cast<uint64_t>(binary_stream.tellg());
+    binary_stream.seekg(0);
+
+    uint32_t binary_format = 0, length = 0;
+    binary_stream.read(reinterpret_cast<char *>(&binary_format), sizeof(binary_format));
+    binary_stream.read(reinterpret_cast<char *>(&length), sizeof(length));
+    // A truncated or corrupt file must not size the allocation
+    if (!binary_stream || length == 0 || length > file_size - 2 * sizeof(uint32_t))
+        return 0;
+    std::vector<char> binary(length);
+    binary_stream.read(binary.data(), length);
+    if (!binary_stream)
+        return 0;
+
+    // Drivers may reject binaries they produced earlier, in which case we silently recompile
+    unsigned int program = glCreateProgram();
+    glProgramBinary(program, binary_format, binary.data(), static_cast<GLsizei>(length));
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+void Shader::saveProgramBinary(const std::string &key, unsigned int program) const {
+    int success, length = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (!success || length <= 0)
+        return;
+
+    std::vector<char> binary(length);
+    GLenum binary_format = 0;
+    glGetProgramBinary(program, length, nullptr, &binary_format, binary.data());
+
+    writeFileAtomically(binary_cache_directory + '/' + key + ".bin", [&](std::ostream &binary_stream) {
+        uint32_t header[2] = {static_cast<uint32_t>(binary_format), static_cast<uint32_t>(length)};
+        binary_stream.write(reinterpret_cast<const char *>(header), sizeof(header));
+        binary_stream.write(binary.data(), length);
+        return static_cast<bool>(binary_stream);
+    });
 }
 
 void Shader::use() {
@@ -104,24 +379,121 @@ void Shader::use() {
 
 void Shader::release() {
     glDeleteProgram(ID);
+    if (pending_program) {
+        glDeleteShader(pending_vertex_shader);
+        glDeleteShader(pending_fragment_shader);
+        glDeleteProgram(pending_program);
+        pending_vertex_shader = pending_fragment_shader = pending_program = 0;
+    }
 }
 
 void Shader::setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(uniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(uniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(uniformLocation(name), value);
 }
 
 void Shader::set4f(const std::string &name, float value[]) const {
-    glUniform4f(glGetUniformLocation(ID, name.c_str()), value[0], value[1], value[2], value[3]);
+    glUniform4f(uniformLocation(name), value[0], value[1], value[2], value[3]);
 }
 
 void Shader::setMat4(const std::string &name, const Eigen::Matrix4f &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, mat.data());
-}
\ No newline at end of file
+    glUniformMatrix4fv(uniformLocation(name), 1, GL_FALSE, mat.data());
+}
+
+ShaderVariants::ShaderVariants(const std::string &vertex_path, const std::string &fragment_path) :
+        vertex_path(vertex_path), fragment_path(fragment_path) {}
+
+void ShaderVariants::prepare(unsigned int features) {
+    if (shaders.find(features) == shaders.end())
+        shaders[features] = std::make_shared<Shader>(vertex_path, fragment_path, features, true);
+}
+
+void ShaderVariants::wait() {
+    for (auto &variant: shaders)
+        variant.second->wait();
+}
+
+Shader *ShaderVariants::get(unsigned int features) {
+    auto variant = shaders.find(features);
+    if (variant == shaders.end())
+        variant = shaders.emplace(features, std::make_shared<Shader>(vertex_path, fragment_path, features, false)).first;
+    else if (variant->second->status() == Shader::PENDING)
+        variant->second->wait();
+    return variant->second.get();
+}
+
+void ShaderVariants::setMat4(const std::string &name, const Eigen::Matrix4f &mat, unsigned int features) const {
+    for (auto &variant: shaders) {
+        if ((variant.first & features) != features)
+            continue;
+        glProgramUniformMatrix4fv(variant.second->ID, variant.second->uniformLocation(name), 1, GL_FALSE,
+                                  mat.data());
+    }
+}
+
+void ShaderVariants::setMat4Array(const std::string &name, const Eigen::Matrix4f *mats, int count,
+                                  unsigned int features) const {
+    // Eigen matrices hold nothing but their 16 floats, an array of them is contiguous
+    for (auto &variant: shaders) {
+        if ((variant.first & features) != features)
+            continue;
+        glProgramUniformMatrix4fv(variant.second->ID, variant.second->uniformLocation(name), count, GL_FALSE,
+                                  mats[0].data());
+    }
+}
+
+void ShaderVariants::setInt(const std::string &name, int value, unsigned int features) const {
+    for (auto &variant: shaders) {
+        if ((variant.first & features) == features)
+            glProgramUniform1i(variant.second->ID, variant.second->uniformLocation(name), value);
+    }
+}
+
+void ShaderVariants::set4f(const std::string &name, const float value[], unsigned int features) const {
+    for (auto &variant: shaders) {
+        if ((variant.first & features) == features)
+            glProgramUniform4f(variant.second->ID, variant.second->uniformLocation(name), value[0], value[1],
+                               value[2], value[3]);
+    }
+}
+
+void ShaderVariants::release() {
+    for (auto &variant: shaders)
+        variant.second->release();
+    shaders.clear();
+}
+
+void ShaderCompileQueue::add(const std::shared_ptr<Shader> &shader, std::function<void(Shader &)> on_ready) {
+    pending.emplace_back(shader, std::move(on_ready));
+}
+
+size_t ShaderCompileQueue::poll() {
+    for (size_t i = 0; i < pending.size();) {
+        if (pending[i].first->poll() == Shader::PENDING) {
+            ++i;
+            continue;
+        }
+        auto finished = std::move(pending[i]);
+        pending.erase(pending.begin() + i);
+        if (finished.second)
+            finished.second(*finished.first);
+    }
+    return pending.size();
+}
+
+void ShaderCompileQueue::waitAll() {
+    while (!pending.empty()) {
+        auto finished = std::move(pending.front());
+        pending.erase(pending.begin());
+        finished.first->wait();
+        if (finished.second)
+            finished.second(*finished.first);
+    }
+}
@@ -0,0 +1,191 @@
+//
+// Created by Andrew on 5/15/2021.
+//
+
+#include "shader_reflection.h"
+
+#include <glad/glad.h>
+
+using std::endl;
+
+static string resourceName(unsigned int program, GLenum interface, unsigned int index, int length) {
+    vector<char> name(static_cast<size_t>(length > 0 ? length : 1));
+    glGetProgramResourceName(program, interface, index, static_cast<GLsizei>(name.size()), nullptr, name.data());
+    return string(name.data());
+}
+
+static vector<ShaderBlock> reflectBlocks(unsigned int program, GLenum block_interface, GLenum member_interface) {
+    vector<ShaderBlock> blocks;
+    int n_blocks = 0;
+    glGetProgramInterfaceiv(program, block_interface, GL_ACTIVE_RESOURCES, &n_blocks);
+    for (int i = 0; i < n_blocks; ++i) {
+        const GLenum properties[] = {GL_NAME_LENGTH, GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE, GL_NUM_ACTIVE_VARIABLES};
+        int values[4];
+        glGetProgramResourceiv(program, block_interface, i, 4, properties, 4, nullptr, values);
+
+        ShaderBlock block{resourceName(program, block_interface, i, values[0]), values[1], values[2], {}};
+        vector<int> member_indices(static_cast<size_t>(values[3]));
+        const GLenum active_variables = GL_ACTIVE_VARIABLES;
+        if (!member_indices.empty())
+            glGetProgramResourceiv(program, block_interface, i, 1, &active_variables,
+                                   static_cast<GLsizei>(member_indices.size()), nullptr, member_indices.data());
+        for (int member_index: member_indices) {
+            const GLenum member_properties[] = {GL_NAME_LENGTH, GL_TYPE, GL_ARRAY_SIZE, GL_OFFSET};
+            int member_values[4];
+            glGetProgramResourceiv(program, member_interface, member_index, 4, member_properties, 4, nullptr,
+                                   member_values);
+            block.members.push_back(ShaderVariable{
+                    resourceName(program, member_interface, member_index, member_values[0]),
+                    static_cast<unsigned int>(member_values[1]), -1, member_values[2], member_values[3], i});
+        }
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+void ShaderReflection::reflect(unsigned int program) {
+    clear();
+
+    // Vertex inputs
+    int n_inputs = 0;
+    glGetProgramInterfaceiv(program, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &n_inputs);
+    for (int i = 0; i < n_inputs; ++i) {
+        const GLenum properties[] = {GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE};
+        int values[4];
+        glGetProgramResourceiv(program, GL_PROGRAM_INPUT, i, 4, properties, 4, nullptr, values);
+        string name = resourceName(program, GL_PROGRAM_INPUT, i, values[0]);
+        if (name.compare(0, 3, "gl_") == 0)
+            continue; // Built-ins have no location
+        attributes.push_back(ShaderVariable{name, static_cast<unsigned int>(values[1]), values[2], values[3], -1, -1});
+    }
+
+    // Default block uniforms and block members
+    int n_uniforms = 0;
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &n_uniforms);
+    for (int i = 0; i < n_uniforms; ++i) {
+        const GLenum properties[] = {GL_NAME_LENGTH, GL_TYPE, GL_LOCATION, GL_ARRAY_SIZE, GL_OFFSET, GL_BLOCK_INDEX};
+        int values[6];
+        glGetProgramResourceiv(program, GL_UNIFORM, i, 6, properties, 6, nullptr, values);
+        uniforms.push_back(ShaderVariable{resourceName(program, GL_UNIFORM, i, values[0]),
+                                          static_cast<unsigned int>(values[1]), values[2], values[3], values[4],
+                                          values[5]});
+    }
+
+    uniform_blocks = reflectBlocks(program, GL_UNIFORM_BLOCK, GL_UNIFORM);
+    storage_blocks = reflectBlocks(program, GL_SHADER_STORAGE_BLOCK, GL_BUFFER_VARIABLE);
+}
+
+void ShaderReflection::clear() {
+    attributes.clear();
+    uniforms.clear();
+    uniform_blocks.clear();
+    storage_blocks.clear();
+}
+
+template<class T>
+static const T *findByName(const vector<T> &items, const string &name) {
+    for (auto &item: items) {
+        if (item.name == name)
+            return &item;
+    }
+    return nullptr;
+}
+
+const ShaderVariable *ShaderReflection::findAttribute(const string &name) const {
+    return findByName(attributes, name);
+}
+
+const ShaderVariable *ShaderReflection::findUniform(const string &name) const {
+    const ShaderVariable *uniform = findByName(uniforms, name);
+    // Arrays are reported as name[0]
+    return uniform ? uniform : findByName(uniforms, name + "[0]");
+}
+
+const ShaderBlock *ShaderReflection::findUniformBlock(const string &name) const {
+    return findByName(uniform_blocks, name);
+}
+
+const ShaderBlock *ShaderReflection::findStorageBlock(const string &name) const {
+    return findByName(storage_blocks, name);
+}
+
+bool ShaderReflection::checkVertexLayout(const vector<VertexAttribute> &layout, std::ostream &out) const {
+    bool valid = true;
+    for (auto &attribute: attributes) {
+        const VertexAttribute *provided = nullptr;
+        for (auto &vertex_attribute: layout) {
+            if (vertex_attribute.location == attribute.location)
+                provided = &vertex_attribute;
+        }
+        if (!provided) {
+            out << "ERROR::SHADER::ATTRIBUTE::NOT_PROVIDED " << attribute.name << " at location "
+                << attribute.location << endl;
+            valid = false;
+            continue;
+        }
+        // Fewer supplied components than declared are legal, GL fills in (0, 0, 0, 1)
+        int components = floatComponents(attribute.type);
+        if (components == 0 || provided->components > components) {
+            out << "ERROR::SHADER::ATTRIBUTE::TYPE_MISMATCH " << attribute.name << " is " << typeName(attribute.type)
+                << " but the vertex layout supplies " << provided->components << " floats ("
+                << provided->name << ")" << endl;
+            valid = false;
+        }
+    }
+    return valid;
+}
+
+void ShaderReflection::print(std::ostream &out) const {
+    out << "Attributes:\n";
+    for (auto &attribute: attributes)
+        out << "  " << attribute.location << ' ' << typeName(attribute.type) << ' ' << attribute.name << '\n';
+    out << "Uniforms:\n";
+    for (auto &uniform: uniforms) {
+        if (uniform.block_index < 0)
+            out << "  " << uniform.location << ' ' << typeName(uniform.type) << ' ' << uniform.name << '\n';
+    }
+    auto printBlocks = [&out](const char *title, const vector<ShaderBlock> &blocks) {
+        out << title << ":\n";
+        for (auto &block: blocks) {
+            out << "  " << block.name << " binding " << block.binding << ", " << block.data_size << " bytes\n";
+            for (auto &member: block.members)
+                out << "    +" << member.offset << ' ' << typeName(member.type) << ' ' << member.name << '\n';
+        }
+    };
+    printBlocks("Uniform blocks", uniform_blocks);
+    printBlocks("Storage blocks", storage_blocks);
+}
+
+const char *ShaderReflection::typeName(unsigned int type) {
+    switch (type) {
+        case GL_FLOAT: return "float";
+        case GL_FLOAT_VEC2: return "vec2";
+        case GL_FLOAT_VEC3: return "vec3";
+        case GL_FLOAT_VEC4: return "vec4";
+        case GL_INT: return "int";
+        case GL_INT_VEC2: return "ivec2";
+        case GL_INT_VEC3: return "ivec3";
+        case GL_INT_VEC4: return "ivec4";
+        case GL_UNSIGNED_INT: return "uint";
+        case GL_BOOL: return "bool";
+        case GL_FLOAT_MAT3: return "mat3";
+        case GL_FLOAT_MAT4: return "mat4";
+        case GL_SAMPLER_2D: return "sampler2D";
+        case GL_SAMPLER_2D_ARRAY: return "sampler2DArray";
+        case GL_SAMPLER_2D_SHADOW: return "sampler2DShadow";
+        case GL_SAMPLER_2D_ARRAY_SHADOW: return "sampler2DArrayShadow";
+        case GL_SAMPLER_CUBE: return "samplerCube";
+        default: return "other";
+    }
+}
+
+int ShaderReflection::floatComponents(unsigned int type) {
+    switch (type) {
+        case GL_FLOAT: return 1;
+        case GL_FLOAT_VEC2: return 2;
+        case GL_FLOAT_VEC3: return 3;
+        case GL_FLOAT_VEC4: return 4;
+        case GL_FLOAT_MAT4: return 4; // One column per location
+        default: return 0;
+    }
+}
@@ -0,0 +1,69 @@
+//
+// Created by Andrew on 5/12/2021.
+//
+
+#include "shader_reloader.h"
+
+#include <algorithm>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+// Editors often save in several writes, a rebuild waits until the files were quiet this long
+const std::chrono::milliseconds SETTLE_TIME(200);
+
+}
+
+void ShaderHotReloader::add(const std::shared_ptr<Shader> &shader) {
+    watcher.watch(shader->vertexPath());
+    watcher.watch(shader->fragmentPath());
+    shaders.push_back(shader);
+}
+
+void ShaderHotReloader::add(ShaderVariants *variants) {
+    watcher.watch(variants->vertexPath());
+    watcher.watch(variants->fragmentPath());
+    variant_sets.push_back(variants);
+}
+
+void ShaderHotReloader::markStale(const std::shared_ptr<Shader> &shader) {
+    if (!changed_files.count(shader->vertexPath()) && !changed_files.count(shader->fragmentPath()))
+        return;
+    if (std::find(stale.begin(), stale.end(), shader) == stale.end())
+        stale.push_back(shader);
+}
+
+void ShaderHotReloader::update() {
+    auto now = std::chrono::steady_clock::now();
+    vector<string> files = watcher.poll();
+    if (!files.empty()) {
+        changed_files.insert(files.begin(), files.end());
+        last_change = now;
+    }
+    if (!changed_files.empty() && now - last_change >= SETTLE_TIME) {
+        for (auto &shader: shaders)
+            markStale(shader);
+        for (auto variants: variant_sets) {
+            for (auto &variant: variants->variants())
+                markStale(variant.second);
+        }
+        changed_files.clear();
+    }
+
+    size_t n_start = Shader::hasParallelCompile() ? stale.size() : std::min<size_t>(stale.size(), 1);
+    for (size_t i = 0; i < n_start; ++i) {
+        cout << "Reloading shader: " << stale[i]->vertexPath() << ", " << stale[i]->fragmentPath() << endl;
+        stale[i]->reload();
+    }
+    stale.erase(stale.begin(), stale.begin() + n_start);
+
+    for (auto &shader: shaders)
+        shader->poll();
+    for (auto variants: variant_sets) {
+        for (auto &variant: variants->variants())
+            variant.second->poll();
+    }
+}
@@ -0,0 +1,190 @@
+//
+// Created by Andrew on 5/29/2021.
+//
+
+#include "shadow_cascades.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <glad/glad.h>
+
+#include "geometry.h"
+#include "memory_tracker.h"
+#include "profiler.h"
+
+using std::cout;
+using std::endl;
+
+ShadowCascades::ShadowCascades(const string &vertex_path, const string &fragment_path, unsigned int n_cascades,
+                               unsigned int resolution, float max_distance, float split_lambda) :
+        n_cascades(std::min(std::max(n_cascades, 1u), MAX_CASCADES)), resolution(resolution),
+        max_distance(max_distance), split_lambda(split_lambda),
+        light_direction(Eigen::Vector3f(-0.4f, -1.0f, -0.3f).normalized()),
+        depth_shader(new Shader(vertex_path, fragment_path)) {
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, static_cast<int>(resolution),
+                   static_cast<int>(resolution), static_cast<int>(this->n_cascades));
+    // Linear filtering with comparison gives 2x2 PCF for free. Outside the map is lit
+    const float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        cout << "ERROR::SHADOW_CASCADES::FRAMEBUFFER_INCOMPLETE" << endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    MemoryUsage usage;
+    usage.gpu_bytes = static_cast<size_t>(resolution) * resolution * 4 * this->n_cascades;
+    MemoryTracker::instance().track(MEMORY_TEXTURE, texture, "shadow cascades", usage);
+}
+
+ShadowCascades::~ShadowCascades() {
+    MemoryTracker::instance().untrack(MEMORY_TEXTURE, texture);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &texture);
+    depth_shader->release();
+}
+
+void ShadowCascades::setLightDirection(const Eigen::Vector3f &direction) {
+    light_direction = direction.normalized();
+}
+
+void ShadowCascades::fit(const FrameView &view, const Eigen::Vector3f &scene_center, float scene_radius) {
+    // Practical split scheme: logarithmic distances keep texel density even, uniform ones avoid tiny near slices
+    float z_near = view.zNear(), z_far = std::min(view.zFar(), max_distance);
+    float splits[MAX_CASCADES + 1];
+    for (unsigned int i = 0; i <= n_cascades; ++i) {
+        float t = static_cast<float>(i) / static_cast<float>(n_cascades);
+        float logarithmic = z_near * std::pow(z_far / z_near, t);
+        float uniform = z_near + (z_far - z_near) * t;
+        splits[i] = split_lambda * logarithmic + (1.0f - split_lambda) * uniform;
+    }
+
+    // The light rotation only depends on its direction, lookAt from the origin
+    Eigen::Vector3f up_hint = std::fabs(light_direction[1]) > 0.99f ? Eigen::Vector3f::UnitZ()
+                                                                     : Eigen::Vector3f::UnitY();
+    Eigen::Matrix3f light_rotation = lookAt(Eigen::Vector3f::Zero(), light_direction, up_hint).topLeftCorner<3, 3>();
+    Eigen::Vector3f light_scene_center = light_rotation * scene_center;
+
+    const std::array<Eigen::Vector3f, 8> &corners = view.frustumCorners();
+    for (unsigned int i = 0; i < n_cascades; ++i) {
+        Cascade &cascade = cascades[i];
+        cascade.split_begin = splits[i];
+        cascade.split_end = splits[i + 1];
+
+        // Slice corners along the rays through the near plane corners, depth grows linearly along them
+        Eigen::Vector3f slice[8];
+        Eigen::Vector3f center = Eigen::Vector3f::Zero();
+        for (int k = 0; k < 4; ++k) {
+            Eigen::Vector3f ray = (corners[k] - view.position()) / z_near;
+            slice[k] = view.position() + ray * cascade.split_begin;
+            slice[k + 4] = view.position() + ray * cascade.split_end;
+            center += slice[k] + slice[k + 4];
+        }
+        center /= 8.0f;
+        // A sphere does not change size when the camera turns, rounding keeps it from flickering in the last bits
+        float radius = 0.0f;
+        for (auto &corner: slice)
+            radius = std::max(radius, (corner - center).norm());
+        radius = std::ceil(radius * 16.0f) / 16.0f;
+
+        // Move the center in whole texels only, the map then shifts by whole texels and edges do not swim
+        float texel = 2.0f * radius / static_cast<float>(resolution);
+        Eigen::Vector3f light_center = light_rotation * center;
+        light_center = (light_center / texel).array().floor() * texel;
+        // Casters between the light and the slice have to be in the map, +z points at the light
+        float toward_light = std::max(radius, light_scene_center[2] + scene_radius - light_center[2]);
+        toward_light = std::ceil(toward_light / radius) * radius;
+
+        Eigen::Matrix4f light_view = Eigen::Matrix4f::Identity();
+        light_view.topLeftCorner<3, 3>() = light_rotation;
+        light_view.topRightCorner<3, 1>() = -light_center;
+        cascade.view_projection = orthographic(-radius, radius, -radius, radius, -toward_light, radius) * light_view;
+    }
+}
+
+void ShadowCascades::render(const FrameView &view, Scene *scene, const Eigen::Matrix4f &model) {
+    PROFILE_SCOPE("ShadowCascades::render");
+    PROFILE_GPU_SCOPE("ShadowCascades::render");
+    Eigen::Vector3f scene_center = Eigen::Vector3f::Zero();
+    float scene_radius = 0.0f;
+    scene->boundingSphere(model, scene_center, scene_radius);
+    fit(view, scene_center, scene_radius);
+
+    int viewport[4];
+    bool bound = false;
+    n_rendered = 0;
+    for (unsigned int i = 0; i < n_cascades; ++i) {
+        Cascade &cascade = cascades[i];
+        bool has_dynamic = false;
+        scene->cull(model, frustumPlanes(cascade.view_projection), cascade.casters, &has_dynamic);
+        // Static contents under the same matrix are already in the layer. Dynamic meshes outside the cascade
+        // don't matter, cull() leaves them out
+        if (cascade.valid && !has_dynamic && !cascade.rendered_dynamic &&
+            cascade.view_projection == cascade.rendered_view_projection && model == cascade.rendered_model &&
+            scene->geometryVersion() == cascade.rendered_geometry_version)
+            continue;
+
+        if (!bound) {
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glViewport(0, 0, static_cast<int>(resolution), static_cast<int>(resolution));
+            // Slope scaled bias against shadow acne
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(2.0f, 4.0f);
+            depth_shader->use();
+            depth_shader->setMat4("model", model);
+            bound = true;
+        }
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, static_cast<int>(i));
+        glClear(GL_DEPTH_BUFFER_BIT);
+        depth_shader->setMat4("light_view_projection", cascade.view_projection);
+        scene->draw_depth(cascade.casters);
+
+        cascade.valid = true;
+        cascade.rendered_view_projection = cascade.view_projection;
+        cascade.rendered_model = model;
+        cascade.rendered_geometry_version = scene->geometryVersion();
+        cascade.rendered_dynamic = has_dynamic;
+        ++n_rendered;
+    }
+    if (bound) {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+}
+
+void ShadowCascades::apply(const ShaderVariants &variants) const {
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Unused cascades repeat the last one, shaders never pick them since its end comes first
+    std::array<Eigen::Matrix4f, MAX_CASCADES> matrices;
+    float ends[MAX_CASCADES];
+    for (unsigned int i = 0; i < MAX_CASCADES; ++i) {
+        const Cascade &cascade = cascades[std::min(i, n_cascades - 1)];
+        matrices[i] = cascade.view_projection;
+        ends[i] = cascade.split_end;
+    }
+    // Only the permutations that sample the map declare these
+    variants.setInt("shadow_map", static_cast<int>(TEXTURE_UNIT), SHADER_FEATURE_SHADOWS);
+    variants.setMat4Array("shadow_matrices", matrices.data(), static_cast<int>(MAX_CASCADES),
+                          SHADER_FEATURE_SHADOWS);
+    variants.set4f("shadow_splits", ends, SHADER_FEATURE_SHADOWS);
+}
@@ -0,0 +1,604 @@
+//
+// Created by Andrew on 5/21/2021.
+//
+
+#include "texture_cooker.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include "batch_geometry.h"
+#include "file_util.h"
+#include "gl_util.h"
+#include "job_system.h"
+#include "profiler.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+TextureCompression TextureCooker::compression_mode = TEXTURE_COMPRESSION_FAST;
+MipFilter TextureCooker::mip_filter = MIP_FILTER_KAISER;
+string TextureCooker::cache_directory;
+
+namespace {
+
+const uint32_t CACHE_MAGIC = 0x58455443; // "CTEX"
+// Bump when the encoders change, so stale cache entries are re-cooked
+const uint32_t COOKER_VERSION = 2;
+
+// 4x4 texels with one array per channel, the layout the batch kernels want
+struct Block {
+    float channels[4][16];
+};
+
+void loadBlock(const unsigned char *texels, Block &block) {
+    for (unsigned int i = 0; i < 16; ++i) {
+        for (unsigned int c = 0; c < 4; ++c)
+            block.channels[c][i] = texels[i * 4 + c];
+    }
+}
+
+// t[i] = dot(texel[i] - origin, direction), over the channels where direction is non-zero
+void project(const Block &block, const float origin[4], const float direction[4], float t[16]) {
+    const float *channels[4] = {block.channels[0], block.channels[1], block.channels[2], block.channels[3]};
+    projectChannels(channels, origin, direction, 16, t);
+}
+
+// Direction of largest variance over the first n_channels, by power iteration on the covariance
+void principalAxis(const Block &block, unsigned int n_channels, float mean[4], float axis[4]) {
+    float min_value[4], max_value[4];
+    for (unsigned int c = 0; c < 4; ++c) {
+        mean[c] = 0.0f;
+        axis[c] = 0.0f;
+        min_value[c] = max_value[c] = block.channels[c][0];
+        for (unsigned int i = 0; i < 16; ++i) {
+            mean[c] += block.channels[c][i];
+            min_value[c] = std::min(min_value[c], block.channels[c][i]);
+            max_value[c] = std::max(max_value[c], block.channels[c][i]);
+        }
+        mean[c] /= 16.0f;
+    }
+    float covariance[4][4] = {};
+    for (unsigned int i = 0; i < 16; ++i) {
+        for (unsigned int a = 0; a < n_channels; ++a) {
+            for (unsigned int b = 0; b < n_channels; ++b)
+                covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+        }
+    }
+    for (unsigned int c = 0; c < n_channels; ++c)
+        axis[c] = max_value[c] - min_value[c];
+    for (unsigned int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = {}, length = 0.0f;
+        for (unsigned int a = 0; a < n_channels; ++a) {
+            for (unsigned int b = 0; b < n_channels; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            length = std::max(length, std::fabs(next[a]));
+        }
+        if (length == 0.0f)
+            break;
+        for (unsigned int c = 0; c < n_channels; ++c)
+            axis[c] = next[c] / length;
+    }
+}
+
+// Endpoints where the texels' projections onto the principal axis end
+void fitEndpoints(const Block &block, unsigned int n_channels, float endpoints[2][4]) {
+    float mean[4], axis[4], t[16];
+    principalAxis(block, n_channels, mean, axis);
+    project(block, mean, axis, t);
+    float t_min = *std::min_element(t, t + 16), t_max = *std::max_element(t, t + 16);
+    for (unsigned int c = 0; c < 4; ++c) {
+        endpoints[0][c] = std::min(std::max(mean[c] + t_min * axis[c], 0.0f), 255.0f);
+        endpoints[1][c] = std::min(std::max(mean[c] + t_max * axis[c], 0.0f), 255.0f);
+    }
+}
+
+// Position of every texel on the segment between two endpoints, 0 at from and 1 at to
+void interpolationFactors(const Block &block, const float from[4], const float to[4], unsigned int n_channels,
+                          float t[16]) {
+    float direction[4] = {}, length = 0.0f;
+    for (unsigned int c = 0; c < n_channels; ++c) {
+        direction[c] = to[c] - from[c];
+        length += direction[c] * direction[c];
+    }
+    if (length == 0.0f) {
+        std::fill(t, t + 16, 0.0f);
+        return;
+    }
+    for (unsigned int c = 0; c < n_channels; ++c)
+        direction[c] /= length;
+    project(block, from, direction, t);
+    for (unsigned int i = 0; i < 16; ++i)
+        t[i] = std::min(std::max(t[i], 0.0f), 1.0f);
+}
+
+uint16_t packRGB565(const float color[3]) {
+    auto quantize = [](float value, float levels) {
+        return static_cast<unsigned int>(std::lround(value * levels / 255.0f));
+    };
+    return static_cast<uint16_t>((quantize(color[0], 31.0f) << 11) | (quantize(color[1], 63.0f) << 5) |
+                                 quantize(color[2], 31.0f));
+}
+
+void unpackRGB565(uint16_t packed, float color[4]) {
+    unsigned int r = packed >> 11, g = (packed >> 5) & 0x3F, b = packed & 0x1F;
+    color[0] = static_cast<float>((r << 3) | (r >> 2));
+    color[1] = static_cast<float>((g << 2) | (g >> 4));
+    color[2] = static_cast<float>((b << 3) | (b >> 2));
+    color[3] = 0.0f;
+}
+
+// BC1 color block, always in four color mode so BC3 can share it
+void encodeColorBlock(const Block &block, unsigned char *out) {
+    float endpoints[2][4];
+    fitEndpoints(block, 3, endpoints);
+    // Inset the endpoints a little, extremes are usually outliers
+    for (unsigned int c = 0; c < 3; ++c) {
+        float inset = (endpoints[1][c] - endpoints[0][c]) / 16.0f;
+        endpoints[0][c] += inset;
+        endpoints[1][c] -= inset;
+    }
+    uint16_t color0 = packRGB565(endpoints[1]), color1 = packRGB565(endpoints[0]);
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    uint32_t indices = 0;
+    if (color0 != color1) {
+        float from[4], to[4], t[16];
+        unpackRGB565(color0, from);
+        unpackRGB565(color1, to);
+        interpolationFactors(block, from, to, 3, t);
+        // Palette order is color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+        static const uint32_t codes[4] = {0, 2, 3, 1};
+        for (unsigned int i = 0; i < 16; ++i)
+            indices |= codes[std::lround(t[i] * 3.0f)] << (2 * i);
+    }
+    out[0] = color0 & 0xFF;
+    out[1] = color0 >> 8;
+    out[2] = color1 & 0xFF;
+    out[3] = color1 >> 8;
+    for (unsigned int i = 0; i < 4; ++i)
+        out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// BC4 block of a single channel, the alpha half of BC3 and each half of BC5
+void encodeChannelBlock(const Block &block, unsigned int channel, unsigned char *out) {
+    const float *values = block.channels[channel];
+    auto high = static_cast<unsigned int>(*std::max_element(values, values + 16));
+    auto low = static_cast<unsigned int>(*std::min_element(values, values + 16));
+    out[0] = static_cast<unsigned char>(high);
+    out[1] = static_cast<unsigned char>(low);
+
+    uint64_t indices = 0;
+    if (high != low) {
+        // Eight value mode: code 0 is high, 1 is low, 2..7 step from high towards low
+        float from[4] = {}, to[4] = {}, t[16];
+        from[channel] = static_cast<float>(low);
+        to[channel] = static_cast<float>(high);
+        interpolationFactors(block, from, to, 4, t);
+        for (unsigned int i = 0; i < 16; ++i) {
+            long step = std::lround(t[i] * 7.0f);
+            uint64_t code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+            indices |= code << (3 * i);
+        }
+    }
+    for (unsigned int i = 0; i < 6; ++i)
+        out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+// Little endian bit stream, as BC7 blocks are laid out
+class BitWriter {
+public:
+    explicit BitWriter(unsigned char *out) : out(out) {
+        std::memset(out, 0, 16);
+    }
+    void write(unsigned int value, unsigned int n_bits) {
+        for (unsigned int i = 0; i < n_bits; ++i, ++position) {
+            if ((value >> i) & 1)
+                out[position >> 3] |= 1 << (position & 7);
+        }
+    }
+private:
+    unsigned char *out;
+    unsigned int position = 0;
+};
+
+}
+
+size_t CookedTexture::byteSize() const {
+    size_t size = 0;
+    for (auto &level: levels)
+        size += level.size();
+    return size;
+}
+
+void TextureCooker::setCompression(TextureCompression compression) {
+    if (compression == TEXTURE_COMPRESSION_FAST) {
+        if (!hasGLExtension("GL_EXT_texture_compression_s3tc")) {
+            cout << "S3TC texture compression unsupported, using BC7" << endl;
+            compression = TEXTURE_COMPRESSION_HIGH_QUALITY;
+        }
+    }
+    compression_mode = compression;
+}
+
+void TextureCooker::setCacheDirectory(const string &directory) {
+    cache_directory = directory;
+    if (directory.empty())
+        return;
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+        cerr << "Failed to create texture cache directory: " << directory << endl;
+        cache_directory.clear();
+    }
+}
+
+BlockFormat TextureCooker::chooseFormat(const string &type, bool has_alpha) {
+    if (compression_mode == TEXTURE_COMPRESSION_NONE)
+        return BLOCK_FORMAT_RGBA8;
+    if (type == "texture_normal")
+        return BLOCK_FORMAT_BC5;
+    if (compression_mode == TEXTURE_COMPRESSION_HIGH_QUALITY)
+        return BLOCK_FORMAT_BC7;
+    return has_alpha ? BLOCK_FORMAT_BC3 : BLOCK_FORMAT_BC1;
+}
+
+unsigned int TextureCooker::internalFormat(BlockFormat format) {
+    switch (format) {
+        case BLOCK_FORMAT_BC1:
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BLOCK_FORMAT_BC3:
+            return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BLOCK_FORMAT_BC5:
+            return GL_COMPRESSED_RG_RGTC2;
+        case BLOCK_FORMAT_BC7:
+            return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        case BLOCK_FORMAT_RGBA8:
+            return GL_RGBA8;
+    }
+    return 0;
+}
+
+size_t TextureCooker::levelSize(unsigned int internal_format, unsigned int width, unsigned int height) {
+    if (internal_format == GL_RGBA8)
+        return static_cast<size_t>(width) * height * 4;
+    size_t block_size = internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ? 8 : 16;
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size;
+}
+
+size_t TextureCooker::levelSize(BlockFormat format, unsigned int width, unsigned int height) {
+    if (format == BLOCK_FORMAT_RGBA8)
+        return static_cast<size_t>(width) * height * 4;
+    size_t block_size = format == BLOCK_FORMAT_BC1 ? 8 : 16;
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * block_size;
+}
+
+void TextureCooker::encodeBC1(const unsigned char *texels, unsigned char *block) {
+    Block texel_block;
+    loadBlock(texels, texel_block);
+    encodeColorBlock(texel_block, block);
+}
+
+void TextureCooker::encodeBC3(const unsigned char *texels, unsigned char *block) {
+    Block texel_block;
+    loadBlock(texels, texel_block);
+    encodeChannelBlock(texel_block, 3, block);
+    encodeColorBlock(texel_block, block + 8);
+}
+
+void TextureCooker::encodeBC5(const unsigned char *texels, unsigned char *block) {
+    Block texel_block;
+    loadBlock(texels, texel_block);
+    encodeChannelBlock(texel_block, 0, block);
+    encodeChannelBlock(texel_block, 1, block + 8);
+}
+
+void TextureCooker::encodeBC7(const unsigned char *texels, unsigned char *block) {
+    // Mode 6 only: one subset, RGBA endpoints of 7 bits plus a shared low bit each, 4-bit indices
+    Block texel_block;
+    loadBlock(texels, texel_block);
+    float endpoints[2][4];
+    fitEndpoints(texel_block, 4, endpoints);
+
+    unsigned int quantized[2][4], p_bits[2];
+    float decoded[2][4];
+    for (unsigned int e = 0; e < 2; ++e) {
+        float best_error = -1.0f;
+        for (unsigned int p = 0; p < 2; ++p) {
+            float error = 0.0f;
+            unsigned int candidate[4];
+            for (unsigned int c = 0; c < 4; ++c) {
+                long q = std::lround((endpoints[e][c] - static_cast<float>(p)) / 2.0f);
+                candidate[c] = static_cast<unsigned int>(std::min(std::max(q, 0L), 127L));
+                float difference = static_cast<float>((candidate[c] << 1) | p) - endpoints[e][c];
+                error += difference * difference;
+            }
+            if (best_error < 0.0f || error < best_error) {
+                best_error = error;
+                p_bits[e] = p;
+                std::copy(candidate, candidate + 4, quantized[e]);
+            }
+        }
+        for (unsigned int c = 0; c < 4; ++c)
+            decoded[e][c] = static_cast<float>((quantized[e][c] << 1) | p_bits[e]);
+    }
+
+    float t[16];
+    unsigned int indices[16];
+    interpolationFactors(texel_block, decoded[0], decoded[1], 4, t);
+    for (unsigned int i = 0; i < 16; ++i)
+        indices[i] = static_cast<unsigned int>(std::lround(t[i] * 15.0f));
+    // The first index is stored without its top bit, so it has to be below 8
+    if (indices[0] & 8) {
+        std::swap(quantized[0], quantized[1]);
+        std::swap(p_bits[0], p_bits[1]);
+        for (auto &index: indices)
+            index = 15 - index;
+    }
+
+    BitWriter writer(block);
+    writer.write(1 << 6, 7); // Mode 6
+    for (unsigned int c = 0; c < 4; ++c) {
+        writer.write(quantized[0][c], 7);
+        writer.write(quantized[1][c], 7);
+    }
+    writer.write(p_bits[0], 1);
+    writer.write(p_bits[1], 1);
+    writer.write(indices[0], 3);
+    for (unsigned int i = 1; i < 16; ++i)
+        writer.write(indices[i], 4);
+}
+
+void TextureCooker::encode(const MipChain &chain, BlockFormat format, CookedTexture &cooked,
+                           unsigned int n_threads) {
+    PROFILE_SCOPE("TextureCooker::encode");
+    cooked.internal_format = internalFormat(format);
+    cooked.width = chain.width;
+    cooked.height = chain.height;
+    if (format == BLOCK_FORMAT_RGBA8) {
+        cooked.levels = chain.levels;
+        return;
+    }
+
+    void (*encode_block)(const unsigned char *, unsigned char *) =
+            format == BLOCK_FORMAT_BC1 ? encodeBC1 : format == BLOCK_FORMAT_BC3 ? encodeBC3 :
+            format == BLOCK_FORMAT_BC5 ? encodeBC5 : encodeBC7;
+    size_t block_size = format == BLOCK_FORMAT_BC1 ? 8 : 16;
+
+    cooked.levels.clear();
+    for (unsigned int level_index = 0; level_index < chain.levels.size(); ++level_index) {
+        const vector<unsigned char> &level = chain.levels[level_index];
+        unsigned int level_width = chain.levelWidth(level_index), level_height = chain.levelHeight(level_index);
+        unsigned int blocks_x = (level_width + 3) / 4, blocks_y = (level_height + 3) / 4;
+        cooked.levels.emplace_back(levelSize(format, level_width, level_height));
+        vector<unsigned char> &encoded = cooked.levels.back();
+
+        // Rows of blocks are independent, split them into jobs
+        auto encode_rows = [&](size_t first_row, size_t end_row) {
+            unsigned char texels[64];
+            for (auto by = static_cast<unsigned int>(first_row); by < end_row; ++by) {
+                for (unsigned int bx = 0; bx < blocks_x; ++bx) {
+                    // Edge blocks of odd sized levels repeat the last row and column
+                    for (unsigned int i = 0; i < 16; ++i) {
+                        unsigned int x = std::min(bx * 4 + i % 4, level_width - 1);
+                        unsigned int y = std::min(by * 4 + i / 4, level_height - 1);
+                        std::memcpy(texels + i * 4, &level[(static_cast<size_t>(y) * level_width + x) * 4], 4);
+                    }
+                    encode_block(texels, &encoded[(static_cast<size_t>(by) * blocks_x + bx) * block_size]);
+                }
+            }
+        };
+        if (n_threads == 1) {
+            encode_rows(0, blocks_y);
+        } else {
+            size_t min_rows = n_threads > 1 ? (blocks_y + n_threads - 1) / n_threads : 1;
+            JobSystem::instance().parallelFor("TextureCooker::encodeRows", blocks_y, encode_rows, min_rows);
+        }
+    }
+}
+
+bool TextureCooker::cook(const string &path, const string &type, CookedTexture &cooked, unsigned int first_level,
+                         string *cache_file) {
+    PROFILE_SCOPE("TextureCooker::cook");
+    string file;
+    if (!cache_directory.empty()) {
+        string key = cacheKey(path, type);
+        if (!key.empty())
+            file = cache_directory + '/' + key + ".ctex";
+        if (!file.empty() && loadCached(file, cooked, first_level)) {
+            if (cache_file)
+                *cache_file = file;
+            return true;
+        }
+    }
+
+    MipChain chain;
+    bool has_alpha;
+    if (!decode(path, type, chain, has_alpha))
+        return false;
+    encode(chain, chooseFormat(type, has_alpha), cooked);
+
+    if (!file.empty() && saveCached(file, cooked)) {
+        if (cache_file)
+            *cache_file = file;
+        // The cache entry can hand out the rest later
+        for (unsigned int level = 0; level < first_level && level < cooked.levels.size(); ++level)
+            vector<unsigned char>().swap(cooked.levels[level]);
+    } else if (cache_file) {
+        cache_file->clear();
+    }
+    return true;
+}
+
+bool TextureCooker::cookUncompressed(const string &path, const string &type, CookedTexture &cooked) {
+    PROFILE_SCOPE("TextureCooker::cookUncompressed");
+    MipChain chain;
+    bool has_alpha;
+    if (!decode(path, type, chain, has_alpha))
+        return false;
+    encode(chain, BLOCK_FORMAT_RGBA8, cooked);
+    return true;
+}
+
+bool TextureCooker::decode(const string &path, const string &type, MipChain &chain, bool &has_alpha) {
+    int width, height, n_channels;
+    unsigned char *rgba;
+    {
+        PROFILE_SCOPE("stbi_load");
+        rgba = stbi_load(path.c_str(), &width, &height, &n_channels, 4);
+    }
+    if (!rgba)
+        return false;
+    has_alpha = false;
+    if (n_channels == 4 || n_channels == 2) {
+        size_t n_texels = static_cast<size_t>(width) * height;
+        for (size_t i = 0; i < n_texels && !has_alpha; ++i)
+            has_alpha = rgba[i * 4 + 3] != 255;
+    }
+    // Diffuse maps are sRGB encoded, the others hold data and are filtered as they are
+    MipGenerator(mip_filter).generate(rgba, width, height, type == "texture_diffuse", chain);
+    stbi_image_free(rgba);
+    return true;
+}
+
+bool TextureCooker::upload(const CookedTexture &cooked) {
+    PROFILE_SCOPE("TextureCooker::upload");
+    for (unsigned int level = 0; level < cooked.levels.size(); ++level)
+        uploadLevel(cooked.internal_format, cooked.width, cooked.height, level, cooked.levels[level]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<int>(cooked.levels.size()) - 1);
+    return !cooked.levels.empty() && hasLevel(0);
+}
+
+bool TextureCooker::hasLevel(unsigned int level) {
+    // A level the driver refused stays undefined, 0x0
+    int width = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, static_cast<int>(level), GL_TEXTURE_WIDTH, &width);
+    return width > 0;
+}
+
+void TextureCooker::uploadLevel(unsigned int internal_format, unsigned int width, unsigned int height,
+                                unsigned int level, const vector<unsigned char> &data) {
+    // An empty level is defined as 0x0, which hands its memory back
+    width = data.empty() ? 0 : std::max(1u, width >> level);
+    height = data.empty() ? 0 : std::max(1u, height >> level);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (internal_format == GL_RGBA8)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                     data.empty() ? nullptr : data.data());
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0,
+                               static_cast<GLsizei>(data.size()), data.empty() ? nullptr : data.data());
+}
+
+string TextureCooker::cacheKey(const string &path, const string &type) {
+    // 64-bit FNV-1a over the source identity and everything deciding the encoding. The file is not read,
+    // its size and modification time stand in for the contents
+    std::error_code error;
+    auto file_size = std::filesystem::file_size(path, error);
+    if (error)
+        return "";
+    auto modification_time = std::filesystem::last_write_time(path, error);
+    if (error)
+        return "";
+
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const string &data) {
+        for (char character: data) {
+            hash ^= static_cast<unsigned char>(character);
+            hash *= 1099511628211ull;
+        }
+        hash ^= 0xFF; // Field separator
+        hash *= 1099511628211ull;
+    };
+    mix(std::filesystem::absolute(path, error).lexically_normal().string());
+    mix(type);
+    mix(std::to_string(file_size));
+    mix(std::to_string(modification_time.time_since_epoch().count()));
+    mix(std::to_string(compression_mode));
+    mix(std::to_string(mip_filter));
+    mix(std::to_string(COOKER_VERSION));
+
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    return key;
+}
+
+bool TextureCooker::loadCached(const string &file, CookedTexture &cooked, unsigned int first_level) {
+    PROFILE_SCOPE("TextureCooker::loadCached");
+    std::ifstream cache_stream(file, std::ios::binary | std::ios::ate);
+    if (!cache_stream.is_open())
+        return false;
+    auto file_size = static_cast<uint64_t>(cache_stream.tellg());
+    cache_stream.seekg(0);
+
+    uint32_t header[6] = {};
+    cache_stream.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!cache_stream || header[0] != CACHE_MAGIC || header[1] != COOKER_VERSION || header[5] == 0)
+        return false;
+    cooked.internal_format = header[2];
+    cooked.width = header[3];
+    cooked.height = header[4];
+    cooked.levels.assign(header[5], vector<unsigned char>());
+    for (unsigned int level = 0; level < cooked.levels.size(); ++level) {
+        uint32_t size = 0;
+        cache_stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+        // Sizes from a corrupt file must not size allocations
+        if (!cache_stream || size > file_size)
+            return false;
+        if (level < first_level) {
+            cache_stream.seekg(size, std::ios::cur);
+            continue;
+        }
+        cooked.levels[level].resize(size);
+        cache_stream.read(reinterpret_cast<char *>(cooked.levels[level].data()), size);
+    }
+    return static_cast<bool>(cache_stream);
+}
+
+bool TextureCooker::readCachedLevel(const string &file, unsigned int level, vector<unsigned char> &data) {
+    std::ifstream cache_stream(file, std::ios::binary | std::ios::ate);
+    auto file_size = static_cast<uint64_t>(cache_stream.tellg());
+    cache_stream.seekg(0);
+    uint32_t header[6] = {};
+    cache_stream.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!cache_stream || header[0] != CACHE_MAGIC || header[1] != COOKER_VERSION || level >= header[5])
+        return false;
+    // Skip the levels above, their sizes are stored in front of them
+    for (unsigned int i = 0; i < level; ++i) {
+        uint32_t size = 0;
+        cache_stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+        cache_stream.seekg(size, std::ios::cur);
+    }
+    uint32_t size = 0;
+    cache_stream.read(reinterpret_cast<char *>(&size), sizeof(size));
+    if (!cache_stream || size > file_size)
+        return false;
+    data.resize(size);
+    cache_stream.read(reinterpret_cast<char *>(data.data()), size);
+    return static_cast<bool>(cache_stream);
+}
+
+bool TextureCooker::saveCached(const string &file, const CookedTexture &cooked) {
+    return writeFileAtomically(file, [&](std::ostream &cache_stream) {
+        uint32_t header[6] = {CACHE_MAGIC, COOKER_VERSION, cooked.internal_format, cooked.width, cooked.height,
+                              static_cast<uint32_t>(cooked.levels.size())};
+        cache_stream.write(reinterpret_cast<const char *>(header), sizeof(header));
+        for (auto &level: cooked.levels) {
+            auto size = static_cast<uint32_t>(level.size());
+            cache_stream.write(reinterpret_cast<const char *>(&size), sizeof(size));
+            cache_stream.write(reinterpret_cast<const char *>(level.data()), size);
+        }
+        return static_cast<bool>(cache_stream);
+    });
+}
@@ -0,0 +1,218 @@
+//
+// Created by Andrew on 5/25/2021.
+//
+
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <glad/glad.h>
+
+#include "memory_tracker.h"
+#include "profiler.h"
+
+using std::cout;
+using std::endl;
+
+TextureStreamer::TextureStreamer(size_t budget_bytes, size_t upload_bytes_per_frame) :
+        budget_bytes(budget_bytes), upload_bytes_per_frame(upload_bytes_per_frame) {}
+
+TextureStreamer::~TextureStreamer() {
+    JobSystem::instance().wait(loads);
+}
+
+size_t TextureStreamer::levelBytes(const StreamedTexture &texture, unsigned int level) const {
+    return TextureCooker::levelSize(texture.cooked.internal_format, std::max(1u, texture.cooked.width >> level),
+                                    std::max(1u, texture.cooked.height >> level));
+}
+
+void TextureStreamer::track(const StreamedTexture &texture) const {
+    MemoryUsage usage;
+    for (unsigned int level = texture.resident_level; level < texture.n_levels; ++level)
+        usage.gpu_bytes += levelBytes(texture, level);
+    for (auto &level: texture.cooked.levels)
+        usage.cpu_bytes += level.capacity();
+    MemoryTracker::instance().track(MEMORY_TEXTURE, texture.id, texture.name, usage);
+}
+
+unsigned int TextureStreamer::load(const string &path, const string &type) {
+    PROFILE_SCOPE("TextureStreamer::load");
+    StreamedTexture texture;
+    texture.name = path;
+    glGenTextures(1, &texture.id);
+    glBindTexture(GL_TEXTURE_2D, texture.id);
+    // Nothing is kept from a cache entry yet, the resident levels are picked once the size is known
+    bool uploaded = TextureCooker::cook(path, type, texture.cooked, std::numeric_limits<unsigned int>::max(),
+                                        &texture.cache_file) && uploadResident(texture);
+    if (!uploaded) {
+        texture.cache_file.clear();
+        if (!TextureCooker::cookUncompressed(path, type, texture.cooked) || !uploadResident(texture)) {
+            cout << "Texture failed to load at path: " << path << endl;
+            glBindTexture(GL_TEXTURE_2D, 0);
+            return texture.id;
+        }
+        cout << "Compressed texture failed to load, uploading uncompressed: " << path << endl;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<int>(texture.base_level));
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<int>(texture.n_levels) - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    track(texture);
+    texture_indices[texture.id] = static_cast<unsigned int>(textures.size());
+    textures.push_back(std::move(texture));
+    demand.push_back(std::numeric_limits<float>::infinity());
+    return textures.back().id;
+}
+
+bool TextureStreamer::uploadResident(StreamedTexture &texture) {
+    texture.n_levels = static_cast<unsigned int>(texture.cooked.levels.size());
+    texture.base_level = 0;
+    while (!texture.cache_file.empty() && texture.base_level + 1 < texture.n_levels &&
+           std::max(texture.cooked.width >> texture.base_level, texture.cooked.height >> texture.base_level) >
+           RESIDENT_SIZE)
+        ++texture.base_level;
+    texture.resident_level = texture.wanted_level = texture.base_level;
+    if (!texture.cache_file.empty() && !TextureCooker::loadCached(texture.cache_file, texture.cooked,
+                                                                  texture.base_level))
+        return false;
+
+    size_t bytes = 0;
+    for (unsigned int level = texture.base_level; level < texture.n_levels; ++level) {
+        TextureCooker::uploadLevel(texture.cooked.internal_format, texture.cooked.width, texture.cooked.height,
+                                   level, texture.cooked.levels[level]);
+        bytes += levelBytes(texture, level);
+    }
+    // Finer levels are read from the cache when wanted, nothing is needed in memory again
+    vector<vector<unsigned char>>(texture.n_levels).swap(texture.cooked.levels);
+    if (texture.n_levels == 0 || !TextureCooker::hasLevel(texture.base_level))
+        return false;
+    resident_bytes += bytes;
+    return true;
+}
+
+void TextureStreamer::request(unsigned int texture, float uv_per_pixel) {
+    auto it = texture_indices.find(texture);
+    if (it != texture_indices.end())
+        demand[it->second] = std::min(demand[it->second], uv_per_pixel);
+}
+
+unsigned int TextureStreamer::residentLevel(unsigned int texture) const {
+    auto it = texture_indices.find(texture);
+    return it == texture_indices.end() ? 0 : textures[it->second].resident_level;
+}
+
+void TextureStreamer::setResidentLevel(StreamedTexture &texture, unsigned int level) {
+    for (unsigned int i = texture.resident_level; i < level; ++i)
+        resident_bytes -= levelBytes(texture, i);
+    for (unsigned int i = level; i < texture.resident_level; ++i)
+        resident_bytes += levelBytes(texture, i);
+    texture.resident_level = level;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, static_cast<int>(level));
+    track(texture);
+}
+
+bool TextureStreamer::evictOne(unsigned int keep_index) {
+    // Textures unused this frame or holding finer levels than they were asked for, oldest use first
+    StreamedTexture *victim = nullptr;
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        StreamedTexture &texture = textures[i];
+        if (i == keep_index || texture.resident_level >= texture.base_level)
+            continue;
+        if (texture.resident_level >= texture.wanted_level && texture.last_used_frame == frame)
+            continue;
+        if (!victim || texture.last_used_frame < victim->last_used_frame)
+            victim = &texture;
+    }
+    if (!victim)
+        return false;
+
+    // Raising the base level stops sampling the level without respecifying the texture's storage, which
+    // would make the driver revalidate the whole texture
+    glBindTexture(GL_TEXTURE_2D, victim->id);
+    setResidentLevel(*victim, victim->resident_level + 1);
+    return true;
+}
+
+void TextureStreamer::update() {
+    PROFILE_SCOPE("TextureStreamer::update");
+    ++frame;
+
+    // Demand to wanted level: the level where one texel covers about one pixel
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        StreamedTexture &texture = textures[i];
+        if (std::isinf(demand[i])) {
+            texture.wanted_level = texture.base_level;
+            continue;
+        }
+        float texels_per_pixel = demand[i] * static_cast<float>(std::max(texture.cooked.width, texture.cooked.height));
+        float level = std::floor(std::log2(std::max(texels_per_pixel, 1.0f)));
+        texture.wanted_level = std::min(static_cast<unsigned int>(level), texture.base_level);
+        texture.last_used_frame = frame;
+        demand[i] = std::numeric_limits<float>::infinity();
+    }
+
+    // Upload finished loads, a limited amount per frame so streaming never causes a hitch
+    size_t uploaded_bytes = 0;
+    while (uploaded_bytes < upload_bytes_per_frame) {
+        LoadResult result;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (results.empty())
+                break;
+            result = std::move(results.front());
+            results.pop_front();
+        }
+        StreamedTexture &texture = textures[result.texture_index];
+        size_t bytes = levelBytes(texture, result.level);
+        texture.loading = false;
+        loading_bytes -= bytes;
+        // Evictions since the request may have made the level useless
+        if (!result.success || result.level + 1 != texture.resident_level || result.level < texture.wanted_level)
+            continue;
+        while (resident_bytes + bytes > budget_bytes && evictOne(result.texture_index)) {}
+        if (resident_bytes + bytes > budget_bytes)
+            continue;
+
+        PROFILE_SCOPE("TextureStreamer::upload");
+        glBindTexture(GL_TEXTURE_2D, texture.id);
+        TextureCooker::uploadLevel(texture.cooked.internal_format, texture.cooked.width, texture.cooked.height,
+                                   result.level, result.data);
+        setResidentLevel(texture, result.level);
+        uploaded_bytes += bytes;
+    }
+
+    // Queue the next finer level of every texture short of its demand, largest shortfall first
+    vector<unsigned int> candidates;
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+        if (!textures[i].loading && textures[i].wanted_level < textures[i].resident_level)
+            candidates.push_back(i);
+    }
+    std::sort(candidates.begin(), candidates.end(), [this](unsigned int a, unsigned int b) {
+        return textures[a].resident_level - textures[a].wanted_level >
+               textures[b].resident_level - textures[b].wanted_level;
+    });
+    for (unsigned int i: candidates) {
+        StreamedTexture &texture = textures[i];
+        unsigned int level = texture.resident_level - 1;
+        size_t bytes = levelBytes(texture, level);
+        while (resident_bytes + loading_bytes + bytes > budget_bytes && evictOne(i)) {}
+        if (resident_bytes + loading_bytes + bytes > budget_bytes)
+            continue;
+        texture.loading = true;
+        loading_bytes += bytes;
+        JobSystem::instance().run("TextureStreamer::readLevel", [this, i, level, file = texture.cache_file] {
+            LoadResult result{i, level, {}, false};
+            result.success = TextureCooker::readCachedLevel(file, level, result.data);
+            std::lock_guard<std::mutex> lock(mutex);
+            results.push_back(std::move(result));
+        }, &loads);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
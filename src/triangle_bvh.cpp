@@ -0,0 +1,228 @@
+//
+// Created by Andrew on 6/10/2021.
+//
+
+#include "triangle_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "batch_geometry.h"
+#include "job_system.h"
+#include "profiler.h"
+
+namespace {
+
+// Point of the triangle a, b, c closest to p, after Ericson's Real-Time Collision Detection
+Eigen::Vector3f closestPointOnTriangle(const Eigen::Vector3f &p, const Eigen::Vector3f &a, const Eigen::Vector3f &b,
+                                       const Eigen::Vector3f &c) {
+    Eigen::Vector3f ab = b - a, ac = c - a, ap = p - a;
+    float d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        return a;
+    Eigen::Vector3f bp = p - b;
+    float d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0.0f && d4 <= d3)
+        return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        return a + d1 / (d1 - d3) * ab;
+    Eigen::Vector3f cp = p - c;
+    float d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0.0f && d5 <= d6)
+        return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        return a + d2 / (d2 - d6) * ac;
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+        return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+}
+
+// Smaller root of a t^2 + 2 half_b t + c if it is in [0, max]. Callers pass the discriminant half_b^2 - a c,
+// which they can form without the cancellation of the direct expression
+bool lowerRoot(float a, float half_b, float c, float discriminant, float max, float &root) {
+    if (a == 0.0f || discriminant < 0.0f)
+        return false;
+    float q = -(half_b + std::copysign(std::sqrt(discriminant), half_b));
+    float r0 = q / a, r1 = q != 0.0f ? c / q : r0;
+    float lower = std::min(r0, r1);
+    if (lower < 0.0f || lower > max)
+        return false;
+    root = lower;
+    return true;
+}
+
+// Fraction of motion in [0, max] at which a sphere first touches the triangle, and where. The face is tried
+// first, then its corners and edges, as in Fauerby's Improved Collision Detection and Response
+bool sweepSphereTriangle(const Eigen::Vector3f (&corners)[3], const Eigen::Vector3f &center, float radius,
+                         const Eigen::Vector3f &motion, float max, float &fraction, Eigen::Vector3f &point) {
+    Eigen::Vector3f closest = closestPointOnTriangle(center, corners[0], corners[1], corners[2]);
+    Eigen::Vector3f away = center - closest;
+    if (away.squaredNorm() < radius * radius) {
+        // Already overlapping. Distance to a convex shape keeps growing once it starts to, so moving out is free
+        if (away.dot(motion) >= 0.0f)
+            return false;
+        fraction = 0.0f;
+        point = closest;
+        return true;
+    }
+
+    Eigen::Vector3f face = (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+    float face_norm = face.norm();
+    if (face_norm > 0.0f) {
+        Eigen::Vector3f normal = face / face_norm;
+        float distance = normal.dot(center - corners[0]);
+        if (distance < 0.0f) {
+            normal = -normal;
+            distance = -distance;
+        }
+        float approach = normal.dot(motion);
+        if (approach < 0.0f) {
+            float t = (distance - radius) / -approach;
+            Eigen::Vector3f contact = center + t * motion - radius * normal;
+            bool inside = true;
+            for (int k = 0; k < 3 && inside; ++k) {
+                const Eigen::Vector3f &from = corners[k], &to = corners[(k + 1) % 3];
+                inside = face.dot((to - from).cross(contact - from)) >= 0.0f;
+            }
+            if (inside) {
+                if (t > max)
+                    return false;
+                fraction = t;
+                point = contact;
+                return true;
+            }
+        }
+    }
+
+    bool found = false;
+    float motion_length2 = motion.squaredNorm();
+    for (const Eigen::Vector3f &corner: corners) {
+        // |center + t motion - corner| = radius, its discriminant from the distance of the corner to the line
+        Eigen::Vector3f base = corner - center;
+        float discriminant = motion_length2 * radius * radius - motion.cross(base).squaredNorm();
+        float t;
+        if (lowerRoot(motion_length2, -motion.dot(base), base.squaredNorm() - radius * radius, discriminant, max,
+                      t)) {
+            max = t;
+            fraction = t;
+            point = corner;
+            found = true;
+        }
+    }
+    for (int k = 0; k < 3; ++k) {
+        // Distance from the edge line is |edge x (center - corner)| / |edge|. Kept in cross products, nothing
+        // cancels when the sphere starts far away
+        Eigen::Vector3f edge = corners[(k + 1) % 3] - corners[k], base = corners[k] - center;
+        Eigen::Vector3f edge_cross_motion = edge.cross(motion), edge_cross_base = edge.cross(base);
+        float edge_length2 = edge.squaredNorm();
+        float triple = edge.dot(motion.cross(base));
+        float discriminant = edge_length2 * (edge_cross_motion.squaredNorm() * radius * radius - triple * triple);
+        float t;
+        if (!lowerRoot(-edge_cross_motion.squaredNorm(), edge_cross_motion.dot(edge_cross_base),
+                       edge_length2 * radius * radius - edge_cross_base.squaredNorm(), discriminant, max, t))
+            continue;
+        float along = (edge.dot(motion) * t - edge.dot(base)) / edge_length2;
+        if (along >= 0.0f && along <= 1.0f) {
+            max = t;
+            fraction = t;
+            point = corners[k] + along * edge;
+            found = true;
+        }
+    }
+    return found;
+}
+
+}
+
+void TriangleBvh::build(const TriangleSource &source) {
+    PROFILE_SCOPE("TriangleBvh::build");
+    vector<Eigen::AlignedBox3f> boxes(source.n_triangles);
+    JobSystem::instance().parallelFor("TriangleBvh::bounds", source.n_triangles, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            boxes[i] = Eigen::AlignedBox3f(source.vertex(i, 0));
+            boxes[i].extend(source.vertex(i, 1));
+            boxes[i].extend(source.vertex(i, 2));
+        }
+    }, 4096);
+    tree.build(boxes);
+}
+
+template<bool ANY_HIT>
+bool TriangleBvh::intersect(const TriangleSource &source, const Eigen::Vector3f &origin,
+                            const Eigen::Vector3f &direction, float max_distance, TriangleHit &hit) const {
+    float leaf[9][Bvh::LEAF_SIZE];
+    const float *leaf_arrays[9];
+    for (int k = 0; k < 9; ++k)
+        leaf_arrays[k] = leaf[k];
+    float distances[Bvh::LEAF_SIZE], u[Bvh::LEAF_SIZE], v[Bvh::LEAF_SIZE];
+    bool found = false;
+    tree.traverse(origin, direction, 0.0f, max_distance, [&](const unsigned int *triangles, unsigned int count,
+                                                             float &closest) {
+        for (unsigned int i = 0; i < count; ++i) {
+            Eigen::Vector3f corner = source.vertex(triangles[i], 0);
+            Eigen::Vector3f edge1 = source.vertex(triangles[i], 1) - corner;
+            Eigen::Vector3f edge2 = source.vertex(triangles[i], 2) - corner;
+            for (int a = 0; a < 3; ++a) {
+                leaf[a][i] = corner[a];
+                leaf[a + 3][i] = edge1[a];
+                leaf[a + 6][i] = edge2[a];
+            }
+        }
+        intersectTriangles(origin, direction, leaf_arrays, count, distances, u, v);
+        for (unsigned int i = 0; i < count; ++i) {
+            // Misses are infinitely far, which an unlimited query would otherwise take
+            if (distances[i] > closest || distances[i] == INFINITY)
+                continue;
+            found = true;
+            if (ANY_HIT)
+                return false;
+            closest = distances[i];
+            hit = TriangleHit{triangles[i], distances[i], u[i], v[i]};
+        }
+        return true;
+    });
+    return found;
+}
+
+bool TriangleBvh::closestHit(const TriangleSource &source, const Eigen::Vector3f &origin,
+                             const Eigen::Vector3f &direction, float max_distance, TriangleHit &hit) const {
+    return intersect<false>(source, origin, direction, max_distance, hit);
+}
+
+bool TriangleBvh::anyHit(const TriangleSource &source, const Eigen::Vector3f &origin,
+                         const Eigen::Vector3f &direction, float max_distance) const {
+    TriangleHit hit;
+    return intersect<true>(source, origin, direction, max_distance, hit);
+}
+
+bool TriangleBvh::sweepSphere(const TriangleSource &source, const Eigen::Vector3f &center, float radius,
+                              const Eigen::Vector3f &motion, float max_fraction, TriangleSweepHit &hit) const {
+    if (motion.isZero(0.0f))
+        return false;
+    bool found = false;
+    tree.traverse(center, motion, radius, max_fraction, [&](const unsigned int *triangles, unsigned int count,
+                                                            float &closest) {
+        for (unsigned int i = 0; i < count; ++i) {
+            Eigen::Vector3f corners[3] = {source.vertex(triangles[i], 0), source.vertex(triangles[i], 1),
+                                          source.vertex(triangles[i], 2)};
+            float fraction;
+            Eigen::Vector3f point;
+            if (!sweepSphereTriangle(corners, center, radius, motion, closest, fraction, point))
+                continue;
+            if (found && fraction >= hit.fraction)
+                continue;
+            closest = fraction;
+            Eigen::Vector3f away = center + fraction * motion - point;
+            // A center on the triangle has no direction to it, push back against the motion
+            Eigen::Vector3f normal = away.isZero(0.0f) ? Eigen::Vector3f(-motion.normalized()) : away.normalized();
+            hit = TriangleSweepHit{triangles[i], fraction, point, normal};
+            found = true;
+        }
+        return true;
+    });
+    return found;
+}
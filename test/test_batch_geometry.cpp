@@ -0,0 +1,289 @@
+//
+// Created by Andrew on 5/27/2021.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <Eigen/Dense>
+
+#include "batch_geometry.h"
+#include "geometry.h"
+
+#include "test_util.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using namespace Eigen;
+
+namespace {
+
+bool near(float a, float b, float tolerance) {
+    return std::fabs(a - b) <= tolerance * std::max(1.0f, std::max(std::fabs(a), std::fabs(b)));
+}
+
+// Odd counts so every vector width leaves a scalar tail
+const size_t N = 1003;
+
+Matrix4f affineTransform() {
+    Affine3f transform = Translation3f(1.5f, -2.0f, 0.25f) * AngleAxisf(0.7f, Vector3f(1, 2, 3).normalized()) *
+                         Scaling(2.0f, 0.5f, 1.25f);
+    return transform.matrix();
+}
+
+void testTransformPoints(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+    Matrix4f transform = perspective(1.0f, 16.0f / 9.0f, 0.1f, 100.0f) * affineTransform();
+    PointsSoA points;
+    points.resize(N);
+    for (size_t i = 0; i < N; ++i) {
+        points.x[i] = coordinate(random);
+        points.y[i] = coordinate(random);
+        points.z[i] = coordinate(random);
+    }
+    PointsSoA result;
+    vector<float> w;
+    transformPoints(transform, points, result, &w);
+    for (size_t i = 0; i < N; ++i) {
+        Vector4f expected = transform * Vector4f(points.x[i], points.y[i], points.z[i], 1.0f);
+        bool same = near(result.x[i], expected[0], 1e-5f) && near(result.y[i], expected[1], 1e-5f) &&
+                    near(result.z[i], expected[2], 1e-5f) && near(w[i], expected[3], 1e-5f);
+        check(same, level + " transformPoints " + std::to_string(i));
+        if (!same)
+            break;
+    }
+
+    // In place
+    transformPoints(transform, points, points);
+    check(points.x == result.x && points.y == result.y && points.z == result.z, level + " transformPoints in place");
+}
+
+void testComputeBounds(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f);
+    for (size_t n: {size_t(1), size_t(7), N}) {
+        PointsSoA points;
+        points.resize(n);
+        Vector3f expected_min = Vector3f::Constant(INFINITY), expected_max = Vector3f::Constant(-INFINITY);
+        for (size_t i = 0; i < n; ++i) {
+            Vector3f point(coordinate(random), coordinate(random), coordinate(random));
+            points.x[i] = point[0];
+            points.y[i] = point[1];
+            points.z[i] = point[2];
+            expected_min = expected_min.cwiseMin(point);
+            expected_max = expected_max.cwiseMax(point);
+        }
+        Vector3f min_corner, max_corner;
+        check(computeBounds(points, min_corner, max_corner) && min_corner == expected_min &&
+              max_corner == expected_max, level + " computeBounds " + std::to_string(n));
+    }
+    Vector3f min_corner, max_corner;
+    check(!computeBounds(PointsSoA(), min_corner, max_corner), level + " computeBounds empty");
+}
+
+void testTransformBounds(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> coordinate(-10.0f, 10.0f), size(0.0f, 5.0f);
+    Matrix4f transform = affineTransform();
+    BoundsSoA bounds;
+    bounds.resize(N);
+    for (size_t i = 0; i < N; ++i) {
+        bounds.min_x[i] = coordinate(random);
+        bounds.min_y[i] = coordinate(random);
+        bounds.min_z[i] = coordinate(random);
+        bounds.max_x[i] = bounds.min_x[i] + size(random);
+        bounds.max_y[i] = bounds.min_y[i] + size(random);
+        bounds.max_z[i] = bounds.min_z[i] + size(random);
+    }
+    BoundsSoA result;
+    transformBounds(transform, bounds, result);
+    for (size_t i = 0; i < N; ++i) {
+        // Box around the eight transformed corners
+        Vector3f expected_min = Vector3f::Constant(INFINITY), expected_max = Vector3f::Constant(-INFINITY);
+        for (int corner = 0; corner < 8; ++corner) {
+            Vector4f point(corner & 1 ? bounds.max_x[i] : bounds.min_x[i],
+                           corner & 2 ? bounds.max_y[i] : bounds.min_y[i],
+                           corner & 4 ? bounds.max_z[i] : bounds.min_z[i], 1.0f);
+            Vector3f transformed = (transform * point).head<3>();
+            expected_min = expected_min.cwiseMin(transformed);
+            expected_max = expected_max.cwiseMax(transformed);
+        }
+        bool same = near(result.min_x[i], expected_min[0], 1e-5f) && near(result.min_y[i], expected_min[1], 1e-5f) &&
+                    near(result.min_z[i], expected_min[2], 1e-5f) && near(result.max_x[i], expected_max[0], 1e-5f) &&
+                    near(result.max_y[i], expected_max[1], 1e-5f) && near(result.max_z[i], expected_max[2], 1e-5f);
+        check(same, level + " transformBounds " + std::to_string(i));
+        if (!same)
+            break;
+    }
+}
+
+void testProjectSpheres(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> coordinate(-20.0f, 20.0f), size(0.1f, 4.0f), unit(-1.0f, 1.0f);
+    const float z_near = 0.1f;
+    Matrix4f view = lookAt(Vector3f(3.0f, 2.0f, 10.0f), Vector3f(0.0f, 0.0f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f));
+    Matrix4f projection = perspective(1.0f, 16.0f / 9.0f, z_near, 100.0f);
+    SpheresSoA spheres;
+    spheres.resize(N);
+    for (size_t i = 0; i < N; ++i) {
+        spheres.x[i] = coordinate(random);
+        spheres.y[i] = coordinate(random);
+        spheres.z[i] = coordinate(random);
+        spheres.radius[i] = size(random);
+    }
+    ScreenRectsSoA rects;
+    projectSpheres(view, projection, spheres, rects);
+
+    Matrix4f view_projection = projection * view;
+    size_t n_projected = 0;
+    for (size_t i = 0; i < N; ++i) {
+        Vector3f center(spheres.x[i], spheres.y[i], spheres.z[i]);
+        float radius = spheres.radius[i];
+        float depth = -(view * center.homogeneous())[2];
+        SphereVisibility expected = depth + radius <= z_near ? SPHERE_BEHIND
+                                  : depth - radius <= z_near ? SPHERE_CLIPPED : SPHERE_PROJECTED;
+        check(rects.visibility[i] == expected, level + " projectSpheres visibility " + std::to_string(i));
+        if (expected != SPHERE_PROJECTED)
+            continue;
+        // Sampling is slow, a subset is enough
+        if (n_projected++ % 8 != 0)
+            continue;
+
+        // Project points sampled on the sphere: all inside the rect, and reaching close to its edges
+        float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+        bool inside = true;
+        for (int sample = 0; sample < 2000; ++sample) {
+            Vector3f direction(unit(random), unit(random), unit(random));
+            if (direction.squaredNorm() < 1e-4f)
+                continue;
+            Vector4f clip = view_projection * (center + radius * direction.normalized()).homogeneous();
+            float x = clip[0] / clip[3], y = clip[1] / clip[3];
+            float slack = 1e-4f * std::max(1.0f, std::max(std::fabs(x), std::fabs(y)));
+            inside = inside && x >= rects.min_x[i] - slack && x <= rects.max_x[i] + slack &&
+                     y >= rects.min_y[i] - slack && y <= rects.max_y[i] + slack;
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+        }
+        float tolerance = 0.05f * std::max(rects.max_x[i] - rects.min_x[i], rects.max_y[i] - rects.min_y[i]);
+        bool tight = min_x - rects.min_x[i] <= tolerance && rects.max_x[i] - max_x <= tolerance &&
+                     min_y - rects.min_y[i] <= tolerance && rects.max_y[i] - max_y <= tolerance;
+        check(inside && tight, level + " projectSpheres rect " + std::to_string(i));
+    }
+    check(n_projected > N / 4, level + " projectSpheres has projected spheres");
+}
+
+// Reference: Moller and Trumbore in Eigen. Also returns how close the hit is to going either way: the distance
+// of the barycentrics to an edge, or a small determinant for rays almost parallel to the triangle
+bool referenceIntersect(const Vector3f &origin, const Vector3f &direction, const Vector3f &corner,
+                        const Vector3f &edge1, const Vector3f &edge2, float &t, float &u, float &v, bool &borderline) {
+    Vector3f p = direction.cross(edge2);
+    float determinant = edge1.dot(p);
+    Vector3f s = origin - corner;
+    Vector3f q = s.cross(edge1);
+    u = s.dot(p) / determinant;
+    v = direction.dot(q) / determinant;
+    t = edge2.dot(q) / determinant;
+    float edge_distance = std::min({std::fabs(u), std::fabs(v), std::fabs(1.0f - u - v), std::fabs(t)});
+    borderline = std::fabs(determinant) < 1e-4f || edge_distance < 1e-4f;
+    return t >= 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f;
+}
+
+void testIntersectTriangles(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> coordinate(-5.0f, 5.0f), unit(-1.0f, 1.0f);
+    vector<float> arrays[9];
+    for (auto &array: arrays)
+        array.resize(N);
+    for (size_t i = 0; i < N; ++i) {
+        for (int a = 0; a < 3; ++a) {
+            arrays[a][i] = coordinate(random);
+            arrays[a + 3][i] = 2.0f * unit(random);
+            arrays[a + 6][i] = 2.0f * unit(random);
+        }
+    }
+    // A degenerate triangle never hits
+    for (int a = 3; a < 9; ++a)
+        arrays[a][0] = 0.0f;
+    const float *triangles[9];
+    for (int k = 0; k < 9; ++k)
+        triangles[k] = arrays[k].data();
+
+    vector<float> distance(N), u(N), v(N);
+    size_t n_hits = 0;
+    for (int r = 0; r < 16; ++r) {
+        Vector3f origin(coordinate(random), coordinate(random), coordinate(random));
+        Vector3f direction = Vector3f(unit(random), unit(random), unit(random)).normalized();
+        intersectTriangles(origin, direction, triangles, N, distance.data(), u.data(), v.data());
+        for (size_t i = 0; i < N; ++i) {
+            Vector3f corner(arrays[0][i], arrays[1][i], arrays[2][i]);
+            Vector3f edge1(arrays[3][i], arrays[4][i], arrays[5][i]), edge2(arrays[6][i], arrays[7][i], arrays[8][i]);
+            float t, expected_u, expected_v;
+            bool borderline;
+            bool expected = referenceIntersect(origin, direction, corner, edge1, edge2, t, expected_u, expected_v,
+                                               borderline);
+            // Rounding decides those
+            if (borderline && i != 0)
+                continue;
+            bool hit = std::isfinite(distance[i]);
+            bool same = hit == expected && (!hit || (near(distance[i], t, 1e-3f) && near(u[i], expected_u, 1e-3f) &&
+                                                     near(v[i], expected_v, 1e-3f)));
+            check(same, level + " intersectTriangles " + std::to_string(r) + " " + std::to_string(i));
+            if (!same)
+                return;
+            n_hits += hit;
+        }
+        check(!std::isfinite(distance[0]), level + " intersectTriangles degenerate");
+    }
+    check(n_hits > 0, level + " intersectTriangles has hits");
+}
+
+void testProjectChannels(std::mt19937 &random, const string &level) {
+    std::uniform_real_distribution<float> value(0.0f, 255.0f), unit(-1.0f, 1.0f);
+    std::vector<float> channels[4];
+    for (auto &channel: channels) {
+        channel.resize(N);
+        for (auto &v: channel)
+            v = value(random);
+    }
+    float origin[4], direction[4];
+    for (int c = 0; c < 4; ++c) {
+        origin[c] = value(random);
+        direction[c] = unit(random);
+    }
+    const float *in[4] = {channels[0].data(), channels[1].data(), channels[2].data(), channels[3].data()};
+    std::vector<float> result(N);
+    projectChannels(in, origin, direction, N, result.data());
+    for (size_t i = 0; i < N; ++i) {
+        float expected = 0.0f;
+        for (int c = 0; c < 4; ++c)
+            expected += (channels[c][i] - origin[c]) * direction[c];
+        if (!near(result[i], expected, 1e-4f)) {
+            check(false, level + " projectChannels " + std::to_string(i));
+            return;
+        }
+    }
+}
+
+}
+
+int main() {
+    SimdLevel detected = detectSimdLevel();
+    cout << "Detected " << simdLevelName(detected) << endl;
+    for (SimdLevel level: {SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_NEON}) {
+        if (!setSimdLevel(level))
+            continue;
+        string name = simdLevelName(level);
+        std::mt19937 random(42);
+        testTransformPoints(random, name);
+        testComputeBounds(random, name);
+        testTransformBounds(random, name);
+        testProjectSpheres(random, name);
+        testIntersectTriangles(random, name);
+        testProjectChannels(random, name);
+        cout << name << " done" << endl;
+    }
+    setSimdLevel(detected);
+    return testResult();
+}
@@ -0,0 +1,122 @@
+//
+// Created by Andrew on 6/8/2021.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+
+#include "test_util.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+
+namespace {
+
+void testParallelFor(const string &mode) {
+    JobSystem &jobs = JobSystem::instance();
+    for (size_t n: {size_t(1), size_t(7), size_t(100003)}) {
+        vector<int> visits(n, 0);
+        jobs.parallelFor("test", n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                ++visits[i];
+        });
+        bool once = std::all_of(visits.begin(), visits.end(), [](int count) { return count == 1; });
+        check(once, mode + " parallelFor visits every index once, n = " + std::to_string(n));
+    }
+}
+
+// Jobs that queue jobs and wait on them, so waiting threads have to run other jobs to make progress
+long long treeSum(long long begin, long long end) {
+    if (end - begin <= 1000)
+        return (begin + end - 1) * (end - begin) / 2;
+    long long middle = (begin + end) / 2, left = 0;
+    JobCounter counter;
+    JobSystem::instance().run("treeSum", [&] { left = treeSum(begin, middle); }, &counter);
+    long long right = treeSum(middle, end);
+    JobSystem::instance().wait(counter);
+    return left + right;
+}
+
+void testNested(const string &mode) {
+    check(treeSum(0, 1000000) == 999999LL * 1000000 / 2, mode + " nested jobs");
+}
+
+void testDependencies(const string &mode) {
+    JobSystem &jobs = JobSystem::instance();
+    JobCounter first, second;
+    std::atomic<int> n_first{0};
+    std::atomic<bool> ordered{true};
+    for (int i = 0; i < 16; ++i) {
+        jobs.run("first", [&] {
+            std::this_thread::yield();
+            ++n_first;
+        }, &first);
+    }
+    for (int i = 0; i < 4; ++i) {
+        jobs.run("second", [&] {
+            if (n_first.load() != 16)
+                ordered = false;
+        }, &second, &first);
+    }
+    jobs.wait(second);
+    check(ordered && n_first == 16 && first.pending() == 0, mode + " dependent jobs run after their dependency");
+}
+
+void testMainThread(const string &mode) {
+    JobSystem &jobs = JobSystem::instance();
+    JobCounter counter;
+    std::thread::id main_id = std::this_thread::get_id();
+    std::atomic<bool> on_main{true};
+    // Queued from a job, the way a worker hands GL work back
+    jobs.run("queue", [&] {
+        for (int i = 0; i < 8; ++i) {
+            jobs.runOnMainThread("main", [&] {
+                if (std::this_thread::get_id() != main_id)
+                    on_main = false;
+            }, &counter);
+        }
+    }, &counter);
+    jobs.wait(counter);
+    check(on_main, mode + " main thread jobs run on the main thread");
+
+    // Without waiting, the frame boundary pump runs them
+    bool pumped = false;
+    jobs.runOnMainThread("pumped", [&] { pumped = true; });
+    jobs.pumpMainThread();
+    check(pumped, mode + " pumpMainThread runs queued main thread jobs");
+}
+
+void runAll(const string &mode) {
+    testParallelFor(mode);
+    testNested(mode);
+    testDependencies(mode);
+    testMainThread(mode);
+}
+
+}
+
+int main() {
+    // Without workers everything runs inline
+    runAll("inline");
+
+    std::atomic<int> observed{0};
+    JobSystem::instance().setObserver([&](const char *, uint64_t begin_ns, uint64_t end_ns) {
+        if (end_ns >= begin_ns)
+            ++observed;
+    });
+    JobSystem::instance().start(3);
+    runAll("3 workers");
+    JobSystem::instance().stop();
+    check(observed > 0, "observer sees jobs");
+    cout << observed << " jobs observed" << endl;
+
+    return testResult();
+}
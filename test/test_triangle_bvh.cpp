@@ -0,0 +1,248 @@
+//
+// Created by Andrew on 6/10/2021.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "geometry.h"
+#include "job_system.h"
+#include "triangle_bvh.h"
+
+#include "test_util.h"
+
+using std::string;
+using std::vector;
+using namespace Eigen;
+
+namespace {
+
+// Small triangles scattered through a box, with shared vertices so indexing is exercised
+struct Soup {
+    vector<float> positions;
+    vector<unsigned int> indices;
+
+    TriangleSource source() const {
+        TriangleSource source;
+        source.positions = positions.data();
+        source.indices = indices.data();
+        source.n_triangles = indices.size() / 3;
+        return source;
+    }
+};
+
+Soup makeSoup(std::mt19937 &random, unsigned int n_triangles) {
+    std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f), offset(-1.0f, 1.0f);
+    Soup soup;
+    for (unsigned int i = 0; i < n_triangles; ++i) {
+        Vector3f center(coordinate(random), coordinate(random), coordinate(random));
+        for (int corner = 0; corner < 3; ++corner) {
+            for (int a = 0; a < 3; ++a)
+                soup.positions.push_back(center[a] + offset(random));
+        }
+        for (int corner = 0; corner < 3; ++corner)
+            soup.indices.push_back(i * 3 + corner);
+    }
+    // One triangle reusing vertices of others
+    soup.indices.insert(soup.indices.end(), {0, 4, 8});
+    return soup;
+}
+
+// Brute force over every triangle, the same intersection test the BVH leaves use
+bool bruteForceClosest(const Soup &soup, const Vector3f &origin, const Vector3f &direction, TriangleHit &hit) {
+    TriangleSource source = soup.source();
+    bool found = false;
+    hit.distance = INFINITY;
+    for (unsigned int i = 0; i < source.n_triangles; ++i) {
+        Vector3f corner = source.vertex(i, 0);
+        Vector3f edge1 = source.vertex(i, 1) - corner, edge2 = source.vertex(i, 2) - corner;
+        Vector3f p = direction.cross(edge2);
+        float determinant = edge1.dot(p);
+        Vector3f s = origin - corner;
+        Vector3f q = s.cross(edge1);
+        float u = s.dot(p) / determinant, v = direction.dot(q) / determinant, t = edge2.dot(q) / determinant;
+        if (t >= 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t < hit.distance) {
+            hit = TriangleHit{i, t, u, v};
+            found = true;
+        }
+    }
+    return found;
+}
+
+void testQueries(const Soup &soup, const TriangleBvh &bvh, std::mt19937 &random, int n_rays, const string &mode) {
+    std::uniform_real_distribution<float> coordinate(-60.0f, 60.0f), unit(-1.0f, 1.0f);
+    TriangleSource source = soup.source();
+    unsigned int n_hits = 0;
+    for (int r = 0; r < n_rays; ++r) {
+        Vector3f origin(coordinate(random), coordinate(random), coordinate(random));
+        // Aimed at the soup so most rays hit something
+        Vector3f target(unit(random) * 40.0f, unit(random) * 40.0f, unit(random) * 40.0f);
+        Vector3f direction = (target - origin).normalized();
+        TriangleHit expected, hit;
+        bool expected_found = bruteForceClosest(soup, origin, direction, expected);
+        bool found = bvh.closestHit(source, origin, direction, INFINITY, hit);
+        // Ties at shared edges may pick either triangle, the distance must agree
+        float tolerance = 1e-4f * std::max(1.0f, expected.distance);
+        bool same = found == expected_found && (!found || std::fabs(hit.distance - expected.distance) <= tolerance);
+        check(same, mode + " closestHit " + std::to_string(r));
+        check(bvh.anyHit(source, origin, direction, INFINITY) == expected_found, mode + " anyHit " + std::to_string(r));
+        if (expected_found) {
+            ++n_hits;
+            // Nothing before the closest hit, and it is found again with a limit just past it
+            check(!bvh.anyHit(source, origin, direction, expected.distance * 0.999f),
+                  mode + " anyHit before closest " + std::to_string(r));
+            check(bvh.closestHit(source, origin, direction, expected.distance * 1.001f, hit),
+                  mode + " closestHit within limit " + std::to_string(r));
+        }
+    }
+    check(n_hits > 0, mode + " rays hit");
+}
+
+bool nearlyEqual(const Vector3f &a, const Vector3f &b) {
+    return (a - b).norm() < 1e-4f;
+}
+
+// Sweeps whose first contact is known: the face, an edge and a corner of one triangle, and a wall
+void testSweepContacts() {
+    Soup soup;
+    soup.positions = {0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+                      -10.0f, -10.0f, 5.0f, 10.0f, -10.0f, 5.0f, 10.0f, 10.0f, 5.0f, -10.0f, 10.0f, 5.0f};
+    soup.indices = {0, 1, 2, 3, 4, 5, 3, 5, 6};
+    TriangleBvh bvh;
+    bvh.build(soup.source());
+    TriangleSource source = soup.source();
+    TriangleSweepHit hit;
+
+    check(bvh.sweepSphere(source, Vector3f(0.2f, 0.2f, -2.0f), 0.5f, Vector3f(0.0f, 0.0f, 4.0f), 1.0f, hit) &&
+          hit.triangle == 0 && std::fabs(hit.fraction - 0.375f) < 1e-5f &&
+          nearlyEqual(hit.normal, -Vector3f::UnitZ()) && nearlyEqual(hit.point, Vector3f(0.2f, 0.2f, 0.0f)),
+          "sweep face");
+    check(bvh.sweepSphere(source, Vector3f(0.5f, -2.0f, 0.0f), 0.5f, Vector3f(0.0f, 4.0f, 0.0f), 1.0f, hit) &&
+          std::fabs(hit.fraction - 0.375f) < 1e-5f && nearlyEqual(hit.normal, -Vector3f::UnitY()) &&
+          nearlyEqual(hit.point, Vector3f(0.5f, 0.0f, 0.0f)), "sweep edge");
+    float corner_fraction = 1.0f - 0.5f / std::sqrt(8.0f);
+    check(bvh.sweepSphere(source, Vector3f(-2.0f, -2.0f, 0.0f), 0.5f, Vector3f(2.0f, 2.0f, 0.0f), 1.0f, hit) &&
+          std::fabs(hit.fraction - corner_fraction) < 1e-5f && nearlyEqual(hit.point, Vector3f::Zero()),
+          "sweep corner");
+    check(!bvh.sweepSphere(source, Vector3f(0.5f, -2.0f, 0.0f), 0.5f, Vector3f(0.0f, 4.0f, 0.0f), 0.3f, hit),
+          "sweep beyond max fraction");
+    check(!bvh.sweepSphere(source, Vector3f(3.0f, 3.0f, -2.0f), 0.5f, Vector3f(0.0f, 0.0f, 4.0f), 1.0f, hit),
+          "sweep past");
+
+    // The wall is two triangles, either may be touched first at its shared edge
+    check(bvh.sweepSphere(source, Vector3f(0.0f, 0.0f, 2.0f), 1.0f, Vector3f(0.0f, 0.0f, 6.0f), 1.0f, hit) &&
+          hit.triangle > 0 && std::fabs(hit.fraction - 2.0f / 6.0f) < 1e-5f &&
+          nearlyEqual(hit.normal, -Vector3f::UnitZ()), "sweep wall");
+    // Overlapping the wall: stopped at once going in, free going out or along it
+    check(bvh.sweepSphere(source, Vector3f(3.0f, 3.0f, 4.5f), 1.0f, Vector3f(0.0f, 0.0f, 1.0f), 1.0f, hit) &&
+          hit.fraction == 0.0f, "sweep further into overlap");
+    check(!bvh.sweepSphere(source, Vector3f(3.0f, 3.0f, 4.5f), 1.0f, Vector3f(0.0f, 0.0f, -1.0f), 1.0f, hit),
+          "sweep out of overlap");
+    check(!bvh.sweepSphere(source, Vector3f(3.0f, 3.0f, 4.5f), 1.0f, Vector3f(1.0f, 0.0f, 0.0f), 1.0f, hit),
+          "sweep along overlap");
+}
+
+// Random sweeps through a soup agree with sweeping every triangle on its own
+void testSweepQueries(const Soup &soup, const TriangleBvh &bvh, std::mt19937 &random, const string &mode) {
+    TriangleSource source = soup.source();
+    vector<TriangleBvh> single(source.n_triangles);
+    vector<TriangleSource> single_sources(source.n_triangles, source);
+    for (unsigned int i = 0; i < source.n_triangles; ++i) {
+        single_sources[i].indices = source.indices + i * 3;
+        single_sources[i].n_triangles = 1;
+        single[i].build(single_sources[i]);
+    }
+    std::uniform_real_distribution<float> coordinate(-60.0f, 60.0f), unit(-1.0f, 1.0f), radius(0.1f, 3.0f);
+    unsigned int n_hits = 0;
+    for (int r = 0; r < 100; ++r) {
+        Vector3f center(coordinate(random), coordinate(random), coordinate(random));
+        Vector3f target(unit(random) * 40.0f, unit(random) * 40.0f, unit(random) * 40.0f);
+        float sphere_radius = radius(random);
+        Vector3f motion = target - center;
+        TriangleSweepHit expected, hit;
+        bool expected_found = false;
+        for (unsigned int i = 0; i < source.n_triangles; ++i) {
+            TriangleSweepHit single_hit;
+            float limit = expected_found ? expected.fraction : 1.0f;
+            if (single[i].sweepSphere(single_sources[i], center, sphere_radius, motion, limit, single_hit)) {
+                expected = single_hit;
+                expected_found = true;
+            }
+        }
+        bool found = bvh.sweepSphere(source, center, sphere_radius, motion, 1.0f, hit);
+        check(found == expected_found && (!found || std::fabs(hit.fraction - expected.fraction) < 1e-5f),
+              mode + " sweepSphere " + std::to_string(r));
+        if (found) {
+            ++n_hits;
+            Vector3f contact_center = center + hit.fraction * motion;
+            check(std::fabs((contact_center - hit.point).norm() - sphere_radius) < 1e-3f * sphere_radius ||
+                  hit.fraction == 0.0f, mode + " sweepSphere contact " + std::to_string(r));
+        }
+    }
+    check(n_hits > 0, mode + " sweeps hit");
+}
+
+void testBvh(const string &mode) {
+    std::mt19937 random(7);
+    // Large enough for subtrees to be built as jobs
+    Soup soup = makeSoup(random, 20000);
+    TriangleBvh bvh;
+    bvh.build(soup.source());
+    Vector3f min_corner, max_corner;
+    check(bvh.bounds(min_corner, max_corner) && (min_corner.array() >= -51.0f).all() &&
+          (max_corner.array() <= 51.0f).all(), mode + " bounds");
+    // Brute force is slow on this many
+    testQueries(soup, bvh, random, 20, mode);
+
+    // A few triangles make a single leaf
+    Soup small = makeSoup(random, 3);
+    TriangleBvh small_bvh;
+    small_bvh.build(small.source());
+    testQueries(small, small_bvh, random, 200, mode + " small");
+
+    Soup medium = makeSoup(random, 1000);
+    TriangleBvh medium_bvh;
+    medium_bvh.build(medium.source());
+    testQueries(medium, medium_bvh, random, 200, mode + " medium");
+    testSweepQueries(medium, medium_bvh, random, mode + " medium");
+
+    TriangleBvh empty;
+    empty.build(TriangleSource());
+    TriangleHit hit;
+    check(empty.empty() && !empty.closestHit(TriangleSource(), Vector3f::Zero(), Vector3f::UnitZ(), INFINITY, hit),
+          mode + " empty");
+}
+
+// A ray through the pixel a point projects to passes through that point
+void testScreenRay() {
+    Matrix4f view = lookAt(Vector3f(3.0f, 2.0f, 10.0f), Vector3f(0.0f, 0.5f, 0.0f), Vector3f(0.0f, 1.0f, 0.0f));
+    Matrix4f projection = perspective(0.8f, 16.0f / 9.0f, 0.1f, 100.0f);
+    const float width = 1920.0f, height = 1080.0f;
+    Vector3f point(0.5f, 1.0f, -2.0f);
+    Vector4f clip = projection * view * point.homogeneous();
+    float x = (clip[0] / clip[3] + 1.0f) / 2.0f * width, y = (1.0f - clip[1] / clip[3]) / 2.0f * height;
+    Ray ray = screenRay(view, projection, x, y, width, height);
+    Vector3f to_point = point - ray.origin;
+    check(std::fabs(ray.direction.norm() - 1.0f) < 1e-5f, "screenRay direction is unit length");
+    check((to_point - to_point.dot(ray.direction) * ray.direction).norm() < 1e-3f, "screenRay passes the point");
+    check(to_point.dot(ray.direction) > 0.0f, "screenRay points away from the camera");
+}
+
+}
+
+int main() {
+    testScreenRay();
+    testSweepContacts();
+    // Without workers the build runs inline
+    testBvh("inline");
+    JobSystem::instance().start(3);
+    testBvh("3 workers");
+    JobSystem::instance().stop();
+
+    return testResult();
+}
@@ -0,0 +1,29 @@
+//
+// Created by Andrew on 6/12/2021.
+//
+
+#ifndef EMPTYGL_TEST_UTIL_H
+#define EMPTYGL_TEST_UTIL_H
+
+#include <iostream>
+#include <string>
+
+// Checks shared by the test executables. Failures are printed and counted, main returns testResult()
+
+inline int failures = 0;
+
+inline void check(bool condition, const std::string &what) {
+    if (!condition) {
+        std::cout << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+// Exit code of a test executable
+inline int testResult() {
+    if (failures > 0)
+        std::cout << failures << " failures" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
+
+#endif //EMPTYGL_TEST_UTIL_H